@@ -0,0 +1,883 @@
+/*-------------------------------------------------------------------------
+ *
+ * batch.c
+ *	  import of more documents by batches
+ *
+ * When the input is split to more documents, then the documents are
+ * imported by batches. Without COPY the command is prepared once, and
+ * executed for every document inside transaction. With COPY the
+ * documents are rows of one COPY command. Every batch is committed.
+ *
+ * The ids of documents can be taken from sequence by blocks before start
+ * of batch, and passed as second parameter (or column of COPY), so the
+ * command doesn't need RETURNING for linking documents with other rows.
+ *
+ * The documents can be validated against schema before import, the
+ * invalid documents are rejected.
+ *
+ * The hash of canonical form of document can be passed as parameter after
+ * values of headers, and it is used instead of document by lookups of
+ * already imported documents. The lookups don't see not committed batch,
+ * so the hashes of documents of current batch are held in memory, and the
+ * batch is committed before the lookup of document that can be in it.
+ *
+ * IDENTIFICATION
+ *   batch.c
+ *
+ *-------------------------------------------------------------------------
+ */
+#include "postgres_fe.h"
+
+#include "pgimportdoc.h"
+
+#if PG_VERSION_NUM >= 110000
+
+#include "catalog/pg_type_d.h"
+
+#else
+
+#include "catalog/pg_type.h"
+
+#endif
+
+#define BATCH_STMT_NAME		"pgimportdoc"
+#define MAX_BATCH_PARAMS	64
+
+/* size of header of binary one dimensional array */
+#define LO_ARRAY_HEADER_SIZE	20
+
+/* the array of documents has to be less than 1GB on server side */
+#define LO_ARRAY_LIMIT			(256 * 1024 * 1024)
+
+/*
+ * Execute command without result, returns -1 on error
+ */
+static int
+batch_exec(BatchImporter *bi, const char *command)
+{
+	PGresult   *result;
+	ExecStatusType status;
+
+	result = PQexec(bi->conn, command);
+	status = PQresultStatus(result);
+
+	if (status != PGRES_COMMAND_OK)
+	{
+		fprintf(stderr, "%s: Unexpected result status: %s\n",
+				bi->param->progname, PQresStatus(status));
+		fprintf(stderr, "%s: Error: %s\n",
+				bi->param->progname, PQresultErrorMessage(result));
+		PQclear(result);
+		return -1;
+	}
+
+	PQclear(result);
+
+	return 0;
+}
+
+/*
+ * Start transaction or COPY command
+ */
+static int
+batch_start(BatchImporter *bi)
+{
+	if (bi->use_copy)
+	{
+		PGresult   *result;
+		ExecStatusType status;
+
+		result = PQexec(bi->conn, bi->param->command);
+		status = PQresultStatus(result);
+
+		if (status != PGRES_COPY_IN)
+		{
+			fprintf(stderr, "%s: Unexpected result status: %s\n",
+					bi->param->progname, PQresStatus(status));
+			fprintf(stderr, "%s: Error: %s\n",
+					bi->param->progname, PQresultErrorMessage(result));
+			PQclear(result);
+			return -1;
+		}
+
+		if (PQbinaryTuples(result))
+		{
+			fprintf(stderr, "%s: only text format of COPY is supported\n",
+					bi->param->progname);
+			PQclear(result);
+			PQputCopyEnd(bi->conn, "binary format is not supported by pgimportdoc");
+			PQclear(PQgetResult(bi->conn));
+			return -1;
+		}
+
+		PQclear(result);
+	}
+	else if (batch_exec(bi, "BEGIN") != 0)
+		return -1;
+
+	bi->in_batch = true;
+	bi->batch_docs = 0;
+
+	return 0;
+}
+
+/*
+ * Ensure there are ids for full batch. The ids are fetched by one query
+ * before start of batch, because no query can be executed during COPY.
+ */
+static int
+batch_reserve_ids(BatchImporter *bi)
+{
+	const struct _param *param = bi->param;
+	const char *values[2];
+	char		count[32];
+	PGresult   *result;
+	int			navail = bi->nids - bi->next_id;
+	int			i;
+
+	if (navail >= param->batch_size)
+		return 0;
+
+	memmove(bi->ids, bi->ids + bi->next_id, navail * sizeof(int64));
+	bi->nids = navail;
+	bi->next_id = 0;
+
+	snprintf(count, sizeof(count), "%d", param->batch_size - navail);
+	values[0] = param->sequence;
+	values[1] = count;
+
+	result = PQexecParams(bi->conn,
+						  "SELECT pg_catalog.nextval($1::regclass)"
+						  "  FROM pg_catalog.generate_series(1, $2::int)",
+						  2, NULL, values, NULL, NULL, 0);
+
+	if (PQresultStatus(result) != PGRES_TUPLES_OK)
+	{
+		fprintf(stderr, "%s: Unexpected result status: %s\n",
+				param->progname, PQresStatus(PQresultStatus(result)));
+		fprintf(stderr, "%s: Error: %s\n",
+				param->progname, PQresultErrorMessage(result));
+		PQclear(result);
+		return -1;
+	}
+
+	for (i = 0; i < PQntuples(result); i++)
+		bi->ids[bi->nids++] = (int64) strtoll(PQgetvalue(result, i, 0), NULL, 10);
+
+	PQclear(result);
+
+	if (param->verbose)
+		fprintf(stdout, "Reserved %d ids from sequence %s\n",
+				param->batch_size - navail, param->sequence);
+
+	return 0;
+}
+
+/*
+ * FNV-1a hash of document (or of its canonical hash). Zero is used for
+ * empty slots.
+ */
+static uint64
+batch_key(const char *data, size_t len)
+{
+	uint64		h = UINT64CONST(0xcbf29ce484222325);
+	size_t		i;
+
+	for (i = 0; i < len; i++)
+	{
+		h ^= (unsigned char) data[i];
+		h *= UINT64CONST(0x100000001b3);
+	}
+
+	return h != 0 ? h : 1;
+}
+
+/*
+ * Returns true, when the key of some document of current batch is same.
+ * The false positive only commits the batch early.
+ */
+static bool
+batch_key_exists(BatchImporter *bi, uint64 key)
+{
+	int			mask = bi->nbatch_keys - 1;
+	int			i = (int) (key & mask);
+
+	while (bi->batch_keys[i] != 0)
+	{
+		if (bi->batch_keys[i] == key)
+			return true;
+
+		i = (i + 1) & mask;
+	}
+
+	return false;
+}
+
+static void
+batch_key_add(BatchImporter *bi, uint64 key)
+{
+	int			mask = bi->nbatch_keys - 1;
+	int			i = (int) (key & mask);
+
+	while (bi->batch_keys[i] != 0 && bi->batch_keys[i] != key)
+		i = (i + 1) & mask;
+
+	bi->batch_keys[i] = key;
+}
+
+/*
+ * Commit current batch
+ */
+static int
+batch_commit(BatchImporter *bi)
+{
+	bi->in_batch = false;
+
+	if (bi->use_copy)
+	{
+		PGresult   *result;
+		ExecStatusType status;
+		int			rc = 0;
+
+		if (PQputCopyEnd(bi->conn, NULL) != 1)
+		{
+			fprintf(stderr, "%s: Error: %s\n",
+					bi->param->progname, PQerrorMessage(bi->conn));
+			return -1;
+		}
+
+		while ((result = PQgetResult(bi->conn)) != NULL)
+		{
+			status = PQresultStatus(result);
+
+			if (status != PGRES_COMMAND_OK)
+			{
+				fprintf(stderr, "%s: Unexpected result status: %s\n",
+						bi->param->progname, PQresStatus(status));
+				fprintf(stderr, "%s: Error: %s\n",
+						bi->param->progname, PQresultErrorMessage(result));
+				rc = -1;
+			}
+
+			PQclear(result);
+		}
+
+		if (rc != 0)
+			return -1;
+
+		/* the large objects are created in transaction around COPY */
+		if (bi->param->large_objects && batch_exec(bi, "COMMIT") != 0)
+			return -1;
+	}
+	else if (batch_exec(bi, "COMMIT") != 0)
+		return -1;
+
+	if (bi->param->verbose)
+		fprintf(stdout, "Committed batch of %d documents\n", bi->batch_docs);
+
+	/* the lookups should see this batch */
+	if (bi->param->skip_existing != NULL)
+	{
+		memset(bi->batch_keys, 0, bi->nbatch_keys * sizeof(uint64));
+		return lookup_sync(&bi->lookup);
+	}
+
+	return 0;
+}
+
+/*
+ * Initialize importer. The command is prepared when COPY is not used.
+ */
+int
+batch_begin(BatchImporter *bi, PGconn *conn,
+			const struct _param * param, int nparams)
+{
+	int			lookup_nparams = nparams;
+
+	memset(bi, 0, sizeof(BatchImporter));
+
+	/*
+	 * The id is second parameter, the hash of canonical form follows the
+	 * values of headers, the name of codec is last parameter.
+	 */
+	if (param->sequence != NULL)
+		nparams += 1;
+	if (param->canonical_hash != CANONICAL_NONE)
+		nparams += 1;
+	if (param->compress != COMPRESS_OFF)
+		nparams += 1;
+
+	bi->conn = conn;
+	bi->param = param;
+	bi->nparams = nparams;
+	bi->use_copy = is_copy_command(param->command);
+	initPQExpBuffer(&bi->compressed);
+
+	if (param->sequence != NULL)
+		bi->ids = pg_malloc(param->batch_size * sizeof(int64));
+
+	if (param->canonical_hash != CANONICAL_NONE)
+		bi->canon = canon_create(param);
+
+	if (param->large_objects)
+	{
+		initPQExpBuffer(&bi->lo_array);
+		bi->lo_doclens = pg_malloc(param->batch_size * sizeof(size_t));
+		bi->lo_values = pg_malloc0(param->batch_size * nparams * sizeof(char *));
+	}
+
+	if (param->schema != NULL)
+	{
+		bi->validator = schema_validator_create(param);
+		if (!bi->validator)
+			return -1;
+	}
+
+	/* the lookup gets the document and additional parameters */
+	if (param->skip_existing != NULL)
+	{
+		/* the hash table of documents of batch is filled to half at most */
+		bi->nbatch_keys = 1;
+		while (bi->nbatch_keys < 2 * param->batch_size)
+			bi->nbatch_keys *= 2;
+		bi->batch_keys = pg_malloc0(bi->nbatch_keys * sizeof(uint64));
+
+		if (lookup_begin(&bi->lookup, conn, param, lookup_nparams) != 0)
+			return -1;
+	}
+
+	if (nparams > MAX_BATCH_PARAMS)
+	{
+		fprintf(stderr, "%s: too much parameters (maximum is %d)\n",
+				param->progname, MAX_BATCH_PARAMS);
+		return -1;
+	}
+
+	if (bi->use_copy)
+		initPQExpBuffer(&bi->row);
+	else
+	{
+		Oid			ptypes[MAX_BATCH_PARAMS];
+		PGresult   *result;
+		ExecStatusType status;
+		int			i;
+
+		/* the OID of large object is passed as text */
+		if (param->large_objects)
+			ptypes[0] = InvalidOid;
+		else if (param->fmt == FORMAT_XML)
+			ptypes[0] = XMLOID;
+		else if (param->fmt == FORMAT_BYTEA)
+			ptypes[0] = BYTEAOID;
+		else
+			ptypes[0] = InvalidOid;
+
+		for (i = 1; i < nparams; i++)
+			ptypes[i] = InvalidOid;
+
+		result = PQprepare(conn, BATCH_STMT_NAME, param->command,
+						   nparams, ptypes);
+		status = PQresultStatus(result);
+
+		if (status != PGRES_COMMAND_OK)
+		{
+			fprintf(stderr, "%s: Unexpected result status: %s\n",
+					param->progname, PQresStatus(status));
+			fprintf(stderr, "%s: Error: %s\n",
+					param->progname, PQresultErrorMessage(result));
+			PQclear(result);
+			return -1;
+		}
+
+		PQclear(result);
+	}
+
+	return 0;
+}
+
+/*
+ * Pass one prepared document to the command. The values are additional
+ * parameters, the id from sequence is assigned here. The batch is
+ * committed when it is full.
+ */
+static int
+batch_put(BatchImporter *bi, const char *data, size_t len, size_t doclen,
+		  const char **values, enum format fmt)
+{
+	const struct _param *param = bi->param;
+	char		id[32];
+	int			i;
+
+	if (!bi->in_batch)
+	{
+		if (param->sequence != NULL && batch_reserve_ids(bi) != 0)
+			return -1;
+
+		if (batch_start(bi) != 0)
+			return -1;
+	}
+
+	if (param->sequence != NULL)
+	{
+		snprintf(id, sizeof(id), INT64_FORMAT, bi->ids[bi->next_id++]);
+		values[1] = id;
+	}
+
+	if (bi->use_copy)
+	{
+		PQExpBuffer row = &bi->row;
+
+		resetPQExpBuffer(row);
+
+		if (fmt == FORMAT_BYTEA)
+		{
+			if (!enlargePQExpBuffer(row, 2 * len + 3))
+				goto oom;
+
+			appendBinaryPQExpBuffer(row, "\\\\x", 3);
+			row->len += hex_encode_bytes(row->data + row->len, data, len);
+		}
+		else
+		{
+			if (!enlargePQExpBuffer(row, 2 * len))
+				goto oom;
+
+			row->len += copy_escape_text(row->data + row->len, data, len);
+		}
+
+		for (i = 1; i < bi->nparams; i++)
+		{
+			const char *value = values[i];
+
+			if (value)
+			{
+				size_t		vlen = strlen(value);
+
+				if (!enlargePQExpBuffer(row, 2 * vlen + 1))
+					goto oom;
+
+				row->data[row->len++] = '\t';
+				row->len += copy_escape_text(row->data + row->len, value, vlen);
+			}
+			else
+				appendBinaryPQExpBuffer(row, "\t\\N", 3);
+		}
+
+		appendPQExpBufferChar(row, '\n');
+
+		if (PQExpBufferBroken(row))
+			goto oom;
+
+		if (PQputCopyData(bi->conn, row->data, row->len) != 1)
+		{
+			fprintf(stderr, "%s: Error: %s\n",
+					param->progname, PQerrorMessage(bi->conn));
+			return -1;
+		}
+	}
+	else
+	{
+		const char *pvalues[MAX_BATCH_PARAMS];
+		int			plengths[MAX_BATCH_PARAMS];
+		int			pformats[MAX_BATCH_PARAMS];
+		PGresult   *result;
+		ExecStatusType status;
+
+		pvalues[0] = data;
+		plengths[0] = len;
+		pformats[0] = fmt == FORMAT_TEXT ? 0 : 1;
+
+		for (i = 1; i < bi->nparams; i++)
+		{
+			pvalues[i] = values[i];
+			plengths[i] = 0;
+			pformats[i] = 0;
+		}
+
+		result = PQexecPrepared(bi->conn, BATCH_STMT_NAME,
+								bi->nparams, pvalues, plengths, pformats,
+								0);
+		status = PQresultStatus(result);
+
+		if (status != PGRES_TUPLES_OK && status != PGRES_COMMAND_OK)
+		{
+			fprintf(stderr, "%s: Unexpected result status: %s\n",
+					param->progname, PQresStatus(status));
+			fprintf(stderr, "%s: Error: %s\n",
+					param->progname, PQresultErrorMessage(result));
+			PQclear(result);
+			return -1;
+		}
+
+		/* print result when we have it */
+		if (status == PGRES_TUPLES_OK && PQntuples(result) > 0 &&
+			!PQgetisnull(result, 0, 0))
+			fprintf(stdout, "%s\n", PQgetvalue(result, 0, 0));
+
+		PQclear(result);
+	}
+
+	bi->batch_docs += 1;
+	bi->total_docs += 1;
+	bi->total_bytes += doclen;
+
+	if (bi->batch_docs >= param->batch_size)
+		return batch_commit(bi);
+
+	return 0;
+
+oom:
+	fprintf(stderr, "%s: Out of memory\n", param->progname);
+	return -1;
+}
+
+/*
+ * Store 32bit integer in network byte order
+ */
+static void
+lo_store_int32(char *dst, uint32 value)
+{
+	dst[0] = (char) (value >> 24);
+	dst[1] = (char) (value >> 16);
+	dst[2] = (char) (value >> 8);
+	dst[3] = (char) value;
+}
+
+/*
+ * Forget documents waiting for large objects
+ */
+static void
+lo_reset(BatchImporter *bi)
+{
+	int			i;
+
+	for (i = 0; i < bi->lo_ndocs * bi->nparams; i++)
+	{
+		if (bi->lo_values[i])
+		{
+			pg_free(bi->lo_values[i]);
+			bi->lo_values[i] = NULL;
+		}
+	}
+
+	bi->lo_ndocs = 0;
+	resetPQExpBuffer(&bi->lo_array);
+}
+
+/*
+ * Create large objects of all waiting documents by one statement, and pass
+ * their OIDs to the command. The large objects and rows of command are
+ * committed together.
+ */
+static int
+lo_flush(BatchImporter *bi)
+{
+	const struct _param *param = bi->param;
+	PQExpBuffer array = &bi->lo_array;
+	const char *pvalues[1];
+	int			plengths[1];
+	int			pformats[1];
+	PGresult   *result;
+	int			rc = 0;
+	int			i;
+
+	if (bi->lo_ndocs == 0)
+		return 0;
+
+	if (PQExpBufferBroken(array))
+	{
+		fprintf(stderr, "%s: Out of memory\n", param->progname);
+		lo_reset(bi);
+		return -1;
+	}
+
+	/* header of bytea[]: ndim, flags, element type, dimension, lower bound */
+	lo_store_int32(array->data, 1);
+	lo_store_int32(array->data + 4, 0);
+	lo_store_int32(array->data + 8, BYTEAOID);
+	lo_store_int32(array->data + 12, bi->lo_ndocs);
+	lo_store_int32(array->data + 16, 1);
+
+	/* the ids are reserved before transaction */
+	if (param->sequence != NULL && batch_reserve_ids(bi) != 0)
+		goto error;
+
+	/* COPY is started after creating of large objects */
+	if (bi->use_copy)
+	{
+		if (batch_exec(bi, "BEGIN") != 0)
+			goto error;
+	}
+	else if (batch_start(bi) != 0)
+		goto error;
+
+	pvalues[0] = array->data;
+	plengths[0] = array->len;
+	pformats[0] = 1;
+
+	result = PQexecParams(bi->conn,
+						  "SELECT pg_catalog.lo_from_bytea(0, d)"
+						  "  FROM pg_catalog.unnest($1::bytea[]) WITH ORDINALITY AS u(d, n)"
+						  " ORDER BY n",
+						  1, NULL, pvalues, plengths, pformats, 0);
+
+	if (PQresultStatus(result) != PGRES_TUPLES_OK)
+	{
+		fprintf(stderr, "%s: Unexpected result status: %s\n",
+				param->progname, PQresStatus(PQresultStatus(result)));
+		fprintf(stderr, "%s: Error: %s\n",
+				param->progname, PQresultErrorMessage(result));
+		PQclear(result);
+		goto error;
+	}
+
+	if (PQntuples(result) != bi->lo_ndocs)
+	{
+		fprintf(stderr, "%s: unexpected number of created large objects: %d\n",
+				param->progname, PQntuples(result));
+		PQclear(result);
+		goto error;
+	}
+
+	if (param->verbose)
+		fprintf(stdout, "Created %d large objects\n", bi->lo_ndocs);
+
+	bi->total_los += bi->lo_ndocs;
+
+	for (i = 0; i < bi->lo_ndocs && rc == 0; i++)
+	{
+		const char *oid = PQgetvalue(result, i, 0);
+		const char *values[MAX_BATCH_PARAMS];
+
+		memcpy(values, bi->lo_values + i * bi->nparams,
+			   bi->nparams * sizeof(char *));
+
+		rc = batch_put(bi, oid, strlen(oid), bi->lo_doclens[i],
+					   values, FORMAT_TEXT);
+	}
+
+	PQclear(result);
+	lo_reset(bi);
+
+	if (rc != 0)
+		return -1;
+
+	/* every array of large objects is committed */
+	if (bi->in_batch)
+		return batch_commit(bi);
+
+	return 0;
+
+error:
+	lo_reset(bi);
+	return -1;
+}
+
+/*
+ * Append document to array of documents of new large objects. The
+ * values of additional parameters are copied.
+ */
+static int
+lo_append(BatchImporter *bi, const char *data, size_t len, size_t doclen,
+		  const char **values)
+{
+	PQExpBuffer array = &bi->lo_array;
+	char	  **lo_values;
+	char		elemlen[4];
+	int			i;
+
+	if (bi->lo_ndocs > 0 &&
+		(size_t) array->len + len + 4 > LO_ARRAY_LIMIT &&
+		lo_flush(bi) != 0)
+		return -1;
+
+	/* space for header, it is filled when the array is complete */
+	if (bi->lo_ndocs == 0)
+	{
+		char		header[LO_ARRAY_HEADER_SIZE];
+
+		memset(header, 0, sizeof(header));
+		appendBinaryPQExpBuffer(array, header, sizeof(header));
+	}
+
+	lo_store_int32(elemlen, (uint32) len);
+	appendBinaryPQExpBuffer(array, elemlen, 4);
+	appendBinaryPQExpBuffer(array, data, len);
+
+	/* the id is assigned later */
+	lo_values = bi->lo_values + bi->lo_ndocs * bi->nparams;
+	for (i = bi->param->sequence != NULL ? 2 : 1; i < bi->nparams; i++)
+		lo_values[i] = values[i] ? pg_strdup(values[i]) : NULL;
+
+	bi->lo_doclens[bi->lo_ndocs++] = doclen;
+
+	if (bi->lo_ndocs >= bi->param->batch_size)
+		return lo_flush(bi);
+
+	return 0;
+}
+
+/*
+ * Import one document. The params are values of additional parameters
+ * (NULL is SQL NULL). The batch is committed when it is full.
+ */
+int
+batch_add(BatchImporter *bi, const char *data, size_t len,
+		  const char *const *params)
+{
+	const struct _param *param = bi->param;
+	const char *values[MAX_BATCH_PARAMS];
+	char		hash[CANONICAL_HASH_LEN + 1];
+	size_t		doclen = len;
+	int			nvalues = bi->nparams;
+	int			first = param->sequence != NULL ? 2 : 1;
+	int			i;
+
+	if (bi->validator)
+	{
+		const char *error;
+		int			rc = schema_validate(bi->validator, data, len, &error);
+
+		if (rc < 0)
+			return -1;
+
+		if (rc == 0)
+		{
+			if (param->reject_dir == NULL)
+			{
+				fprintf(stderr, "%s: document is not valid: %s\n",
+						param->progname, error);
+				return -1;
+			}
+
+			if (schema_reject(data, len, error, param) != 0)
+				return -1;
+
+			bi->rejected_docs += 1;
+			return 0;
+		}
+	}
+
+	if (bi->canon && canon_hash(bi->canon, data, len, hash) != 0)
+		return -1;
+
+	if (param->skip_existing != NULL)
+	{
+		uint64		key;
+		int			rc;
+
+		/*
+		 * The same document in current batch is not visible for lookup, so
+		 * the batch is committed first.
+		 */
+		key = bi->canon ? batch_key(hash, CANONICAL_HASH_LEN) : batch_key(data, len);
+		if (batch_key_exists(bi, key) && batch_flush(bi) != 0)
+			return -1;
+
+		/* the hash of canonical form is looked up instead of document */
+		if (bi->canon)
+			rc = lookup_exists(&bi->lookup, hash, CANONICAL_HASH_LEN, params);
+		else
+			rc = lookup_exists(&bi->lookup, data, len, params);
+
+		if (rc < 0)
+			return -1;
+
+		if (rc > 0)
+		{
+			bi->skipped_docs += 1;
+			return 0;
+		}
+
+		batch_key_add(bi, key);
+	}
+
+	if (param->compress != COMPRESS_OFF)
+	{
+		values[--nvalues] = compress_document(&bi->compressed, &data, &len, param);
+		if (!values[nvalues])
+			return -1;
+	}
+
+	if (bi->canon)
+		values[--nvalues] = hash;
+
+	/* the id is assigned when the document is passed to command */
+	if (param->sequence != NULL)
+		values[1] = NULL;
+
+	for (i = first; i < nvalues; i++)
+		values[i] = params[i - first];
+
+	if (param->large_objects)
+		return lo_append(bi, data, len, doclen, values);
+
+	return batch_put(bi, data, len, doclen, values, param->fmt);
+}
+
+/*
+ * Commit current batch, when some documents are not committed yet
+ */
+int
+batch_flush(BatchImporter *bi)
+{
+	if (bi->lo_ndocs > 0)
+		return lo_flush(bi);
+
+	if (bi->in_batch)
+		return batch_commit(bi);
+
+	return 0;
+}
+
+/*
+ * Commit last batch and release resources
+ */
+int
+batch_end(BatchImporter *bi)
+{
+	int			rc;
+
+	rc = batch_flush(bi);
+
+	if (bi->use_copy)
+		termPQExpBuffer(&bi->row);
+	termPQExpBuffer(&bi->compressed);
+	if (bi->ids)
+		pg_free(bi->ids);
+	if (bi->canon)
+		canon_free(bi->canon);
+	if (bi->validator)
+		schema_validator_free(bi->validator);
+	if (bi->param->skip_existing != NULL)
+	{
+		lookup_end(&bi->lookup);
+		pg_free(bi->batch_keys);
+	}
+	if (bi->param->large_objects)
+	{
+		termPQExpBuffer(&bi->lo_array);
+		pg_free(bi->lo_doclens);
+		pg_free(bi->lo_values);
+	}
+
+	if (rc == 0 && bi->param->verbose)
+	{
+		fprintf(stdout, "Imported " INT64_FORMAT " documents of size " INT64_FORMAT "\n",
+				bi->total_docs, bi->total_bytes);
+
+		if (bi->param->skip_existing != NULL)
+			fprintf(stdout, "Skipped " INT64_FORMAT " documents imported already\n",
+					bi->skipped_docs);
+
+		if (bi->param->schema != NULL)
+			fprintf(stdout, "Rejected " INT64_FORMAT " invalid documents\n",
+					bi->rejected_docs);
+
+		if (bi->param->large_objects)
+			fprintf(stdout, "Created " INT64_FORMAT " large objects\n",
+					bi->total_los);
+	}
+
+	return rc;
+}
@@ -0,0 +1,623 @@
+/*-------------------------------------------------------------------------
+ *
+ * bench.c
+ *	  microbenchmarks of pgimportdoc kernels
+ *
+ * Measures throughput of escaping, encoding and decoding kernels on
+ * generated standard inputs, for every implementation supported by this
+ * CPU, and throughput of canonical hashing, JSON Schema validation and
+ * parallel decompression (the same functions that pgimportdoc uses). The
+ * result is written to stdout in JSON format.
+ *
+ * IDENTIFICATION
+ *   bench.c
+ *
+ *-------------------------------------------------------------------------
+ */
+#include "postgres_fe.h"
+
+#ifndef WIN32
+#include <poll.h>
+#include <unistd.h>
+#endif
+
+#ifdef USE_ZSTD
+#include <zstd.h>
+#endif
+
+#include "getopt_long.h"
+#include "portability/instr_time.h"
+
+#include "pgimportdoc.h"
+
+#define DEFAULT_INPUT_SIZE	(16 * 1024 * 1024)
+#define DEFAULT_MIN_TIME	0.5
+
+/* size of independent zstd frames of compressed input */
+#define BENCH_FRAME_SIZE	(1024 * 1024)
+
+/* threads used by decompression */
+#define BENCH_DECOMPRESS_JOBS	4
+
+typedef enum BenchInput
+{
+	INPUT_TEXT,					/* text with few escaped characters */
+	INPUT_BINARY,				/* random bytes */
+	INPUT_HEX,					/* hex encoded random bytes */
+	INPUT_BASE64,				/* base64 encoded random bytes */
+	INPUT_BASE64_LINES,			/* base64 split to lines of 76 chars */
+	INPUT_XML,					/* XML document with comments, CDATA */
+	INPUT_JSON,					/* JSON array of small objects */
+	INPUT_ZSTD,					/* NDJSON compressed to more zstd frames */
+	NUM_INPUTS
+} BenchInput;
+
+static const char *input_names[] = {
+	"text", "binary", "hex", "base64", "base64-lines", "xml", "json", "zstd"
+};
+
+/* JSON Schema of INPUT_JSON */
+static const char *bench_schema =
+"{\"type\": \"array\", \"items\": {\"type\": \"object\","
+" \"required\": [\"id\", \"value\"], \"additionalProperties\": false,"
+" \"properties\": {\"id\": {\"type\": \"integer\", \"minimum\": 0},"
+" \"value\": {\"type\": \"string\", \"minLength\": 8, \"maxLength\": 8},"
+" \"tags\": {\"type\": \"array\", \"items\": {\"enum\": [\"a\", \"b\", \"c\"]}}}}}";
+
+typedef size_t (*BenchFunc) (char *dst, const char *src, size_t len);
+
+typedef struct BenchKernel
+{
+	const char *name;
+	BenchInput	input;
+	BenchFunc	func;
+	bool		depends_on_impl;	/* is measured for every implementation */
+} BenchKernel;
+
+static const char *progname;
+
+/* deterministic generator of inputs */
+static uint64 rng_state = UINT64CONST(0x9E3779B97F4A7C15);
+
+static uint64
+rng_next(void)
+{
+	rng_state ^= rng_state << 13;
+	rng_state ^= rng_state >> 7;
+	rng_state ^= rng_state << 17;
+
+	return rng_state;
+}
+
+static size_t
+bench_escape_text(char *dst, const char *src, size_t len)
+{
+	return copy_escape_text(dst, src, len);
+}
+
+static size_t
+bench_hex_encode(char *dst, const char *src, size_t len)
+{
+	return hex_encode_bytes(dst, src, len);
+}
+
+static size_t
+bench_decode(char *dst, const char *src, size_t len, InputEncoding encoding)
+{
+	DecodeState state;
+	ssize_t		n;
+
+	decode_init(&state, encoding);
+
+	n = decode_chunk(&state, dst, src, len);
+	if (n < 0 || !decode_finish(&state))
+	{
+		fprintf(stderr, "%s: invalid benchmark input\n", progname);
+		exit(1);
+	}
+
+	return n;
+}
+
+static size_t
+bench_hex_decode(char *dst, const char *src, size_t len)
+{
+	return bench_decode(dst, src, len, INPUT_ENCODING_HEX);
+}
+
+static size_t
+bench_base64_decode(char *dst, const char *src, size_t len)
+{
+	return bench_decode(dst, src, len, INPUT_ENCODING_BASE64);
+}
+
+static Canonicalizer *canon_xml;
+static Canonicalizer *canon_json;
+
+static size_t
+bench_canon(Canonicalizer *cn, char *dst, const char *src, size_t len)
+{
+	if (canon_hash(cn, src, len, dst) != 0)
+	{
+		fprintf(stderr, "%s: invalid benchmark input\n", progname);
+		exit(1);
+	}
+
+	return CANONICAL_HASH_LEN;
+}
+
+static size_t
+bench_canon_xml(char *dst, const char *src, size_t len)
+{
+	return bench_canon(canon_xml, dst, src, len);
+}
+
+static size_t
+bench_canon_json(char *dst, const char *src, size_t len)
+{
+	return bench_canon(canon_json, dst, src, len);
+}
+
+#ifndef WIN32
+
+static SchemaValidator *validator;
+
+static size_t
+bench_schema_json(char *dst, const char *src, size_t len)
+{
+	const char *error;
+
+	if (schema_validate(validator, src, len, &error) != 1)
+	{
+		fprintf(stderr, "%s: invalid benchmark input\n", progname);
+		exit(1);
+	}
+
+	return 0;
+}
+
+#endif
+
+#if defined(USE_ZSTD) && !defined(WIN32)
+
+/* unlinked temporary file with INPUT_ZSTD, the decompression maps it */
+static int	zstd_fd = -1;
+static struct _param decompress_param;
+
+/*
+ * Decompress the input by more threads, and read it from pipe like the
+ * FIFO reader
+ */
+static size_t
+bench_decompress(char *dst, const char *src, size_t len)
+{
+	Decompressor *dc;
+	char		chunk[65536];
+	int			fd = dup(zstd_fd);
+	size_t		total = 0;
+	bool		failed;
+
+	if (fd < 0 ||
+		decompress_start(&dc, "benchmark input", &fd, &decompress_param) != 0 ||
+		!dc)
+	{
+		fprintf(stderr, "%s: cannot decompress benchmark input\n", progname);
+		exit(1);
+	}
+
+	for (;;)
+	{
+		ssize_t		n = read(fd, chunk, sizeof(chunk));
+
+		if (n > 0)
+			total += n;
+		else if (n == 0)
+			break;
+		else if (errno == EAGAIN || errno == EWOULDBLOCK)
+		{
+			struct pollfd pfd;
+
+			pfd.fd = fd;
+			pfd.events = POLLIN;
+			pfd.revents = 0;
+			poll(&pfd, 1, -1);
+		}
+		else if (errno != EINTR)
+			break;
+	}
+
+	close(fd);
+	failed = decompress_failed(dc);
+	decompress_end(dc);
+
+	if (failed)
+	{
+		fprintf(stderr, "%s: cannot decompress benchmark input\n", progname);
+		exit(1);
+	}
+
+	return total;
+}
+
+#endif
+
+static const BenchKernel kernels[] = {
+	{"escape_text", INPUT_TEXT, bench_escape_text, true},
+	{"hex_encode", INPUT_BINARY, bench_hex_encode, true},
+	{"hex_decode", INPUT_HEX, bench_hex_decode, true},
+	{"base64_decode", INPUT_BASE64, bench_base64_decode, true},
+	{"base64_decode", INPUT_BASE64_LINES, bench_base64_decode, true},
+	{"canon_xml", INPUT_XML, bench_canon_xml, false},
+	{"canon_json", INPUT_JSON, bench_canon_json, false},
+#ifndef WIN32
+	{"schema_json", INPUT_JSON, bench_schema_json, false},
+#endif
+#if defined(USE_ZSTD) && !defined(WIN32)
+	{"decompress", INPUT_ZSTD, bench_decompress, false},
+#endif
+	{NULL}
+};
+
+static void
+generate_input(PQExpBuffer buf, BenchInput input, size_t size)
+{
+	static const char b64chars[] =
+	"ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+	size_t		i;
+
+	resetPQExpBuffer(buf);
+
+	switch (input)
+	{
+		case INPUT_TEXT:
+			/* words, and about 2% of characters should be escaped */
+			for (i = 0; i < size; i++)
+			{
+				uint64		r = rng_next() % 100;
+
+				if (r < 1)
+					appendPQExpBufferChar(buf, '\n');
+				else if (r < 2)
+					appendPQExpBufferChar(buf, '\t');
+				else if (r < 17)
+					appendPQExpBufferChar(buf, ' ');
+				else
+					appendPQExpBufferChar(buf, 'a' + rng_next() % 26);
+			}
+			break;
+
+		case INPUT_BINARY:
+			for (i = 0; i < size; i++)
+				appendPQExpBufferChar(buf, (char) (rng_next() & 0xff));
+			break;
+
+		case INPUT_HEX:
+			for (i = 0; i < size; i++)
+				appendPQExpBufferChar(buf, "0123456789abcdef"[rng_next() & 0x0f]);
+			break;
+
+		case INPUT_BASE64:
+		case INPUT_BASE64_LINES:
+			for (i = 0; i < size; i++)
+			{
+				if (input == INPUT_BASE64_LINES && i % 77 == 76)
+					appendPQExpBufferChar(buf, '\n');
+				else
+					appendPQExpBufferChar(buf, b64chars[rng_next() & 0x3f]);
+			}
+
+			/* complete quantum of base64 */
+			while (buf->len > 0 && buf->len % 77 % 4 != 0 &&
+				   input == INPUT_BASE64_LINES)
+				buf->data[--buf->len] = '\0';
+			while (buf->len % 4 != 0 && input == INPUT_BASE64)
+				buf->data[--buf->len] = '\0';
+			break;
+
+		case INPUT_XML:
+			appendPQExpBufferStr(buf, "<?xml version=\"1.0\"?>\n<items>\n");
+			while (buf->len < size)
+				appendPQExpBuffer(buf, "  <item value=\"%08x\" id=\"%u\"><!-- generated -->"
+								  "<name>item</name><empty/><![CDATA[a < b]]></item>\n",
+								  (unsigned int) rng_next(),
+								  (unsigned int) (rng_next() % 100000));
+			appendPQExpBufferStr(buf, "</items>\n");
+			break;
+
+		case INPUT_JSON:
+			appendPQExpBufferChar(buf, '[');
+			while (buf->len < size)
+				appendPQExpBuffer(buf, "%s\n  {\"value\": \"%08x\", \"id\": %u, \"tags\": [\"a\", \"c\"]}",
+								  buf->len > 1 ? "," : "",
+								  (unsigned int) rng_next(),
+								  (unsigned int) (rng_next() % 100000));
+			appendPQExpBufferStr(buf, "\n]\n");
+			break;
+
+		case INPUT_ZSTD:
+#ifdef USE_ZSTD
+			{
+				PQExpBufferData ndjson;
+				size_t		pos;
+
+				initPQExpBuffer(&ndjson);
+				while (ndjson.len < size)
+					appendPQExpBuffer(&ndjson, "{\"id\": %u, \"value\": \"%08x\"}\n",
+									  (unsigned int) (rng_next() % 100000),
+									  (unsigned int) rng_next());
+
+				/* independent frames are decompressed in parallel */
+				for (pos = 0; pos < ndjson.len; pos += BENCH_FRAME_SIZE)
+				{
+					size_t		chunk = Min(BENCH_FRAME_SIZE, ndjson.len - pos);
+					size_t		bound = ZSTD_compressBound(chunk);
+					size_t		n;
+
+					if (!enlargePQExpBuffer(buf, bound))
+						break;
+
+					n = ZSTD_compress(buf->data + buf->len, bound,
+									  ndjson.data + pos, chunk, 3);
+					if (ZSTD_isError(n))
+					{
+						fprintf(stderr, "%s: %s\n", progname, ZSTD_getErrorName(n));
+						exit(1);
+					}
+
+					buf->len += n;
+				}
+
+				termPQExpBuffer(&ndjson);
+			}
+#endif
+			break;
+
+		default:
+			break;
+	}
+
+	if (PQExpBufferBroken(buf))
+	{
+		fprintf(stderr, "%s: Out of memory\n", progname);
+		exit(1);
+	}
+}
+
+#ifndef WIN32
+
+/*
+ * Write data to new temporary file, returns its descriptor. The path is
+ * returned in path.
+ */
+static int
+write_temp_file(char *path, size_t pathlen, const char *data, size_t len)
+{
+	const char *tmpdir = getenv("TMPDIR");
+	int			fd;
+
+	snprintf(path, pathlen, "%s/pgimportdoc_bench_XXXXXX", tmpdir ? tmpdir : "/tmp");
+
+	fd = mkstemp(path);
+	if (fd < 0 || write(fd, data, len) != (ssize_t) len)
+	{
+		fprintf(stderr, "%s: Cannot write temporary file '%s': %s\n",
+				progname, path, strerror(errno));
+		exit(1);
+	}
+
+	return fd;
+}
+
+#endif
+
+/*
+ * Prepare state of kernels, that use functions of pgimportdoc
+ */
+static void
+setup_kernels(PQExpBuffer inputs)
+{
+	static struct _param xml_param;
+	static struct _param json_param;
+
+	xml_param.progname = progname;
+	xml_param.canonical_hash = CANONICAL_XML;
+	canon_xml = canon_create(&xml_param);
+
+	json_param.progname = progname;
+	json_param.canonical_hash = CANONICAL_JSON;
+	canon_json = canon_create(&json_param);
+
+#ifndef WIN32
+	{
+		static struct _param schema_param;
+		char		path[MAXPGPATH];
+
+		/* the schema is loaded from file */
+		close(write_temp_file(path, sizeof(path), bench_schema, strlen(bench_schema)));
+
+		schema_param.progname = progname;
+		schema_param.schema = pg_strdup(path);
+
+		if (schema_load(&schema_param) != 0)
+			exit(1);
+
+		unlink(path);
+
+		validator = schema_validator_create(&schema_param);
+		if (!validator)
+			exit(1);
+	}
+#endif
+
+#if defined(USE_ZSTD) && !defined(WIN32)
+	{
+		char		path[MAXPGPATH];
+
+		zstd_fd = write_temp_file(path, sizeof(path), inputs[INPUT_ZSTD].data,
+								  inputs[INPUT_ZSTD].len);
+		unlink(path);
+
+		decompress_param.progname = progname;
+		decompress_param.decompress_jobs = BENCH_DECOMPRESS_JOBS;
+	}
+#endif
+}
+
+static void
+cleanup_kernels(void)
+{
+	canon_free(canon_xml);
+	canon_free(canon_json);
+
+#ifndef WIN32
+	schema_validator_free(validator);
+	schema_unload();
+#endif
+
+#if defined(USE_ZSTD) && !defined(WIN32)
+	close(zstd_fd);
+#endif
+}
+
+static void
+usage(void)
+{
+	printf("%s measures throughput of pgimportdoc kernels.\n\n", progname);
+	printf("Usage:\n  %s [OPTION]...\n\n", progname);
+	printf("Options:\n");
+	printf("  -s, --size=BYTES  size of input data, default is %d\n", DEFAULT_INPUT_SIZE);
+	printf("  -t, --time=SECS   minimal time of one measurement, default is %.1f\n", DEFAULT_MIN_TIME);
+	printf("  -k, --kernel=NAME measure only kernel NAME\n");
+	printf("  -?, --help        show this help, then exit\n");
+}
+
+int
+main(int argc, char **argv)
+{
+	static struct option long_options[] = {
+		{"size", required_argument, NULL, 's'},
+		{"time", required_argument, NULL, 't'},
+		{"kernel", required_argument, NULL, 'k'},
+		{"help", no_argument, NULL, '?'},
+		{NULL, 0, NULL, 0}
+	};
+
+	PQExpBufferData inputs[NUM_INPUTS];
+	size_t		size = DEFAULT_INPUT_SIZE;
+	double		min_time = DEFAULT_MIN_TIME;
+	const char *only_kernel = NULL;
+	const EncodeKernels *const *impls;
+	const EncodeKernels *selected;
+	char	   *dst;
+	bool		first = true;
+	int			c;
+	int			optindex;
+	int			i;
+	int			k;
+
+	progname = get_progname(argv[0]);
+
+	impls = encode_supported_kernels();
+	encode_select_kernels(NULL);
+	selected = encode_kernels;
+
+	while ((c = getopt_long(argc, argv, "s:t:k:?", long_options, &optindex)) != -1)
+	{
+		switch (c)
+		{
+			case 's':
+				if (strtol(optarg, NULL, 10) < 1024)
+				{
+					fprintf(stderr, "%s: input size should be at least 1024\n", progname);
+					exit(1);
+				}
+				size = strtol(optarg, NULL, 10);
+				break;
+			case 't':
+				min_time = atof(optarg);
+				break;
+			case 'k':
+				only_kernel = optarg;
+				break;
+			case '?':
+				usage();
+				exit(optopt ? 1 : 0);
+			default:
+				exit(1);
+		}
+	}
+
+	for (i = 0; i < NUM_INPUTS; i++)
+	{
+		initPQExpBuffer(&inputs[i]);
+		generate_input(&inputs[i], i, size);
+	}
+
+	setup_kernels(inputs);
+
+	/* escaped or encoded data can be twice longer */
+	dst = pg_malloc(2 * size + 64);
+
+	printf("{\n  \"selected\": \"%s\",\n  \"implementations\": [", selected->name);
+	for (i = 0; impls[i]; i++)
+		printf("%s\"%s\"", i > 0 ? ", " : "", impls[i]->name);
+	printf("],\n  \"input_size\": %zu,\n  \"results\": [", size);
+
+	for (k = 0; kernels[k].name; k++)
+	{
+		const BenchKernel *kernel = &kernels[k];
+
+		if (only_kernel && strcmp(only_kernel, kernel->name) != 0)
+			continue;
+
+		for (i = 0; impls[i]; i++)
+		{
+			PQExpBuffer input = &inputs[kernel->input];
+			instr_time	start;
+			instr_time	duration;
+			int64		iterations = 0;
+			double		seconds;
+
+			encode_kernels = impls[i];
+
+			INSTR_TIME_SET_CURRENT(start);
+
+			do
+			{
+				kernel->func(dst, input->data, input->len);
+				iterations += 1;
+
+				INSTR_TIME_SET_CURRENT(duration);
+				INSTR_TIME_SUBTRACT(duration, start);
+			} while (INSTR_TIME_GET_DOUBLE(duration) < min_time);
+
+			seconds = INSTR_TIME_GET_DOUBLE(duration);
+
+			printf("%s\n    {\"kernel\": \"%s\", \"impl\": \"%s\", \"input\": \"%s\", "
+				   "\"iterations\": " INT64_FORMAT ", \"seconds\": %.6f, \"mb_per_sec\": %.1f}",
+				   first ? "" : ",",
+				   kernel->name,
+				   kernel->depends_on_impl ? encode_kernels->name : "generic",
+				   input_names[kernel->input],
+				   iterations, seconds,
+				   (double) input->len * iterations / seconds / (1024.0 * 1024.0));
+
+			first = false;
+
+			if (!kernel->depends_on_impl)
+				break;
+		}
+	}
+
+	printf("\n  ]\n}\n");
+
+	encode_kernels = selected;
+
+	cleanup_kernels();
+
+	pg_free(dst);
+	for (i = 0; i < NUM_INPUTS; i++)
+		termPQExpBuffer(&inputs[i]);
+
+	return 0;
+}
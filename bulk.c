@@ -0,0 +1,363 @@
+/*-------------------------------------------------------------------------
+ *
+ * bulk.c
+ *	  bulk load modes
+ *
+ * In freeze mode the whole import runs in one transaction. The target
+ * table is truncated (or created) at start of this transaction, and the
+ * documents are loaded by COPY ... FREEZE, so the rows are frozen already,
+ * and the table is not rewritten by later anti-wraparound vacuum.
+ *
+ * In attach mode the documents are loaded to new standalone table with
+ * same columns as range partitioned parent table. After load the indexes
+ * of parent and CHECK constraint of partition bound are created, and the
+ * table is attached as partition. The CHECK constraint allows to skip
+ * the validation scan of ATTACH PARTITION, so the parent is locked only
+ * for short time.
+ *
+ * IDENTIFICATION
+ *   bulk.c
+ *
+ *-------------------------------------------------------------------------
+ */
+#include "postgres_fe.h"
+
+#include "pgimportdoc.h"
+
+#define BOUND_CONSTRAINT_NAME	"pgimportdoc_bound"
+
+/* quoted name of partition key column of parent in attach mode */
+static char *partition_key = NULL;
+
+/*
+ * Execute command without result, returns -1 on error
+ */
+static int
+bulk_exec(PGconn *conn, const char *command, const struct _param * param)
+{
+	PGresult   *result;
+	ExecStatusType status;
+
+	if (param->verbose)
+		fprintf(stdout, "execute command: %s\n", command);
+
+	result = PQexec(conn, command);
+	status = PQresultStatus(result);
+
+	if (status != PGRES_COMMAND_OK)
+	{
+		fprintf(stderr, "%s: Unexpected result status: %s\n",
+				param->progname, PQresStatus(status));
+		fprintf(stderr, "%s: Error: %s\n",
+				param->progname, PQresultErrorMessage(result));
+		PQclear(result);
+		return -1;
+	}
+
+	PQclear(result);
+
+	return 0;
+}
+
+/*
+ * Returns true when command contains word (case insensitive)
+ */
+bool
+command_has_word(const char *command, const char *word)
+{
+	size_t		len = strlen(word);
+	const char *ptr;
+
+	for (ptr = command; *ptr; ptr++)
+	{
+		if ((ptr == command ||
+			 (!isalnum((unsigned char) ptr[-1]) && ptr[-1] != '_')) &&
+			pg_strncasecmp(ptr, word, len) == 0 &&
+			!isalnum((unsigned char) ptr[len]) && ptr[len] != '_')
+			return true;
+	}
+
+	return false;
+}
+
+/*
+ * COPY FREEZE cannot be used for partitioned table
+ */
+static int
+check_freeze_target(PGconn *conn, const struct _param * param)
+{
+	const char *values[1];
+	PGresult   *result;
+	int			rc = 0;
+
+	values[0] = param->truncate;
+
+	result = PQexecParams(conn,
+						  "SELECT relkind FROM pg_catalog.pg_class WHERE oid = $1::regclass",
+						  1, NULL, values, NULL, NULL, 0);
+
+	if (PQresultStatus(result) != PGRES_TUPLES_OK)
+	{
+		fprintf(stderr, "%s: Error: %s\n",
+				param->progname, PQresultErrorMessage(result));
+		rc = -1;
+	}
+	else if (PQntuples(result) == 1 && strcmp(PQgetvalue(result, 0, 0), "r") != 0)
+	{
+		fprintf(stderr, "%s: COPY FREEZE can be used only for plain table, \"%s\" is not\n",
+				param->progname, param->truncate);
+		rc = -1;
+	}
+
+	PQclear(result);
+
+	return rc;
+}
+
+/*
+ * Execute commands returned by query, returns -1 on error
+ */
+static int
+bulk_exec_generated(PGconn *conn, const char *query,
+					int nparams, const char *const *values,
+					const struct _param * param)
+{
+	PGresult   *result;
+	int			rc = 0;
+	int			i;
+
+	result = PQexecParams(conn, query, nparams, NULL, values, NULL, NULL, 0);
+
+	if (PQresultStatus(result) != PGRES_TUPLES_OK)
+	{
+		fprintf(stderr, "%s: Error: %s\n",
+				param->progname, PQresultErrorMessage(result));
+		PQclear(result);
+		return -1;
+	}
+
+	for (i = 0; i < PQntuples(result) && rc == 0; i++)
+		rc = bulk_exec(conn, PQgetvalue(result, i, 0), param);
+
+	PQclear(result);
+
+	return rc;
+}
+
+/*
+ * Read the partition key of parent. Only the range partitioning by one
+ * column is supported, because the CHECK constraint is built from bounds.
+ */
+static int
+read_partition_key(PGconn *conn, const struct _param * param)
+{
+	const char *values[1];
+	PGresult   *result;
+
+	values[0] = param->attach;
+
+	result = PQexecParams(conn,
+						  "SELECT pg_catalog.quote_ident(a.attname)"
+						  "  FROM pg_catalog.pg_partitioned_table p"
+						  "       JOIN pg_catalog.pg_attribute a"
+						  "         ON a.attrelid = p.partrelid AND a.attnum = p.partattrs[0]"
+						  " WHERE p.partrelid = $1::regclass"
+						  "   AND p.partstrat = 'r' AND p.partnatts = 1",
+						  1, NULL, values, NULL, NULL, 0);
+
+	if (PQresultStatus(result) != PGRES_TUPLES_OK)
+	{
+		fprintf(stderr, "%s: Error: %s\n",
+				param->progname, PQresultErrorMessage(result));
+		PQclear(result);
+		return -1;
+	}
+
+	if (PQntuples(result) != 1)
+	{
+		fprintf(stderr, "%s: table \"%s\" is not partitioned by range of one column\n",
+				param->progname, param->attach);
+		PQclear(result);
+		return -1;
+	}
+
+	partition_key = pg_strdup(PQgetvalue(result, 0, 0));
+
+	PQclear(result);
+
+	return 0;
+}
+
+/*
+ * Create standalone table with same columns, defaults and constraints
+ * like parent. The indexes are created after load.
+ */
+static int
+create_partition(PGconn *conn, const struct _param * param)
+{
+	PQExpBufferData command;
+	int			rc;
+
+	initPQExpBuffer(&command);
+	appendPQExpBuffer(&command,
+					  "CREATE TABLE %s (LIKE %s INCLUDING ALL EXCLUDING INDEXES)",
+					  param->partition, param->attach);
+
+	rc = bulk_exec(conn, command.data, param);
+
+	termPQExpBuffer(&command);
+
+	return rc;
+}
+
+/*
+ * Create indexes of parent and CHECK constraint of bound, and attach the
+ * loaded table as partition.
+ */
+static int
+attach_partition(PGconn *conn, const struct _param * param)
+{
+	PQExpBufferData command;
+	const char *values[2];
+	int			rc;
+
+	/*
+	 * The indexes used by constraints are created by constraints, so they
+	 * can be attached to constraints of parent.
+	 */
+	values[0] = param->attach;
+	values[1] = param->partition;
+
+	rc = bulk_exec_generated(conn,
+							 "SELECT CASE WHEN c.oid IS NOT NULL"
+							 "  THEN 'ALTER TABLE ' || $2::regclass::text || ' ADD '"
+							 "       || pg_catalog.pg_get_constraintdef(c.oid)"
+							 "  ELSE 'CREATE ' || CASE WHEN i.indisunique THEN 'UNIQUE ' ELSE '' END"
+							 "       || 'INDEX ON ' || $2::regclass::text"
+							 "       || substring(pg_catalog.pg_get_indexdef(i.indexrelid) FROM ' USING .*')"
+							 "  END"
+							 "  FROM pg_catalog.pg_index i"
+							 "       LEFT JOIN pg_catalog.pg_constraint c"
+							 "         ON c.conindid = i.indexrelid AND c.conrelid = i.indrelid"
+							 "            AND c.contype IN ('p', 'u', 'x')"
+							 " WHERE i.indrelid = $1::regclass"
+							 " ORDER BY i.indexrelid",
+							 2, values, param);
+	if (rc != 0)
+		return -1;
+
+	initPQExpBuffer(&command);
+
+	appendPQExpBuffer(&command,
+					  "ALTER TABLE %s ADD CONSTRAINT " BOUND_CONSTRAINT_NAME
+					  " CHECK (%s IS NOT NULL AND %s >= (%s) AND %s < (%s))",
+					  param->partition,
+					  partition_key, partition_key, param->partition_from,
+					  partition_key, param->partition_to);
+	rc = bulk_exec(conn, command.data, param);
+
+	if (rc == 0)
+	{
+		resetPQExpBuffer(&command);
+		appendPQExpBuffer(&command,
+						  "ALTER TABLE %s ATTACH PARTITION %s FOR VALUES FROM (%s) TO (%s)",
+						  param->attach, param->partition,
+						  param->partition_from, param->partition_to);
+		rc = bulk_exec(conn, command.data, param);
+	}
+
+	/* the constraint is redundant after attaching */
+	if (rc == 0)
+	{
+		resetPQExpBuffer(&command);
+		appendPQExpBuffer(&command,
+						  "ALTER TABLE %s DROP CONSTRAINT " BOUND_CONSTRAINT_NAME,
+						  param->partition);
+		rc = bulk_exec(conn, command.data, param);
+	}
+
+	termPQExpBuffer(&command);
+
+	if (rc == 0 && param->verbose)
+		fprintf(stdout, "Table \"%s\" is attached to \"%s\"\n",
+				param->partition, param->attach);
+
+	return rc;
+}
+
+/*
+ * Start the bulk load. In freeze mode the transaction is started, and the
+ * target table is truncated or created. In attach mode the table is
+ * created.
+ */
+int
+bulk_begin(PGconn *conn, const struct _param * param)
+{
+	if (param->attach && read_partition_key(conn, param) != 0)
+		return -1;
+
+	if (param->freeze && bulk_exec(conn, "BEGIN", param) != 0)
+		return -1;
+
+	if (param->attach)
+		return create_partition(conn, param);
+
+	if (!param->freeze)
+		return 0;
+
+	if (param->truncate)
+	{
+		PQExpBufferData command;
+		int			rc;
+
+		if (check_freeze_target(conn, param) != 0)
+			return -1;
+
+		/* the name is SQL identifier (can be qualified) like in command */
+		initPQExpBuffer(&command);
+		appendPQExpBuffer(&command, "TRUNCATE %s", param->truncate);
+
+		rc = bulk_exec(conn, command.data, param);
+
+		termPQExpBuffer(&command);
+
+		return rc;
+	}
+
+	return bulk_exec(conn, param->create_sql, param);
+}
+
+/*
+ * Finish the bulk load. The rc is result of import.
+ */
+int
+bulk_end(PGconn *conn, const struct _param * param, int rc)
+{
+	if (param->freeze)
+	{
+		if (rc != 0)
+		{
+			/* the error is reported already */
+			bulk_exec(conn, "ROLLBACK", param);
+			return rc;
+		}
+
+		if (bulk_exec(conn, "COMMIT", param) != 0)
+			return -1;
+	}
+
+	if (param->attach)
+	{
+		if (rc != 0)
+		{
+			if (!param->freeze)
+				fprintf(stderr, "%s: table \"%s\" is not attached to \"%s\"\n",
+						param->progname, param->partition, param->attach);
+			return rc;
+		}
+
+		return attach_partition(conn, param);
+	}
+
+	return rc;
+}
@@ -0,0 +1,788 @@
+/*-------------------------------------------------------------------------
+ *
+ * canon.c
+ *	  hash of canonical form of XML and JSON documents
+ *
+ * Semantically same documents can differ by order of attributes or keys,
+ * by whitespaces or by comments, and then they are not detected as
+ * duplicates by comparing of bytes. The hash (SHA-256) is calculated from
+ * canonical form of document:
+ *
+ * XML (C14N-lite) - without XML declaration, DOCTYPE and comments, the
+ * text with whitespaces only is removed, attributes are sorted by name and
+ * quoted by double quotes, empty element is written by start and end tag,
+ * CDATA section is replaced by escaped text, and line ends are normalized.
+ * Entities and namespaces are not processed.
+ *
+ * JSON - compact form without whitespaces, the members of objects are
+ * sorted by keys. Strings and numbers are not normalized.
+ *
+ * The canonical form is not materialized - it is written to the hash by
+ * small buffer. The document that cannot be parsed is hashed as is. Every
+ * batch importer (worker thread) has own state.
+ *
+ * IDENTIFICATION
+ *   canon.c
+ *
+ *-------------------------------------------------------------------------
+ */
+#include "postgres_fe.h"
+
+#include "common/sha2.h"
+
+#if PG_VERSION_NUM >= 140000
+
+#include "common/cryptohash.h"
+
+#endif
+
+#include "pgimportdoc.h"
+
+/* size of buffer of canonical form, that is written to hash */
+#define CANON_BUFSIZE		8192
+
+/* max nesting of JSON arrays and objects */
+#define CANON_MAX_DEPTH		1000
+
+/*
+ * Attribute of XML element or member of JSON object
+ */
+typedef struct CanonItem
+{
+	const char *name;			/* name of attribute or key (with quotes) */
+	size_t		namelen;
+	const char *value;			/* value (without quotes for attribute) */
+	size_t		valuelen;
+} CanonItem;
+
+struct Canonicalizer
+{
+	const struct _param *param;
+#if PG_VERSION_NUM >= 140000
+	pg_cryptohash_ctx *ctx;
+#else
+	pg_sha256_ctx ctx;
+#endif
+	bool		failed;			/* hash cannot be calculated */
+	char		buffer[CANON_BUFSIZE];
+	int			buflen;
+	CanonItem  *items;			/* stack of attributes or members */
+	int			nitems;
+	int			maxitems;
+	int			depth;
+};
+
+static void
+hash_start(Canonicalizer *cn)
+{
+	cn->buflen = 0;
+	cn->failed = false;
+
+#if PG_VERSION_NUM >= 140000
+
+	if (!cn->ctx)
+		cn->ctx = pg_cryptohash_create(PG_SHA256);
+
+	if (!cn->ctx || pg_cryptohash_init(cn->ctx) < 0)
+		cn->failed = true;
+
+#else
+
+	pg_sha256_init(&cn->ctx);
+
+#endif
+}
+
+static void
+hash_flush(Canonicalizer *cn)
+{
+	if (cn->buflen > 0 && !cn->failed)
+	{
+#if PG_VERSION_NUM >= 140000
+
+		if (pg_cryptohash_update(cn->ctx, (uint8 *) cn->buffer, cn->buflen) < 0)
+			cn->failed = true;
+
+#else
+
+		pg_sha256_update(&cn->ctx, (uint8 *) cn->buffer, cn->buflen);
+
+#endif
+	}
+
+	cn->buflen = 0;
+}
+
+/*
+ * Write hex encoded hash to target (CANONICAL_HASH_LEN + 1 bytes)
+ */
+static int
+hash_finish(Canonicalizer *cn, char *hash)
+{
+	uint8		digest[PG_SHA256_DIGEST_LENGTH];
+
+	hash_flush(cn);
+
+#if PG_VERSION_NUM >= 140000
+
+	if (!cn->failed && pg_cryptohash_final(cn->ctx, digest, sizeof(digest)) < 0)
+		cn->failed = true;
+
+#else
+
+	pg_sha256_final(&cn->ctx, digest);
+
+#endif
+
+	if (cn->failed)
+	{
+		fprintf(stderr, "%s: cannot calculate hash of document\n",
+				cn->param->progname);
+		return -1;
+	}
+
+	hex_encode_bytes(hash, (const char *) digest, sizeof(digest));
+	hash[CANONICAL_HASH_LEN] = '\0';
+
+	return 0;
+}
+
+static void
+emit(Canonicalizer *cn, const char *data, size_t len)
+{
+	while (len > 0)
+	{
+		size_t		n = Min(len, (size_t) (CANON_BUFSIZE - cn->buflen));
+
+		memcpy(cn->buffer + cn->buflen, data, n);
+		cn->buflen += n;
+		data += n;
+		len -= n;
+
+		if (cn->buflen == CANON_BUFSIZE)
+			hash_flush(cn);
+	}
+}
+
+static void
+emit_char(Canonicalizer *cn, char c)
+{
+	if (cn->buflen == CANON_BUFSIZE)
+		hash_flush(cn);
+
+	cn->buffer[cn->buflen++] = c;
+}
+
+static void
+push_item(Canonicalizer *cn, const char *name, size_t namelen,
+		  const char *value, size_t valuelen)
+{
+	CanonItem  *item;
+
+	if (cn->nitems == cn->maxitems)
+	{
+		cn->maxitems = cn->maxitems > 0 ? cn->maxitems * 2 : 16;
+		cn->items = pg_realloc(cn->items, cn->maxitems * sizeof(CanonItem));
+	}
+
+	item = &cn->items[cn->nitems++];
+	item->name = name;
+	item->namelen = namelen;
+	item->value = value;
+	item->valuelen = valuelen;
+}
+
+static int
+compare_bytes(const char *a, size_t alen, const char *b, size_t blen)
+{
+	int			rc = memcmp(a, b, Min(alen, blen));
+
+	if (rc != 0)
+		return rc;
+
+	return alen < blen ? -1 : (alen > blen ? 1 : 0);
+}
+
+/*
+ * Items are sorted by names, the duplicate names (possible in JSON) by
+ * values, so the result doesn't depend on order in document.
+ */
+static int
+compare_items(const void *a, const void *b)
+{
+	const CanonItem *ia = (const CanonItem *) a;
+	const CanonItem *ib = (const CanonItem *) b;
+	int			rc;
+
+	rc = compare_bytes(ia->name, ia->namelen, ib->name, ib->namelen);
+	if (rc != 0)
+		return rc;
+
+	return compare_bytes(ia->value, ia->valuelen, ib->value, ib->valuelen);
+}
+
+static bool
+is_space(char c)
+{
+	return c == ' ' || c == '\t' || c == '\n' || c == '\r';
+}
+
+static const char *
+skip_spaces(const char *p, const char *end)
+{
+	while (p < end && is_space(*p))
+		p++;
+
+	return p;
+}
+
+/*
+ * Returns position of pattern in [p, end), or NULL
+ */
+static const char *
+find_bytes(const char *p, const char *end, const char *pattern)
+{
+	size_t		len = strlen(pattern);
+
+	while ((size_t) (end - p) >= len)
+	{
+		if (memcmp(p, pattern, len) == 0)
+			return p;
+		p++;
+	}
+
+	return NULL;
+}
+
+static bool
+starts_with(const char *p, const char *end, const char *pattern)
+{
+	size_t		len = strlen(pattern);
+
+	return (size_t) (end - p) >= len && memcmp(p, pattern, len) == 0;
+}
+
+/*
+ * Write text with escaped '&' (when escape_amp), '<', '>', and with
+ * normalized line ends. When attr is true, then the quotes are escaped
+ * and whitespaces are replaced by space like XML parser does.
+ */
+static void
+xml_emit_text(Canonicalizer *cn, const char *p, const char *end,
+			  bool escape_amp, bool attr)
+{
+	while (p < end)
+	{
+		char		c = *p++;
+
+		if (c == '\r')
+		{
+			if (p < end && *p == '\n')
+				p++;
+			emit_char(cn, attr ? ' ' : '\n');
+		}
+		else if (attr && (c == '\n' || c == '\t'))
+			emit_char(cn, ' ');
+		else if (attr && c == '"')
+			emit(cn, "&quot;", 6);
+		else if (c == '&' && escape_amp)
+			emit(cn, "&amp;", 5);
+		else if (c == '<')
+			emit(cn, "&lt;", 4);
+		else if (c == '>')
+			emit(cn, "&gt;", 4);
+		else
+			emit_char(cn, c);
+	}
+}
+
+static const char *
+xml_name_end(const char *p, const char *end)
+{
+	while (p < end && !is_space(*p) && *p != '/' && *p != '>' && *p != '=')
+		p++;
+
+	return p;
+}
+
+/*
+ * Process start tag (p points after '<'). Returns position after tag,
+ * or NULL when tag is broken.
+ */
+static const char *
+xml_start_tag(Canonicalizer *cn, const char *p, const char *end)
+{
+	const char *name = p;
+	size_t		namelen;
+	bool		empty = false;
+	int			i;
+
+	p = xml_name_end(p, end);
+	namelen = p - name;
+	if (namelen == 0)
+		return NULL;
+
+	cn->nitems = 0;
+
+	for (;;)
+	{
+		const char *aname;
+		const char *value;
+		char		quote;
+
+		p = skip_spaces(p, end);
+		if (p >= end)
+			return NULL;
+
+		if (*p == '>')
+		{
+			p++;
+			break;
+		}
+
+		if (*p == '/')
+		{
+			if (p + 1 >= end || p[1] != '>')
+				return NULL;
+			empty = true;
+			p += 2;
+			break;
+		}
+
+		aname = p;
+		p = xml_name_end(p, end);
+		if (p == aname)
+			return NULL;
+
+		value = skip_spaces(p, end);
+		if (value >= end || *value != '=')
+			return NULL;
+		value = skip_spaces(value + 1, end);
+		if (value >= end || (*value != '"' && *value != '\''))
+			return NULL;
+
+		quote = *value++;
+		p = memchr(value, quote, end - value);
+		if (!p)
+			return NULL;
+
+		push_item(cn, aname, xml_name_end(aname, end) - aname, value, p - value);
+		p++;
+	}
+
+	if (cn->nitems > 1)
+		qsort(cn->items, cn->nitems, sizeof(CanonItem), compare_items);
+
+	emit_char(cn, '<');
+	emit(cn, name, namelen);
+
+	for (i = 0; i < cn->nitems; i++)
+	{
+		emit_char(cn, ' ');
+		emit(cn, cn->items[i].name, cn->items[i].namelen);
+		emit(cn, "=\"", 2);
+		xml_emit_text(cn, cn->items[i].value,
+					  cn->items[i].value + cn->items[i].valuelen, false, true);
+		emit_char(cn, '"');
+	}
+
+	emit_char(cn, '>');
+
+	if (empty)
+	{
+		emit(cn, "</", 2);
+		emit(cn, name, namelen);
+		emit_char(cn, '>');
+	}
+
+	return p;
+}
+
+/*
+ * Skip DOCTYPE (p points after "<!"), the internal subset can contain
+ * '>' inside brackets or quotes.
+ */
+static const char *
+xml_skip_doctype(const char *p, const char *end)
+{
+	int			brackets = 0;
+	char		quote = '\0';
+
+	while (p < end)
+	{
+		char		c = *p++;
+
+		if (quote)
+		{
+			if (c == quote)
+				quote = '\0';
+		}
+		else if (c == '"' || c == '\'')
+			quote = c;
+		else if (c == '[')
+			brackets++;
+		else if (c == ']')
+			brackets--;
+		else if (c == '>' && brackets <= 0)
+			return p;
+	}
+
+	return NULL;
+}
+
+static bool
+canon_xml(Canonicalizer *cn, const char *p, const char *end)
+{
+	while (p < end)
+	{
+		if (*p != '<')
+		{
+			const char *text = p;
+
+			p = memchr(p, '<', end - p);
+			if (!p)
+				p = end;
+
+			/* the text with whitespaces only is ignored */
+			if (skip_spaces(text, p) < p)
+				xml_emit_text(cn, text, p, false, false);
+		}
+		else if (starts_with(p, end, "<?"))
+		{
+			const char *pi_end = find_bytes(p + 2, end, "?>");
+
+			if (!pi_end)
+				return false;
+
+			/* XML declaration is ignored, other processing instructions not */
+			if (!(starts_with(p, end, "<?xml") &&
+				  (is_space(p[5]) || p[5] == '?')))
+				emit(cn, p, pi_end + 2 - p);
+
+			p = pi_end + 2;
+		}
+		else if (starts_with(p, end, "<!--"))
+		{
+			p = find_bytes(p + 4, end, "-->");
+			if (!p)
+				return false;
+			p += 3;
+		}
+		else if (starts_with(p, end, "<![CDATA["))
+		{
+			const char *cdata_end = find_bytes(p + 9, end, "]]>");
+
+			if (!cdata_end)
+				return false;
+
+			xml_emit_text(cn, p + 9, cdata_end, true, false);
+			p = cdata_end + 3;
+		}
+		else if (starts_with(p, end, "<!"))
+		{
+			p = xml_skip_doctype(p + 2, end);
+			if (!p)
+				return false;
+		}
+		else if (starts_with(p, end, "</"))
+		{
+			const char *name = p + 2;
+			const char *name_end = xml_name_end(name, end);
+
+			p = skip_spaces(name_end, end);
+			if (name_end == name || p >= end || *p != '>')
+				return false;
+
+			emit(cn, "</", 2);
+			emit(cn, name, name_end - name);
+			emit_char(cn, '>');
+			p++;
+		}
+		else
+		{
+			p = xml_start_tag(cn, p + 1, end);
+			if (!p)
+				return false;
+		}
+	}
+
+	return true;
+}
+
+static bool json_value(Canonicalizer *cn, const char **pp, const char *end,
+					   bool output);
+
+/*
+ * Returns position after JSON string (p points to quote), or NULL
+ */
+static const char *
+json_string_end(const char *p, const char *end)
+{
+	for (p++; p < end; p++)
+	{
+		if (*p == '\\')
+			p++;
+		else if (*p == '"')
+			return p + 1;
+	}
+
+	return NULL;
+}
+
+/*
+ * Process JSON object (p points after '{'). When output is true, the
+ * members are collected first, and written sorted by keys.
+ */
+static bool
+json_object(Canonicalizer *cn, const char **pp, const char *end, bool output)
+{
+	const char *p = skip_spaces(*pp, end);
+	int			base = cn->nitems;
+	int			i;
+
+	if (p < end && *p == '}')
+		p++;
+	else
+	{
+		for (;;)
+		{
+			const char *key = p;
+			const char *value;
+
+			if (p >= end || *p != '"')
+				return false;
+			p = json_string_end(p, end);
+			if (!p)
+				return false;
+
+			value = skip_spaces(p, end);
+			if (value >= end || *value != ':')
+				return false;
+			value = skip_spaces(value + 1, end);
+
+			p = value;
+			if (!json_value(cn, &p, end, false))
+				return false;
+
+			if (output)
+				push_item(cn, key, json_string_end(key, end) - key,
+						  value, p - value);
+
+			p = skip_spaces(p, end);
+			if (p < end && *p == ',')
+			{
+				p = skip_spaces(p + 1, end);
+				continue;
+			}
+			if (p < end && *p == '}')
+			{
+				p++;
+				break;
+			}
+			return false;
+		}
+	}
+
+	*pp = p;
+
+	if (!output)
+		return true;
+
+	if (cn->nitems - base > 1)
+		qsort(cn->items + base, cn->nitems - base, sizeof(CanonItem), compare_items);
+
+	emit_char(cn, '{');
+
+	/* the nested objects push items above, so items are read by index */
+	for (i = base; i < cn->nitems; i++)
+	{
+		const char *value = cn->items[i].value;
+
+		if (i > base)
+			emit_char(cn, ',');
+		emit(cn, cn->items[i].name, cn->items[i].namelen);
+		emit_char(cn, ':');
+
+		if (!json_value(cn, &value, value + cn->items[i].valuelen, true))
+			return false;
+	}
+
+	emit_char(cn, '}');
+
+	cn->nitems = base;
+
+	return true;
+}
+
+static bool
+json_array(Canonicalizer *cn, const char **pp, const char *end, bool output)
+{
+	const char *p = skip_spaces(*pp, end);
+	bool		first = true;
+
+	if (output)
+		emit_char(cn, '[');
+
+	if (p < end && *p == ']')
+		p++;
+	else
+	{
+		for (;;)
+		{
+			if (output && !first)
+				emit_char(cn, ',');
+			first = false;
+
+			if (!json_value(cn, &p, end, output))
+				return false;
+
+			p = skip_spaces(p, end);
+			if (p < end && *p == ',')
+			{
+				p = skip_spaces(p + 1, end);
+				continue;
+			}
+			if (p < end && *p == ']')
+			{
+				p++;
+				break;
+			}
+			return false;
+		}
+	}
+
+	if (output)
+		emit_char(cn, ']');
+
+	*pp = p;
+
+	return true;
+}
+
+/*
+ * Parse JSON value on *pp, and write its canonical form, when output is
+ * true. The *pp is moved after value.
+ */
+static bool
+json_value(Canonicalizer *cn, const char **pp, const char *end, bool output)
+{
+	const char *p = *pp;
+	const char *value_end;
+	bool		ok;
+
+	if (p >= end)
+		return false;
+
+	if (*p == '{' || *p == '[')
+	{
+		if (++cn->depth > CANON_MAX_DEPTH)
+			return false;
+
+		*pp = p + 1;
+		if (*p == '{')
+			ok = json_object(cn, pp, end, output);
+		else
+			ok = json_array(cn, pp, end, output);
+
+		cn->depth--;
+
+		return ok;
+	}
+
+	if (*p == '"')
+		value_end = json_string_end(p, end);
+	else if (starts_with(p, end, "true"))
+		value_end = p + 4;
+	else if (starts_with(p, end, "false"))
+		value_end = p + 5;
+	else if (starts_with(p, end, "null"))
+		value_end = p + 4;
+	else
+	{
+		value_end = p;
+		while (value_end < end && strchr("+-0123456789.eE", *value_end))
+			value_end++;
+		if (value_end == p)
+			value_end = NULL;
+	}
+
+	if (!value_end)
+		return false;
+
+	if (output)
+		emit(cn, p, value_end - p);
+
+	*pp = value_end;
+
+	return true;
+}
+
+static bool
+canon_json(Canonicalizer *cn, const char *p, const char *end)
+{
+	p = skip_spaces(p, end);
+
+	if (!json_value(cn, &p, end, true))
+		return false;
+
+	return skip_spaces(p, end) == end;
+}
+
+Canonicalizer *
+canon_create(const struct _param * param)
+{
+	Canonicalizer *cn = pg_malloc0(sizeof(Canonicalizer));
+
+	cn->param = param;
+
+	return cn;
+}
+
+/*
+ * Calculate hash of canonical form of document. The hex encoded hash is
+ * written to target (CANONICAL_HASH_LEN + 1 bytes). Returns -1 on error.
+ */
+int
+canon_hash(Canonicalizer *cn, const char *data, size_t len, char *hash)
+{
+	const struct _param *param = cn->param;
+	bool		ok;
+
+	hash_start(cn);
+	cn->nitems = 0;
+	cn->depth = 0;
+
+	if (param->canonical_hash == CANONICAL_XML)
+		ok = canon_xml(cn, data, data + len);
+	else
+		ok = canon_json(cn, data, data + len);
+
+	if (!ok)
+	{
+		if (param->verbose)
+			fprintf(stderr, "%s: warning: document is not valid %s, hash of original data is used\n",
+					param->progname,
+					param->canonical_hash == CANONICAL_XML ? "XML" : "JSON");
+
+		hash_start(cn);
+		emit(cn, data, len);
+	}
+
+	return hash_finish(cn, hash);
+}
+
+void
+canon_free(Canonicalizer *cn)
+{
+#if PG_VERSION_NUM >= 140000
+
+	if (cn->ctx)
+		pg_cryptohash_free(cn->ctx);
+
+#endif
+
+	if (cn->items)
+		pg_free(cn->items);
+
+	pg_free(cn);
+}
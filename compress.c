@@ -0,0 +1,336 @@
+/*-------------------------------------------------------------------------
+ *
+ * compress.c
+ *	  adaptive compression of BYTEA documents
+ *
+ * The entropy of every document is estimated from a sample, and already
+ * compressed data (JPEG, PDF, ZIP, ...) are imported without compression.
+ * For other documents the codec with the best ratio is selected, whose
+ * speed is not lower than target throughput. The speed of every codec
+ * level is measured, so the selection is adapted to the real data and
+ * CPU. The name of used codec (none, lz4 or zstd) is passed as last
+ * parameter of the command.
+ *
+ * LZ4 data are in frame format, so they can be decompressed by any LZ4
+ * tool or library.
+ *
+ * IDENTIFICATION
+ *   compress.c
+ *
+ *-------------------------------------------------------------------------
+ */
+#include "postgres_fe.h"
+
+#include <math.h>
+#include <pthread.h>
+
+#ifdef USE_LZ4
+#include <lz4frame.h>
+#endif
+
+#ifdef USE_ZSTD
+#include <zstd.h>
+#endif
+
+#include "portability/instr_time.h"
+
+#include "pgimportdoc.h"
+
+/* smaller documents are not compressed */
+#define MIN_COMPRESS_SIZE		256
+
+/* the entropy is estimated from few chunks of document */
+#define SAMPLE_CHUNK_SIZE		4096
+#define SAMPLE_CHUNKS			4
+
+/* entropy (bits per byte) of data that cannot be compressed well */
+#define MAX_COMPRESSIBLE_ENTROPY	7.5
+
+/* speed of compression is measured only for documents of this size */
+#define MIN_MEASURED_SIZE		(64 * 1024)
+
+/* every Nth measured document probes the next level with better ratio */
+#define PROBE_INTERVAL			16
+
+typedef struct CodecLevel
+{
+	const char *name;
+	CompressMode codec;
+	int			level;
+	double		speed;			/* estimated MB/s, updated by measurements */
+} CodecLevel;
+
+/* ordered by compression ratio, initial speeds are usual values */
+static CodecLevel codec_levels[] = {
+#ifdef USE_LZ4
+	{"lz4", COMPRESS_LZ4, 0, 600.0},
+#endif
+#ifdef USE_ZSTD
+	{"zstd", COMPRESS_ZSTD, 1, 350.0},
+	{"zstd", COMPRESS_ZSTD, 3, 250.0},
+	{"zstd", COMPRESS_ZSTD, 6, 100.0},
+	{"zstd", COMPRESS_ZSTD, 9, 60.0},
+	{"zstd", COMPRESS_ZSTD, 15, 20.0},
+#endif
+	{NULL}
+};
+
+/* protects speeds, the documents can be compressed by more workers */
+static pthread_mutex_t speed_mutex = PTHREAD_MUTEX_INITIALIZER;
+static int64 nmeasured = 0;
+
+/*
+ * Returns true when pgimportdoc was built with support of codec
+ */
+bool
+compress_supported(CompressMode mode)
+{
+	int			i;
+
+	for (i = 0; codec_levels[i].name; i++)
+		if (mode == COMPRESS_AUTO || codec_levels[i].codec == mode)
+			return true;
+
+	return false;
+}
+
+/*
+ * Returns true when level is supported by zstd library
+ */
+bool
+compress_zstd_level_valid(int level)
+{
+#ifdef USE_ZSTD
+
+	return level >= ZSTD_minCLevel() && level <= ZSTD_maxCLevel();
+
+#else
+
+	return false;
+
+#endif
+}
+
+/*
+ * Estimate entropy (bits per byte) from the histogram of sample of data
+ */
+static double
+estimate_entropy(const char *data, size_t len)
+{
+	const unsigned char *ptr = (const unsigned char *) data;
+	uint32		counts[256];
+	size_t		total = 0;
+	double		entropy = 0.0;
+	int			i;
+
+	memset(counts, 0, sizeof(counts));
+
+	if (len <= SAMPLE_CHUNK_SIZE * SAMPLE_CHUNKS)
+	{
+		size_t		j;
+
+		for (j = 0; j < len; j++)
+			counts[ptr[j]]++;
+
+		total = len;
+	}
+	else
+	{
+		/* chunks are spread over document */
+		for (i = 0; i < SAMPLE_CHUNKS; i++)
+		{
+			const unsigned char *chunk;
+			size_t		j;
+
+			chunk = ptr + (len - SAMPLE_CHUNK_SIZE) / (SAMPLE_CHUNKS - 1) * i;
+
+			for (j = 0; j < SAMPLE_CHUNK_SIZE; j++)
+				counts[chunk[j]]++;
+		}
+
+		total = SAMPLE_CHUNK_SIZE * SAMPLE_CHUNKS;
+	}
+
+	for (i = 0; i < 256; i++)
+	{
+		if (counts[i] > 0)
+		{
+			double		p = (double) counts[i] / total;
+
+			entropy -= p * log2(p);
+		}
+	}
+
+	return entropy;
+}
+
+/*
+ * Select the codec with best ratio, that is fast enough. The speed is
+ * updated only for used level, so one slow measurement could exclude the
+ * level forever. Sometimes the next level (with better ratio) is used for
+ * the document, that will be measured, so its speed can recover.
+ */
+static CodecLevel *
+choose_codec_level(size_t len, const struct _param * param)
+{
+	CodecLevel *result = NULL;
+	int			i;
+
+	pthread_mutex_lock(&speed_mutex);
+
+	for (i = 0; codec_levels[i].name; i++)
+	{
+		/* the fastest is used when no codec is fast enough */
+		if (!result || codec_levels[i].speed >= param->compress_target)
+			result = &codec_levels[i];
+	}
+
+	if (len >= MIN_MEASURED_SIZE && ++nmeasured % PROBE_INTERVAL == 0 &&
+		result[1].name)
+		result++;
+
+	pthread_mutex_unlock(&speed_mutex);
+
+	return result;
+}
+
+/*
+ * Compress data to buf. Returns size of compressed data, or 0 on error.
+ */
+static size_t
+compress_data(PQExpBuffer buf, const char *data, size_t len,
+			  CompressMode codec, int level, const struct _param * param)
+{
+	size_t		bound = 0;
+	size_t		result = 0;
+
+	resetPQExpBuffer(buf);
+
+#ifdef USE_LZ4
+	if (codec == COMPRESS_LZ4)
+		bound = LZ4F_compressFrameBound(len, NULL);
+#endif
+#ifdef USE_ZSTD
+	if (codec == COMPRESS_ZSTD)
+		bound = ZSTD_compressBound(len);
+#endif
+
+	if (bound == 0 || !enlargePQExpBuffer(buf, bound))
+	{
+		fprintf(stderr, "%s: Out of memory\n", param->progname);
+		return 0;
+	}
+
+#ifdef USE_LZ4
+	if (codec == COMPRESS_LZ4)
+	{
+		result = LZ4F_compressFrame(buf->data, bound, data, len, NULL);
+		if (LZ4F_isError(result))
+		{
+			fprintf(stderr, "%s: lz4 compression failed: %s\n",
+					param->progname, LZ4F_getErrorName(result));
+			return 0;
+		}
+	}
+#endif
+#ifdef USE_ZSTD
+	if (codec == COMPRESS_ZSTD)
+	{
+		result = ZSTD_compress(buf->data, bound, data, len, level);
+		if (ZSTD_isError(result))
+		{
+			fprintf(stderr, "%s: zstd compression failed: %s\n",
+					param->progname, ZSTD_getErrorName(result));
+			return 0;
+		}
+	}
+#endif
+
+	buf->len = result;
+
+	return result;
+}
+
+/*
+ * Compress document. When the document is compressed, then *data and
+ * *len are replaced by compressed data stored in buf. Returns the name of
+ * used codec, or NULL on error.
+ */
+const char *
+compress_document(PQExpBuffer buf, const char **data, size_t *len,
+				  const struct _param * param)
+{
+	CodecLevel	forced;
+	CodecLevel *cl;
+	instr_time	start;
+	instr_time	duration;
+	size_t		clen;
+
+	if (*len < MIN_COMPRESS_SIZE)
+		return "none";
+
+	if (param->compress == COMPRESS_AUTO)
+	{
+		double		entropy = estimate_entropy(*data, *len);
+
+		if (entropy > MAX_COMPRESSIBLE_ENTROPY)
+		{
+			if (param->verbose)
+				fprintf(stdout, "Document of size %zu is not compressed (entropy %.2f)\n",
+						*len, entropy);
+
+			return "none";
+		}
+
+		cl = choose_codec_level(*len, param);
+	}
+	else
+	{
+		forced.name = param->compress == COMPRESS_LZ4 ? "lz4" : "zstd";
+		forced.codec = param->compress;
+		forced.level = param->compress_level;
+		forced.speed = 0.0;
+		cl = &forced;
+	}
+
+	INSTR_TIME_SET_CURRENT(start);
+
+	clen = compress_data(buf, *data, *len, cl->codec, cl->level, param);
+	if (clen == 0)
+		return NULL;
+
+	INSTR_TIME_SET_CURRENT(duration);
+	INSTR_TIME_SUBTRACT(duration, start);
+
+	/* update estimated speed of codec level */
+	if (cl != &forced && *len >= MIN_MEASURED_SIZE &&
+		INSTR_TIME_GET_DOUBLE(duration) > 0.0)
+	{
+		double		speed;
+
+		speed = *len / INSTR_TIME_GET_DOUBLE(duration) / (1024.0 * 1024.0);
+
+		pthread_mutex_lock(&speed_mutex);
+		cl->speed = 0.8 * cl->speed + 0.2 * speed;
+		pthread_mutex_unlock(&speed_mutex);
+	}
+
+	if (param->verbose)
+	{
+		if (cl->codec == COMPRESS_ZSTD)
+			fprintf(stdout, "Document of size %zu compressed to %zu by zstd:%d\n",
+					*len, clen, cl->level);
+		else
+			fprintf(stdout, "Document of size %zu compressed to %zu by %s\n",
+					*len, clen, cl->name);
+	}
+
+	/* compression is not useful */
+	if (clen >= *len - *len / 32)
+		return "none";
+
+	*data = buf->data;
+	*len = clen;
+
+	return cl->name;
+}
@@ -0,0 +1,154 @@
+/*-------------------------------------------------------------------------
+ *
+ * copysock.c
+ *	  writing of COPY data directly to the socket of connection
+ *
+ * PQputCopyData copies every chunk to the output buffer of libpq before
+ * it is sent. For very large documents the CopyData messages can be
+ * written directly to the socket by sendmsg (writev) - the header of
+ * message and the escaped chunk are sent without any copy. It is possible
+ * only when the connection is not encrypted. Like libpq, the write to the
+ * socket closed by server doesn't raise SIGPIPE. libpq starts and finishes
+ * the COPY, only the data are sent around libpq.
+ *
+ * IDENTIFICATION
+ *   copysock.c
+ *
+ *-------------------------------------------------------------------------
+ */
+#include "postgres_fe.h"
+
+#ifndef WIN32
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#endif
+
+#include "pgimportdoc.h"
+
+/*
+ * Returns true, when the COPY data can be written directly to socket.
+ * The output buffer of libpq is flushed.
+ */
+bool
+copy_direct_start(PGconn *conn, const struct _param * param)
+{
+#ifndef WIN32
+	if (PQsslInUse(conn))
+	{
+		if (param->verbose)
+			fprintf(stdout, "SSL is used, COPY data are sent by libpq\n");
+		return false;
+	}
+
+#if PG_VERSION_NUM >= 120000
+	if (PQgssEncInUse(conn))
+	{
+		if (param->verbose)
+			fprintf(stdout, "GSSAPI encryption is used, COPY data are sent by libpq\n");
+		return false;
+	}
+#endif
+
+	/* nothing of libpq can be sent after our data */
+	if (PQflush(conn) != 0)
+		return false;
+
+	return true;
+#else
+	return false;
+#endif
+}
+
+/*
+ * Send one CopyData message. It has same interface like PQputCopyData
+ * (returns 1 on success, -1 on error). After an error the connection
+ * should not be used, because a part of message can be sent.
+ */
+int
+copy_direct_put(PGconn *conn, const char *buffer, int nbytes)
+{
+#ifndef WIN32
+	unsigned char header[5];
+	struct iovec iov[2];
+	uint32		msglen = (uint32) nbytes + 4;
+	int			sock = PQsocket(conn);
+	int			iovcnt = 2;
+
+	if (nbytes == 0)
+		return 1;
+
+	header[0] = 'd';
+	header[1] = (unsigned char) (msglen >> 24);
+	header[2] = (unsigned char) (msglen >> 16);
+	header[3] = (unsigned char) (msglen >> 8);
+	header[4] = (unsigned char) msglen;
+
+	iov[0].iov_base = header;
+	iov[0].iov_len = sizeof(header);
+	iov[1].iov_base = (char *) buffer;
+	iov[1].iov_len = nbytes;
+
+	while (iovcnt > 0)
+	{
+		ssize_t		written;
+		struct iovec *iovp = &iov[2 - iovcnt];
+
+#ifdef MSG_NOSIGNAL
+		{
+			struct msghdr msg;
+
+			memset(&msg, 0, sizeof(msg));
+			msg.msg_iov = iovp;
+			msg.msg_iovlen = iovcnt;
+
+			written = sendmsg(sock, &msg, MSG_NOSIGNAL);
+		}
+#else
+		/* libpq sets SO_NOSIGPIPE where MSG_NOSIGNAL is not available */
+		written = writev(sock, iovp, iovcnt);
+#endif
+
+		if (written < 0)
+		{
+			/* libpq uses nonblocking socket */
+			if (errno == EAGAIN || errno == EWOULDBLOCK)
+			{
+				struct pollfd pfd;
+
+				pfd.fd = sock;
+				pfd.events = POLLOUT;
+				pfd.revents = 0;
+
+				if (poll(&pfd, 1, -1) < 0 && errno != EINTR)
+					return -1;
+
+				continue;
+			}
+
+			if (errno == EINTR)
+				continue;
+
+			return -1;
+		}
+
+		/* skip sent data */
+		while (iovcnt > 0 && (size_t) written >= iovp->iov_len)
+		{
+			written -= iovp->iov_len;
+			iovp++;
+			iovcnt--;
+		}
+
+		if (iovcnt > 0)
+		{
+			iovp->iov_base = (char *) iovp->iov_base + written;
+			iovp->iov_len -= written;
+		}
+	}
+
+	return 1;
+#else
+	return -1;
+#endif
+}
@@ -0,0 +1,645 @@
+/*-------------------------------------------------------------------------
+ *
+ * decompress.c
+ *	  parallel decompression of compressed input files
+ *
+ * Compressed regular file (zstd or gzip) used as FIFO input is mapped to
+ * memory, and it is decompressed by more threads. The file is split to
+ * independent segments - zstd frames (files compressed by pzstd, or
+ * concatenated compressed parts), or gzip members with BGZF header
+ * (files compressed by bgzip). Every thread takes next segment,
+ * decompresses it to own buffer, and waits for its turn, so the data are
+ * written in original order to pipe, that is read like any other FIFO
+ * (the documents are framed and imported by workers). When the buffer is
+ * too big (the file has only one frame, or plain gzip file, that cannot
+ * be split), the thread writes data continuously in its turn.
+ *
+ * IDENTIFICATION
+ *   decompress.c
+ *
+ *-------------------------------------------------------------------------
+ */
+#include "postgres_fe.h"
+
+#ifndef WIN32
+
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#ifdef USE_ZSTD
+#include <zstd.h>
+#endif
+
+#ifdef HAVE_LIBZ
+#include <zlib.h>
+#endif
+
+#include "pgimportdoc.h"
+
+/* size of one step of decompression */
+#define DECOMPRESS_CHUNK_SIZE	(256 * 1024)
+
+/*
+ * Decompressed data are written in turn of segment, when the buffer is
+ * bigger than this limit.
+ */
+#define DECOMPRESS_BUFFER_LIMIT	(64 * 1024 * 1024)
+
+typedef enum DecompressFormat
+{
+	DECOMPRESS_ZSTD,
+	DECOMPRESS_GZIP
+} DecompressFormat;
+
+struct Decompressor
+{
+	const struct _param *param;
+	const char *path;
+	DecompressFormat format;
+	const char *data;			/* mapped file */
+	size_t		size;
+	int			pipe_fd;		/* write end of pipe */
+	pthread_mutex_t mutex;
+	pthread_cond_t turn;
+	size_t		next_offset;	/* start of next segment */
+	int64		next_segment;	/* number of next segment */
+	int64		next_write;		/* number of segment, that is written */
+	int			nrunning;		/* last thread closes pipe */
+	bool		failed;
+	pthread_t  *threads;
+	int			nthreads;
+};
+
+/*
+ * Thread's state of decompression of one segment
+ */
+typedef struct SegmentWriter
+{
+	Decompressor *dc;
+	int64		segment;
+	bool		has_turn;		/* previous segments are written */
+	PQExpBufferData buf;
+} SegmentWriter;
+
+static void
+set_failed(Decompressor *dc)
+{
+	pthread_mutex_lock(&dc->mutex);
+	dc->failed = true;
+	pthread_cond_broadcast(&dc->turn);
+	pthread_mutex_unlock(&dc->mutex);
+}
+
+/*
+ * Returns size of segment starting on offset, or 0 when the data are
+ * broken. The scan reads only headers.
+ */
+static size_t
+segment_size(Decompressor *dc, size_t offset)
+{
+	const unsigned char *p = (const unsigned char *) dc->data + offset;
+	size_t		avail = dc->size - offset;
+
+	if (dc->format == DECOMPRESS_ZSTD)
+	{
+#ifdef USE_ZSTD
+
+		size_t		size = ZSTD_findFrameCompressedSize(p, avail);
+
+		if (ZSTD_isError(size))
+		{
+			fprintf(stderr, "%s: Cannot decompress '%s': %s\n",
+					dc->param->progname, dc->path, ZSTD_getErrorName(size));
+			return 0;
+		}
+
+		return size;
+
+#endif
+	}
+	else
+	{
+		/* the BGZF member has its size in extra field "BC" */
+		if (avail >= 18 && p[0] == 0x1f && p[1] == 0x8b && p[2] == 8 &&
+			(p[3] & 0x04) != 0)
+		{
+			size_t		xlen = p[10] | (p[11] << 8);
+			size_t		pos = 12;
+
+			while (pos + 4 <= 12 + xlen && pos + 4 <= avail)
+			{
+				size_t		slen = p[pos + 2] | (p[pos + 3] << 8);
+
+				if (p[pos] == 'B' && p[pos + 1] == 'C' && slen == 2 &&
+					pos + 6 <= avail)
+				{
+					size_t		bsize = (p[pos + 4] | (p[pos + 5] << 8)) + 1;
+
+					return Min(bsize, avail);
+				}
+
+				pos += 4 + slen;
+			}
+		}
+
+		/* plain gzip cannot be split, rest of file is one segment */
+		return avail;
+	}
+
+	return 0;
+}
+
+/*
+ * Wait until previous segments are written. Returns false when
+ * decompression failed.
+ */
+static bool
+wait_turn(SegmentWriter *sw)
+{
+	Decompressor *dc = sw->dc;
+	bool		failed;
+
+	if (sw->has_turn)
+		return true;
+
+	pthread_mutex_lock(&dc->mutex);
+	while (!dc->failed && dc->next_write != sw->segment)
+		pthread_cond_wait(&dc->turn, &dc->mutex);
+	failed = dc->failed;
+	pthread_mutex_unlock(&dc->mutex);
+
+	sw->has_turn = !failed;
+
+	return !failed;
+}
+
+/*
+ * Write buffered data to pipe, when it is the turn of segment (or when
+ * force is true). Returns false on error.
+ */
+static bool
+flush_segment(SegmentWriter *sw, bool force)
+{
+	Decompressor *dc = sw->dc;
+	const char *p = sw->buf.data;
+	size_t		len = sw->buf.len;
+
+	if (!force && len < DECOMPRESS_BUFFER_LIMIT && !sw->has_turn)
+		return true;
+
+	if (!wait_turn(sw))
+		return false;
+
+	while (len > 0)
+	{
+		ssize_t		n = write(dc->pipe_fd, p, len);
+
+		if (n < 0)
+		{
+			if (errno == EINTR)
+				continue;
+
+			/* the reader is closed on error of import, it is not reported */
+			if (errno != EPIPE)
+				fprintf(stderr, "%s: Cannot write decompressed data of '%s': %s\n",
+						dc->param->progname, dc->path, strerror(errno));
+			return false;
+		}
+
+		p += n;
+		len -= n;
+	}
+
+	resetPQExpBuffer(&sw->buf);
+
+	return true;
+}
+
+/*
+ * Reserve space for next step of decompression
+ */
+static bool
+enlarge_segment(SegmentWriter *sw)
+{
+	if (!enlargePQExpBuffer(&sw->buf, DECOMPRESS_CHUNK_SIZE))
+	{
+		fprintf(stderr, "%s: Out of memory\n", sw->dc->param->progname);
+		return false;
+	}
+
+	return true;
+}
+
+#ifdef USE_ZSTD
+
+static bool
+decompress_zstd(SegmentWriter *sw, ZSTD_DCtx *dctx, const char *data,
+				size_t len)
+{
+	ZSTD_inBuffer in = {data, len, 0};
+	size_t		rc = 1;
+
+	ZSTD_DCtx_reset(dctx, ZSTD_reset_session_only);
+
+	while (in.pos < in.size || rc != 0)
+	{
+		ZSTD_outBuffer out;
+
+		if (!enlarge_segment(sw))
+			return false;
+
+		out.dst = sw->buf.data + sw->buf.len;
+		out.size = DECOMPRESS_CHUNK_SIZE;
+		out.pos = 0;
+
+		rc = ZSTD_decompressStream(dctx, &out, &in);
+		if (ZSTD_isError(rc))
+		{
+			fprintf(stderr, "%s: Cannot decompress '%s': %s\n",
+					sw->dc->param->progname, sw->dc->path, ZSTD_getErrorName(rc));
+			return false;
+		}
+
+		sw->buf.len += out.pos;
+
+		/* the frame is not complete */
+		if (in.pos == in.size && rc != 0 && out.pos == 0)
+		{
+			fprintf(stderr, "%s: Cannot decompress '%s': truncated data\n",
+					sw->dc->param->progname, sw->dc->path);
+			return false;
+		}
+
+		if (!flush_segment(sw, false))
+			return false;
+	}
+
+	return true;
+}
+
+#endif
+
+#ifdef HAVE_LIBZ
+
+/*
+ * Decompress one or more (concatenated) gzip members
+ */
+static bool
+decompress_gzip(SegmentWriter *sw, z_stream *zs, const char *data,
+				size_t len)
+{
+	int			rc = Z_OK;
+
+	inflateReset(zs);
+
+	zs->next_in = (Bytef *) data;
+	zs->avail_in = 0;
+
+	for (;;)
+	{
+		/* avail_in is 32bit */
+		if (zs->avail_in == 0)
+		{
+			size_t		consumed = (const char *) zs->next_in - data;
+
+			zs->avail_in = Min(len - consumed, (size_t) UINT_MAX);
+		}
+
+		if (rc == Z_STREAM_END)
+		{
+			/* next member follows */
+			if (zs->avail_in == 0)
+				break;
+
+			inflateReset(zs);
+		}
+
+		if (!enlarge_segment(sw))
+			return false;
+
+		zs->next_out = (Bytef *) sw->buf.data + sw->buf.len;
+		zs->avail_out = DECOMPRESS_CHUNK_SIZE;
+
+		rc = inflate(zs, Z_NO_FLUSH);
+		sw->buf.len += DECOMPRESS_CHUNK_SIZE - zs->avail_out;
+
+		if (rc != Z_OK && rc != Z_STREAM_END)
+		{
+			fprintf(stderr, "%s: Cannot decompress '%s': %s\n",
+					sw->dc->param->progname, sw->dc->path,
+					rc == Z_BUF_ERROR ? "truncated data" :
+					zs->msg ? zs->msg : "broken data");
+			return false;
+		}
+
+		if (!flush_segment(sw, false))
+			return false;
+	}
+
+	return true;
+}
+
+#endif
+
+static void *
+decompress_thread(void *arg)
+{
+	Decompressor *dc = (Decompressor *) arg;
+	SegmentWriter sw;
+	sigset_t	sigpipe;
+	bool		close_pipe;
+
+#ifdef USE_ZSTD
+	ZSTD_DCtx  *dctx = NULL;
+#endif
+
+#ifdef HAVE_LIBZ
+	z_stream	zs;
+	bool		zs_ready = false;
+#endif
+
+	/* write to closed pipe returns EPIPE */
+	sigemptyset(&sigpipe);
+	sigaddset(&sigpipe, SIGPIPE);
+	pthread_sigmask(SIG_BLOCK, &sigpipe, NULL);
+
+	sw.dc = dc;
+	initPQExpBuffer(&sw.buf);
+
+#ifdef USE_ZSTD
+	if (dc->format == DECOMPRESS_ZSTD && !(dctx = ZSTD_createDCtx()))
+		set_failed(dc);
+#endif
+
+#ifdef HAVE_LIBZ
+	if (dc->format == DECOMPRESS_GZIP)
+	{
+		memset(&zs, 0, sizeof(zs));
+		if (inflateInit2(&zs, 16 + MAX_WBITS) != Z_OK)
+			set_failed(dc);
+		else
+			zs_ready = true;
+	}
+#endif
+
+	for (;;)
+	{
+		size_t		offset;
+		size_t		len = 0;
+		bool		ok = false;
+
+		pthread_mutex_lock(&dc->mutex);
+
+		if (dc->failed || dc->next_offset >= dc->size)
+		{
+			pthread_mutex_unlock(&dc->mutex);
+			break;
+		}
+
+		offset = dc->next_offset;
+		len = segment_size(dc, offset);
+		if (len == 0)
+		{
+			dc->failed = true;
+			pthread_cond_broadcast(&dc->turn);
+			pthread_mutex_unlock(&dc->mutex);
+			break;
+		}
+
+		sw.segment = dc->next_segment++;
+		dc->next_offset += len;
+
+		pthread_mutex_unlock(&dc->mutex);
+
+		sw.has_turn = false;
+		resetPQExpBuffer(&sw.buf);
+
+#ifdef USE_ZSTD
+		if (dc->format == DECOMPRESS_ZSTD)
+			ok = decompress_zstd(&sw, dctx, dc->data + offset, len);
+#endif
+
+#ifdef HAVE_LIBZ
+		if (dc->format == DECOMPRESS_GZIP)
+			ok = decompress_gzip(&sw, &zs, dc->data + offset, len);
+#endif
+
+		if (!ok || !flush_segment(&sw, true))
+		{
+			set_failed(dc);
+			break;
+		}
+
+		pthread_mutex_lock(&dc->mutex);
+		dc->next_write += 1;
+		pthread_cond_broadcast(&dc->turn);
+		pthread_mutex_unlock(&dc->mutex);
+	}
+
+#ifdef USE_ZSTD
+	if (dctx)
+		ZSTD_freeDCtx(dctx);
+#endif
+
+#ifdef HAVE_LIBZ
+	if (zs_ready)
+		inflateEnd(&zs);
+#endif
+
+	termPQExpBuffer(&sw.buf);
+
+	pthread_mutex_lock(&dc->mutex);
+	close_pipe = --dc->nrunning == 0;
+	pthread_mutex_unlock(&dc->mutex);
+
+	/* the reader gets EOF after all data */
+	if (close_pipe)
+		close(dc->pipe_fd);
+
+	return NULL;
+}
+
+/*
+ * When the file opened as *fd is compressed regular file, then the
+ * decompression threads are started, and *fd is replaced by read end of
+ * pipe with decompressed data. Returns -1 on error.
+ */
+int
+decompress_start(Decompressor **result, const char *path, int *fd,
+				 const struct _param * param)
+{
+	Decompressor *dc;
+	struct stat st;
+	const unsigned char *magic;
+	DecompressFormat format;
+	void	   *data;
+	int			pipefd[2];
+	sigset_t	sigset;
+	int			nthreads;
+	int			i;
+
+	*result = NULL;
+
+	if (fstat(*fd, &st) != 0 || !S_ISREG(st.st_mode) || st.st_size < 4)
+		return 0;
+
+	data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, *fd, 0);
+	if (data == MAP_FAILED)
+	{
+		fprintf(stderr, "%s: Cannot map '%s': %s\n",
+				param->progname, path, strerror(errno));
+		return -1;
+	}
+
+	magic = data;
+	if (magic[0] == 0x28 && magic[1] == 0xb5 && magic[2] == 0x2f && magic[3] == 0xfd)
+		format = DECOMPRESS_ZSTD;
+	else if (magic[0] == 0x1f && magic[1] == 0x8b)
+		format = DECOMPRESS_GZIP;
+	else
+	{
+		/* not compressed file is read directly */
+		munmap(data, st.st_size);
+		return 0;
+	}
+
+#ifndef USE_ZSTD
+	if (format == DECOMPRESS_ZSTD)
+	{
+		fprintf(stderr, "%s: zstd is not supported by this build, '%s' cannot be decompressed\n",
+				param->progname, path);
+		munmap(data, st.st_size);
+		return -1;
+	}
+#endif
+
+#ifndef HAVE_LIBZ
+	if (format == DECOMPRESS_GZIP)
+	{
+		fprintf(stderr, "%s: gzip is not supported by this build, '%s' cannot be decompressed\n",
+				param->progname, path);
+		munmap(data, st.st_size);
+		return -1;
+	}
+#endif
+
+	if (pipe(pipefd) != 0 || fcntl(pipefd[0], F_SETFL, O_NONBLOCK) != 0)
+	{
+		fprintf(stderr, "%s: Cannot create pipe: %s\n",
+				param->progname, strerror(errno));
+		munmap(data, st.st_size);
+		return -1;
+	}
+
+	madvise(data, st.st_size, MADV_SEQUENTIAL);
+
+	nthreads = param->decompress_jobs > 0 ? param->decompress_jobs : param->jobs;
+
+	dc = pg_malloc0(sizeof(Decompressor));
+	dc->param = param;
+	dc->path = path;
+	dc->format = format;
+	dc->data = data;
+	dc->size = st.st_size;
+	dc->pipe_fd = pipefd[1];
+	pthread_mutex_init(&dc->mutex, NULL);
+	pthread_cond_init(&dc->turn, NULL);
+	dc->threads = pg_malloc(nthreads * sizeof(pthread_t));
+
+	/* the mapping doesn't need the file */
+	close(*fd);
+	*fd = pipefd[0];
+	*result = dc;
+
+	/* the pipe is closed by last finished thread */
+	dc->nrunning = nthreads;
+
+	/* SIGINT and SIGTERM are handled by the thread reading the pipe */
+	sigemptyset(&sigset);
+	sigaddset(&sigset, SIGINT);
+	sigaddset(&sigset, SIGTERM);
+
+	for (i = 0; i < nthreads; i++)
+	{
+		sigset_t	oldset;
+		int			rc;
+
+		pthread_sigmask(SIG_BLOCK, &sigset, &oldset);
+		rc = pthread_create(&dc->threads[i], NULL, decompress_thread, dc);
+		pthread_sigmask(SIG_SETMASK, &oldset, NULL);
+
+		if (rc != 0)
+		{
+			bool		close_pipe;
+
+			fprintf(stderr, "%s: cannot create thread: %s\n",
+					param->progname, strerror(rc));
+
+			pthread_mutex_lock(&dc->mutex);
+			dc->failed = true;
+			pthread_cond_broadcast(&dc->turn);
+			dc->nrunning -= nthreads - i;
+			close_pipe = dc->nrunning == 0;
+			pthread_mutex_unlock(&dc->mutex);
+
+			if (close_pipe)
+				close(dc->pipe_fd);
+
+			return -1;
+		}
+
+		dc->nthreads += 1;
+	}
+
+	if (param->verbose)
+		fprintf(stdout, "Input '%s' is decompressed (%s) by %d threads\n",
+				path, format == DECOMPRESS_ZSTD ? "zstd" : "gzip", nthreads);
+
+	return 0;
+}
+
+/*
+ * Returns true, when the decompression failed. The reader should check it
+ * after EOF.
+ */
+bool
+decompress_failed(Decompressor *dc)
+{
+	bool		failed;
+
+	pthread_mutex_lock(&dc->mutex);
+	failed = dc->failed;
+	pthread_mutex_unlock(&dc->mutex);
+
+	return failed;
+}
+
+/*
+ * Wait for decompression threads and release resources. The read end of
+ * pipe should be closed before, so the threads are not blocked.
+ */
+void
+decompress_end(Decompressor *dc)
+{
+	int			i;
+
+	/* threads waiting for their turn (after error of import) are stopped */
+	set_failed(dc);
+
+	for (i = 0; i < dc->nthreads; i++)
+		pthread_join(dc->threads[i], NULL);
+
+	munmap((void *) dc->data, dc->size);
+
+	pthread_mutex_destroy(&dc->mutex);
+	pthread_cond_destroy(&dc->turn);
+	pg_free(dc->threads);
+	pg_free(dc);
+}
+
+#endif							/* WIN32 */
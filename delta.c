@@ -0,0 +1,424 @@
+/*-------------------------------------------------------------------------
+ *
+ * delta.c
+ *	  delta encoding of new versions of frequently revised documents
+ *
+ * The previous version of the document (identified by a key) and the id
+ * returned by the import command are stored in local cache directory.
+ * The new version is imported as binary delta against the previous
+ * version, and the id of previous version is passed as second parameter
+ * (it is NULL for full version). After keyframe interval, or when the
+ * delta is not smaller, the full version (keyframe) is imported.
+ *
+ * The delta is similar to VCDIFF, but simpler. The header is "PGD1" and
+ * the length of the target in 4 bytes, then the instructions follow
+ * (all numbers are 4 bytes in network byte order):
+ *
+ *   0x01 OFFSET LENGTH		copy LENGTH bytes from base at OFFSET
+ *   0x02 LENGTH DATA		add LENGTH bytes of DATA
+ *
+ * The matches are found by rolling hash of target compared with hashes
+ * of aligned blocks of base.
+ *
+ * IDENTIFICATION
+ *   delta.c
+ *
+ *-------------------------------------------------------------------------
+ */
+#include "postgres_fe.h"
+
+#include <sys/stat.h>
+
+#ifndef WIN32
+#include <unistd.h>
+#endif
+
+#include "pgimportdoc.h"
+
+#define DELTA_MAGIC			"PGD1"
+#define DELTA_BLOCK			16
+#define DELTA_OP_COPY		0x01
+#define DELTA_OP_ADD		0x02
+
+/* multiplier of rolling hash */
+#define HASH_MULT			0x01000193
+
+static void
+append_uint32(PQExpBuffer buf, uint32 value)
+{
+	char		bytes[4];
+
+	bytes[0] = (char) (value >> 24);
+	bytes[1] = (char) (value >> 16);
+	bytes[2] = (char) (value >> 8);
+	bytes[3] = (char) value;
+
+	appendBinaryPQExpBuffer(buf, bytes, 4);
+}
+
+static void
+emit_add(PQExpBuffer delta, const char *data, size_t len)
+{
+	if (len == 0)
+		return;
+
+	appendPQExpBufferChar(delta, DELTA_OP_ADD);
+	append_uint32(delta, (uint32) len);
+	appendBinaryPQExpBuffer(delta, data, len);
+}
+
+static void
+emit_copy(PQExpBuffer delta, size_t offset, size_t len)
+{
+	appendPQExpBufferChar(delta, DELTA_OP_COPY);
+	append_uint32(delta, (uint32) offset);
+	append_uint32(delta, (uint32) len);
+}
+
+static uint32
+block_hash(const unsigned char *data)
+{
+	uint32		h = 0;
+	int			i;
+
+	for (i = 0; i < DELTA_BLOCK; i++)
+		h = h * HASH_MULT + data[i];
+
+	return h;
+}
+
+/*
+ * Compute delta of target against base
+ */
+static void
+delta_compute(PQExpBuffer delta,
+			  const char *base, size_t blen,
+			  const char *target, size_t tlen)
+{
+	const unsigned char *b = (const unsigned char *) base;
+	const unsigned char *t = (const unsigned char *) target;
+	int32	   *table = NULL;
+	uint32		mask = 0;
+	uint32		outmult = 1;
+	uint32		h = 0;
+	size_t		lit = 0;
+	size_t		i = 0;
+	int			k;
+
+	resetPQExpBuffer(delta);
+	appendBinaryPQExpBuffer(delta, DELTA_MAGIC, 4);
+	append_uint32(delta, (uint32) tlen);
+
+	if (blen >= DELTA_BLOCK && tlen >= DELTA_BLOCK)
+	{
+		size_t		nblocks = blen / DELTA_BLOCK;
+		size_t		size = 1024;
+		size_t		j;
+
+		/* direct mapped table of offsets of aligned blocks */
+		while (size < nblocks * 2)
+			size *= 2;
+
+		mask = (uint32) (size - 1);
+		table = pg_malloc(size * sizeof(int32));
+		memset(table, -1, size * sizeof(int32));
+
+		for (j = 0; j < nblocks; j++)
+		{
+			uint32		slot = block_hash(b + j * DELTA_BLOCK) & mask;
+
+			if (table[slot] < 0)
+				table[slot] = (int32) (j * DELTA_BLOCK);
+		}
+
+		/* HASH_MULT ^ (DELTA_BLOCK - 1), for removing of leaving byte */
+		for (k = 0; k < DELTA_BLOCK - 1; k++)
+			outmult *= HASH_MULT;
+
+		h = block_hash(t);
+	}
+
+	while (table && i + DELTA_BLOCK <= tlen)
+	{
+		int32		off = table[h & mask];
+
+		if (off >= 0 && memcmp(b + off, t + i, DELTA_BLOCK) == 0)
+		{
+			size_t		boff = off;
+			size_t		len = DELTA_BLOCK;
+
+			/* extend the match to both sides */
+			while (i > lit && boff > 0 && b[boff - 1] == t[i - 1])
+			{
+				i--;
+				boff--;
+				len++;
+			}
+
+			while (boff + len < blen && i + len < tlen && b[boff + len] == t[i + len])
+				len++;
+
+			emit_add(delta, target + lit, i - lit);
+			emit_copy(delta, boff, len);
+
+			i += len;
+			lit = i;
+
+			if (i + DELTA_BLOCK <= tlen)
+				h = block_hash(t + i);
+
+			continue;
+		}
+
+		if (i + DELTA_BLOCK >= tlen)
+			break;
+
+		h = (h - t[i] * outmult) * HASH_MULT + t[i + DELTA_BLOCK];
+		i++;
+	}
+
+	emit_add(delta, target + lit, tlen - lit);
+
+	if (table)
+		pg_free(table);
+}
+
+/*
+ * FNV-1a hash is used for checking of cached base
+ */
+static uint64
+data_checksum(const char *data, size_t len)
+{
+	uint64		h = UINT64CONST(0xcbf29ce484222325);
+	size_t		i;
+
+	for (i = 0; i < len; i++)
+	{
+		h ^= (unsigned char) data[i];
+		h *= UINT64CONST(0x100000001b3);
+	}
+
+	return h;
+}
+
+static void
+cache_path(char *path, const char *suffix, const struct _param * param)
+{
+	snprintf(path, MAXPGPATH, "%s/%s.%s",
+			 param->delta_cache, param->delta_key, suffix);
+}
+
+/*
+ * Read whole file to buffer. Returns false when file doesn't exist, or
+ * cannot be read.
+ */
+static bool
+read_file(const char *path, PQExpBuffer buf)
+{
+	FILE	   *f;
+	char		buffer[BUFSIZ];
+	size_t		size;
+	bool		result;
+
+	resetPQExpBuffer(buf);
+
+	f = fopen(path, "rb");
+	if (!f)
+		return false;
+
+	while ((size = fread(buffer, 1, sizeof(buffer), f)) > 0)
+		appendBinaryPQExpBuffer(buf, buffer, size);
+
+	result = !ferror(f) && !PQExpBufferBroken(buf);
+	fclose(f);
+
+	return result;
+}
+
+/*
+ * Write file by temporary file and rename, so the cache is not broken
+ * after crash.
+ */
+static bool
+write_file(const char *path, const char *data, size_t len,
+		   const struct _param * param)
+{
+	char		tmppath[MAXPGPATH];
+	FILE	   *f;
+	bool		written;
+
+	snprintf(tmppath, sizeof(tmppath), "%s.tmp", path);
+
+	f = fopen(tmppath, "wb");
+	if (!f)
+	{
+		fprintf(stderr, "%s: Unable to open '%s': %s\n",
+				param->progname, tmppath, strerror(errno));
+		return false;
+	}
+
+	/* the file is closed when the write failed too */
+	written = fwrite(data, 1, len, f) == len;
+	if (fclose(f) != 0)
+		written = false;
+
+	if (!written)
+	{
+		fprintf(stderr, "%s: Cannot write '%s': %s\n",
+				param->progname, tmppath, strerror(errno));
+		unlink(tmppath);
+		return false;
+	}
+
+	if (rename(tmppath, path) != 0)
+	{
+		fprintf(stderr, "%s: Cannot rename '%s': %s\n",
+				param->progname, tmppath, strerror(errno));
+		unlink(tmppath);
+		return false;
+	}
+
+	return true;
+}
+
+/*
+ * Prepare imported value of new version of document. When the previous
+ * version is in cache, and the delta is useful, then delta is stored to
+ * "value", and the id of previous version is returned in "base_id"
+ * (malloced). Else the "value" is document, and "base_id" is NULL.
+ */
+int
+delta_prepare(const char *doc, size_t len, PQExpBuffer value,
+			  char **base_id, const struct _param * param)
+{
+	char		path[MAXPGPATH];
+	PQExpBufferData base;
+	PQExpBufferData meta;
+	char		id[256];
+	int			chain;
+	uint64		checksum;
+	bool		keyframe = true;
+
+	*base_id = NULL;
+
+	initPQExpBuffer(&base);
+	initPQExpBuffer(&meta);
+
+	cache_path(path, "meta", param);
+	if (read_file(path, &meta) &&
+		sscanf(meta.data, "id %255s chain %d checksum " UINT64_FORMAT,
+			   id, &chain, &checksum) == 3)
+	{
+		cache_path(path, "base", param);
+
+		if (!read_file(path, &base) ||
+			data_checksum(base.data, base.len) != checksum)
+		{
+			fprintf(stderr, "%s: warning: cached version of '%s' is broken, full version is imported\n",
+					param->progname, param->delta_key);
+		}
+		else if (chain + 1 < param->keyframe_interval)
+		{
+			delta_compute(value, base.data, base.len, doc, len);
+
+			if (PQExpBufferBroken(value))
+			{
+				fprintf(stderr, "%s: Out of memory\n", param->progname);
+				termPQExpBuffer(&base);
+				termPQExpBuffer(&meta);
+				return -1;
+			}
+
+			/* delta is not useful when it is not smaller */
+			keyframe = value->len >= len;
+		}
+	}
+
+	if (keyframe)
+	{
+		resetPQExpBuffer(value);
+		appendBinaryPQExpBuffer(value, doc, len);
+	}
+	else
+		*base_id = pg_strdup(id);
+
+	if (param->verbose)
+	{
+		if (keyframe)
+			fprintf(stdout, "Import full version of '%s'\n", param->delta_key);
+		else
+			fprintf(stdout, "Import delta of '%s' of size %zu against version %s\n",
+					param->delta_key, value->len, id);
+	}
+
+	termPQExpBuffer(&base);
+	termPQExpBuffer(&meta);
+
+	if (PQExpBufferBroken(value))
+	{
+		fprintf(stderr, "%s: Out of memory\n", param->progname);
+		return -1;
+	}
+
+	return 0;
+}
+
+/*
+ * Store imported version of document and its id to cache. The length of
+ * delta chain is incremented, when the version was imported as delta.
+ */
+int
+delta_store(const char *doc, size_t len, const char *id, bool is_delta,
+			const struct _param * param)
+{
+	char		path[MAXPGPATH];
+	PQExpBufferData meta;
+	int			chain = 0;
+	int			rc = 0;
+
+	if (*id == '\0' || strpbrk(id, " \t\r\n") != NULL)
+	{
+		fprintf(stderr, "%s: id of version \"%s\" cannot be stored in delta cache\n",
+				param->progname, id);
+		return -1;
+	}
+
+	if (is_delta)
+	{
+		cache_path(path, "meta", param);
+
+		initPQExpBuffer(&meta);
+		if (read_file(path, &meta))
+			sscanf(meta.data, "id %*s chain %d", &chain);
+		termPQExpBuffer(&meta);
+
+		chain += 1;
+	}
+
+	if (mkdir(param->delta_cache, S_IRWXU) != 0 && errno != EEXIST)
+	{
+		fprintf(stderr, "%s: Unable to create directory '%s': %s\n",
+				param->progname, param->delta_cache, strerror(errno));
+		return -1;
+	}
+
+	/* base is written first, so the meta with old checksum is not valid */
+	cache_path(path, "base", param);
+	if (!write_file(path, doc, len, param))
+		rc = -1;
+
+	if (rc == 0)
+	{
+		initPQExpBuffer(&meta);
+		appendPQExpBuffer(&meta, "id %s chain %d checksum " UINT64_FORMAT "\n",
+						  id, chain, data_checksum(doc, len));
+
+		cache_path(path, "meta", param);
+		if (!write_file(path, meta.data, meta.len, param))
+			rc = -1;
+
+		termPQExpBuffer(&meta);
+	}
+
+	return rc;
+}
@@ -0,0 +1,565 @@
+/*-------------------------------------------------------------------------
+ *
+ * encode.c
+ *	  escaping, encoding and decoding of document data
+ *
+ * Documents can be long, and the escaping is done for every byte, so
+ * the clean (not escaped) parts of data are detected and copied by
+ * blocks. Every kernel has scalar implementation (eight bytes are
+ * checked at once in generic 64bit registers), and SSE2 implementation
+ * when it is available (always on x86_64). The implementations are
+ * collected in EncodeKernels tables, so they can be compared by
+ * microbenchmarks. Implementations for newer instruction sets are in
+ * encode_simd.c, and they are selected at runtime.
+ *
+ * IDENTIFICATION
+ *   encode.c
+ *
+ *-------------------------------------------------------------------------
+ */
+#include "postgres_fe.h"
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "port/pg_bitutils.h"
+
+#include "pgimportdoc.h"
+
+static const char hexdigits[] = "0123456789abcdef";
+
+/*
+ * Write escaped form of one byte. Only backslash, newline, carriage
+ * return and tab have to be escaped inside COPY text format field.
+ */
+static inline char *
+escape_byte(char *dst, char c)
+{
+	switch (c)
+	{
+		case '\\':
+			*dst++ = '\\';
+			*dst++ = '\\';
+			break;
+		case '\n':
+			*dst++ = '\\';
+			*dst++ = 'n';
+			break;
+		case '\r':
+			*dst++ = '\\';
+			*dst++ = 'r';
+			break;
+		case '\t':
+			*dst++ = '\\';
+			*dst++ = 't';
+			break;
+		default:
+			*dst++ = c;
+	}
+
+	return dst;
+}
+
+#define SWAR_ONES		UINT64CONST(0x0101010101010101)
+#define SWAR_HIGHS		UINT64CONST(0x8080808080808080)
+
+/*
+ * Returns nonzero when some byte of w is equal to c.
+ */
+static inline uint64
+swar_has_byte(uint64 w, unsigned char c)
+{
+	uint64		x = w ^ (SWAR_ONES * c);
+
+	return (x - SWAR_ONES) & ~x & SWAR_HIGHS;
+}
+
+static size_t
+escape_text_scalar(char *dst, const char *src, size_t len)
+{
+	char	   *d = dst;
+	size_t		i = 0;
+
+	while (i + 8 <= len)
+	{
+		uint64		w;
+		uint64		special;
+
+		memcpy(&w, src + i, 8);
+
+		special = swar_has_byte(w, '\\') | swar_has_byte(w, '\n') |
+			swar_has_byte(w, '\r') | swar_has_byte(w, '\t');
+
+		memcpy(d, &w, 8);
+
+		if (special == 0)
+		{
+			d += 8;
+			i += 8;
+			continue;
+		}
+
+		/*
+		 * The borrow can mark bytes after a special byte too, so simply
+		 * process this word byte by byte.
+		 */
+		for (int j = 0; j < 8; j++)
+			d = escape_byte(d, src[i++]);
+	}
+
+	for (; i < len; i++)
+		d = escape_byte(d, src[i]);
+
+	return d - dst;
+}
+
+static size_t
+hex_encode_scalar(char *dst, const char *src, size_t len)
+{
+	char	   *d = dst;
+	size_t		i;
+
+	for (i = 0; i < len; i++)
+	{
+		unsigned char c = (unsigned char) src[i];
+
+		*d++ = hexdigits[c >> 4];
+		*d++ = hexdigits[c & 0x0f];
+	}
+
+	return d - dst;
+}
+
+#ifdef __SSE2__
+
+static size_t
+escape_text_sse2(char *dst, const char *src, size_t len)
+{
+	const __m128i bslash = _mm_set1_epi8('\\');
+	const __m128i nl = _mm_set1_epi8('\n');
+	const __m128i cr = _mm_set1_epi8('\r');
+	const __m128i tab = _mm_set1_epi8('\t');
+	char	   *d = dst;
+	size_t		i = 0;
+
+	while (i + 16 <= len)
+	{
+		__m128i		chunk = _mm_loadu_si128((const __m128i *) (src + i));
+		__m128i		special;
+		int			mask;
+		int			n;
+
+		special = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(chunk, bslash),
+											_mm_cmpeq_epi8(chunk, nl)),
+							   _mm_or_si128(_mm_cmpeq_epi8(chunk, cr),
+											_mm_cmpeq_epi8(chunk, tab)));
+
+		/* the store is speculative, the escaped byte will be overwritten */
+		_mm_storeu_si128((__m128i *) d, chunk);
+
+		mask = _mm_movemask_epi8(special);
+		if (mask == 0)
+		{
+			d += 16;
+			i += 16;
+			continue;
+		}
+
+		n = pg_rightmost_one_pos32((uint32) mask);
+		d += n;
+		i += n;
+
+		d = escape_byte(d, src[i++]);
+	}
+
+	for (; i < len; i++)
+		d = escape_byte(d, src[i]);
+
+	return d - dst;
+}
+
+static size_t
+hex_encode_sse2(char *dst, const char *src, size_t len)
+{
+	const __m128i lomask = _mm_set1_epi8(0x0f);
+	const __m128i nine = _mm_set1_epi8(9);
+	const __m128i zero = _mm_set1_epi8('0');
+	const __m128i alpha = _mm_set1_epi8('a' - '0' - 10);
+	size_t		i = 0;
+	size_t		n;
+
+	while (i + 16 <= len)
+	{
+		__m128i		chunk = _mm_loadu_si128((const __m128i *) (src + i));
+		__m128i		hi = _mm_and_si128(_mm_srli_epi16(chunk, 4), lomask);
+		__m128i		lo = _mm_and_si128(chunk, lomask);
+
+		/* nibble to digit: '0' + n, plus offset to 'a' for n > 9 */
+		hi = _mm_add_epi8(_mm_add_epi8(hi, zero),
+						  _mm_and_si128(_mm_cmpgt_epi8(hi, nine), alpha));
+		lo = _mm_add_epi8(_mm_add_epi8(lo, zero),
+						  _mm_and_si128(_mm_cmpgt_epi8(lo, nine), alpha));
+
+		_mm_storeu_si128((__m128i *) (dst + 2 * i), _mm_unpacklo_epi8(hi, lo));
+		_mm_storeu_si128((__m128i *) (dst + 2 * i + 16), _mm_unpackhi_epi8(hi, lo));
+
+		i += 16;
+	}
+
+	n = hex_encode_scalar(dst + 2 * i, src + i, len - i);
+
+	return 2 * i + n;
+}
+
+#endif							/* __SSE2__ */
+
+/*
+ * Escape data for COPY text format. Returns length of escaped data.
+ */
+size_t
+copy_escape_text(char *dst, const char *src, size_t len)
+{
+	return encode_kernels->escape_text(dst, src, len);
+}
+
+/*
+ * Encode binary data to hex digits (without any prefix). Returns
+ * length of encoded data (2 * len).
+ */
+size_t
+hex_encode_bytes(char *dst, const char *src, size_t len)
+{
+	return encode_kernels->hex_encode(dst, src, len);
+}
+
+/*
+ * Decoding of base64 or hex encoded input. The data are decoded in
+ * streaming fashion, the whitespaces (line breaks) are ignored.
+ */
+
+#define DEC_INVALID		0xff
+#define DEC_SPACE		0xfe
+#define DEC_PAD			0xfd
+
+static unsigned char b64_dec_table[256];
+static unsigned char hex_dec_table[256];
+static bool dec_tables_ready = false;
+
+static void
+init_decode_tables(void)
+{
+	const char *b64chars =
+	"ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+	int			i;
+
+	memset(b64_dec_table, DEC_INVALID, sizeof(b64_dec_table));
+	memset(hex_dec_table, DEC_INVALID, sizeof(hex_dec_table));
+
+	for (i = 0; i < 64; i++)
+		b64_dec_table[(unsigned char) b64chars[i]] = i;
+
+	/* url safe alphabet */
+	b64_dec_table['-'] = 62;
+	b64_dec_table['_'] = 63;
+	b64_dec_table['='] = DEC_PAD;
+
+	for (i = 0; i < 10; i++)
+		hex_dec_table['0' + i] = i;
+	for (i = 0; i < 6; i++)
+	{
+		hex_dec_table['a' + i] = 10 + i;
+		hex_dec_table['A' + i] = 10 + i;
+	}
+
+	b64_dec_table[' '] = hex_dec_table[' '] = DEC_SPACE;
+	b64_dec_table['\t'] = hex_dec_table['\t'] = DEC_SPACE;
+	b64_dec_table['\n'] = hex_dec_table['\n'] = DEC_SPACE;
+	b64_dec_table['\r'] = hex_dec_table['\r'] = DEC_SPACE;
+
+	dec_tables_ready = true;
+}
+
+void
+decode_init(DecodeState *state, InputEncoding encoding)
+{
+	if (!dec_tables_ready)
+		init_decode_tables();
+
+	state->encoding = encoding;
+	state->bits = 0;
+	state->nbits = 0;
+	state->finished = false;
+}
+
+/*
+ * Block decoders decode clean (without whitespaces, padding or invalid
+ * characters) prefix of input. They returns number of processed input
+ * characters - it is multiple of 8 for base64 (6 bytes are written for
+ * 8 characters), and multiple of 2 for hex.
+ */
+static size_t
+base64_decode_scalar(char *dst, const char *src, size_t len)
+{
+	const unsigned char *s = (const unsigned char *) src;
+	size_t		i = 0;
+
+	while (i + 8 <= len)
+	{
+		uint64		w;
+		unsigned char c0 = b64_dec_table[s[i]],
+					c1 = b64_dec_table[s[i + 1]],
+					c2 = b64_dec_table[s[i + 2]],
+					c3 = b64_dec_table[s[i + 3]],
+					c4 = b64_dec_table[s[i + 4]],
+					c5 = b64_dec_table[s[i + 5]],
+					c6 = b64_dec_table[s[i + 6]],
+					c7 = b64_dec_table[s[i + 7]];
+
+		if ((c0 | c1 | c2 | c3 | c4 | c5 | c6 | c7) & 0xc0)
+			break;
+
+		w = ((uint64) c0 << 42) | ((uint64) c1 << 36) |
+			((uint64) c2 << 30) | ((uint64) c3 << 24) |
+			((uint64) c4 << 18) | ((uint64) c5 << 12) |
+			((uint64) c6 << 6) | (uint64) c7;
+
+		dst[0] = (char) (w >> 40);
+		dst[1] = (char) (w >> 32);
+		dst[2] = (char) (w >> 24);
+		dst[3] = (char) (w >> 16);
+		dst[4] = (char) (w >> 8);
+		dst[5] = (char) w;
+
+		dst += 6;
+		i += 8;
+	}
+
+	return i;
+}
+
+static size_t
+hex_decode_scalar(char *dst, const char *src, size_t len)
+{
+	const unsigned char *s = (const unsigned char *) src;
+	size_t		i = 0;
+
+	while (i + 2 <= len)
+	{
+		unsigned char hi = hex_dec_table[s[i]];
+		unsigned char lo = hex_dec_table[s[i + 1]];
+
+		if ((hi | lo) & 0xf0)
+			break;
+
+		*dst++ = (char) ((hi << 4) | lo);
+		i += 2;
+	}
+
+	return i;
+}
+
+#ifdef __SSE2__
+
+static size_t
+hex_decode_sse2(char *dst, const char *src, size_t len)
+{
+	const __m128i c0 = _mm_set1_epi8('0' - 1);
+	const __m128i c9 = _mm_set1_epi8('9' + 1);
+	const __m128i ca = _mm_set1_epi8('a' - 1);
+	const __m128i cf = _mm_set1_epi8('f' + 1);
+	const __m128i lower = _mm_set1_epi8(0x20);
+	const __m128i lobyte = _mm_set1_epi16(0x00ff);
+	size_t		i = 0;
+
+	while (i + 16 <= len)
+	{
+		__m128i		chunk = _mm_loadu_si128((const __m128i *) (src + i));
+		__m128i		lc = _mm_or_si128(chunk, lower);
+		__m128i		digits;
+		__m128i		alphas;
+		__m128i		val;
+
+		digits = _mm_and_si128(_mm_cmpgt_epi8(chunk, c0),
+							   _mm_cmplt_epi8(chunk, c9));
+		alphas = _mm_and_si128(_mm_cmpgt_epi8(lc, ca),
+							   _mm_cmplt_epi8(lc, cf));
+
+		if (_mm_movemask_epi8(_mm_or_si128(digits, alphas)) != 0xffff)
+			break;
+
+		val = _mm_or_si128(_mm_and_si128(digits,
+										 _mm_sub_epi8(chunk, _mm_set1_epi8('0'))),
+						   _mm_and_si128(alphas,
+										 _mm_sub_epi8(lc, _mm_set1_epi8('a' - 10))));
+
+		/* first digit of pair is in low byte of 16bit lane */
+		val = _mm_or_si128(_mm_slli_epi16(_mm_and_si128(val, lobyte), 4),
+						   _mm_srli_epi16(val, 8));
+
+		_mm_storel_epi64((__m128i *) (dst + i / 2), _mm_packus_epi16(val, val));
+
+		i += 16;
+	}
+
+	return i + hex_decode_scalar(dst + i / 2, src + i, len - i);
+}
+
+#endif							/* __SSE2__ */
+
+const EncodeKernels encode_kernels_scalar = {
+	"scalar",
+	escape_text_scalar,
+	hex_encode_scalar,
+	hex_decode_scalar,
+	base64_decode_scalar
+};
+
+#ifdef __SSE2__
+
+const EncodeKernels encode_kernels_sse2 = {
+	"sse2",
+	escape_text_sse2,
+	hex_encode_sse2,
+	hex_decode_sse2,
+	base64_decode_scalar
+};
+
+/* can be replaced by faster implementation by encode_select_kernels */
+const EncodeKernels *encode_kernels = &encode_kernels_sse2;
+
+#else
+
+const EncodeKernels *encode_kernels = &encode_kernels_scalar;
+
+#endif
+
+static ssize_t
+decode_base64(DecodeState *state, char *dst, const char *src, size_t len)
+{
+	const unsigned char *s = (const unsigned char *) src;
+	char	   *d = dst;
+	size_t		i = 0;
+
+	while (i < len)
+	{
+		unsigned char v;
+
+		if (state->nbits == 0 && !state->finished)
+		{
+			size_t		n;
+
+			n = encode_kernels->base64_decode(d, src + i, len - i);
+			d += n / 8 * 6;
+			i += n;
+
+			if (i >= len)
+				break;
+		}
+
+		v = b64_dec_table[s[i++]];
+
+		if (v == DEC_SPACE)
+			continue;
+		else if (v == DEC_PAD)
+		{
+			/* only 2 or 4 bits can be unused after last character */
+			if (state->nbits != 2 && state->nbits != 4 && !state->finished)
+				return -1;
+
+			state->finished = true;
+			state->bits = 0;
+			state->nbits = 0;
+			continue;
+		}
+		else if (v == DEC_INVALID || state->finished)
+			return -1;
+
+		state->bits = (state->bits << 6) | v;
+		state->nbits += 6;
+
+		if (state->nbits >= 8)
+		{
+			state->nbits -= 8;
+			*d++ = (char) (state->bits >> state->nbits);
+			state->bits &= (1 << state->nbits) - 1;
+		}
+	}
+
+	return d - dst;
+}
+
+static ssize_t
+decode_hex(DecodeState *state, char *dst, const char *src, size_t len)
+{
+	const unsigned char *s = (const unsigned char *) src;
+	char	   *d = dst;
+	size_t		i = 0;
+
+	while (i < len)
+	{
+		unsigned char v;
+
+		if (state->nbits == 0)
+		{
+			size_t		n;
+
+			n = encode_kernels->hex_decode(d, src + i, len - i);
+			d += n / 2;
+			i += n;
+
+			if (i >= len)
+				break;
+		}
+
+		v = hex_dec_table[s[i++]];
+
+		if (v == DEC_SPACE)
+			continue;
+		else if (v == DEC_INVALID)
+			return -1;
+
+		if (state->nbits == 0)
+		{
+			state->bits = v;
+			state->nbits = 4;
+		}
+		else
+		{
+			*d++ = (char) ((state->bits << 4) | v);
+			state->nbits = 0;
+		}
+	}
+
+	return d - dst;
+}
+
+/*
+ * Decode chunk of input data. Returns length of decoded data
+ * or -1 when input data are not valid.
+ */
+ssize_t
+decode_chunk(DecodeState *state, char *dst, const char *src, size_t len)
+{
+	if (state->encoding == INPUT_ENCODING_BASE64)
+		return decode_base64(state, dst, src, len);
+	else if (state->encoding == INPUT_ENCODING_HEX)
+		return decode_hex(state, dst, src, len);
+
+	memcpy(dst, src, len);
+
+	return len;
+}
+
+/*
+ * Returns false when input was not complete.
+ */
+bool
+decode_finish(DecodeState *state)
+{
+	/* base64 without padding is allowed */
+	if (state->encoding == INPUT_ENCODING_BASE64)
+		return state->nbits == 0 || state->nbits == 2 || state->nbits == 4;
+
+	return state->nbits == 0;
+}
@@ -0,0 +1,623 @@
+/*-------------------------------------------------------------------------
+ *
+ * encode_simd.c
+ *	  vectorized encoding kernels selected at runtime
+ *
+ * One binary should use the best instruction set of the CPU where it
+ * runs, so the kernels for SSE4.2, AVX2 and AVX-512 are compiled with
+ * target attributes (independently on compiler options), and they are
+ * selected by cpuid at startup. NEON kernels are used on ARM64 (NEON
+ * is mandatory there, but hwcap is checked on Linux anyway).
+ *
+ * The SSE4.2 and AVX2 kernels decode base64 by the algorithm of
+ * Wojciech Mula and Daniel Lemire (translation by nibble lookups,
+ * merging of 6bit values by multiply-add instructions).
+ *
+ * IDENTIFICATION
+ *   encode_simd.c
+ *
+ *-------------------------------------------------------------------------
+ */
+#include "postgres_fe.h"
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#define USE_X86_KERNELS
+#include <immintrin.h>
+#endif
+
+#if defined(__aarch64__)
+#define USE_NEON_KERNELS
+#include <arm_neon.h>
+#if defined(__linux__)
+#include <sys/auxv.h>
+#include <asm/hwcap.h>
+#endif
+#endif
+
+#include "port/pg_bitutils.h"
+
+#include "pgimportdoc.h"
+
+static const char hexdigits[16] = "0123456789abcdef";
+
+#ifdef USE_X86_KERNELS
+
+#define TARGET_SSE42	__attribute__((target("sse4.2")))
+#define TARGET_AVX2		__attribute__((target("avx2")))
+#define TARGET_AVX512	__attribute__((target("avx512f,avx512bw")))
+
+/*
+ * SSE4.2 (with SSSE3 byte shuffles)
+ */
+TARGET_SSE42
+static size_t
+hex_encode_sse42(char *dst, const char *src, size_t len)
+{
+	const __m128i lut = _mm_loadu_si128((const __m128i *) hexdigits);
+	const __m128i lomask = _mm_set1_epi8(0x0f);
+	size_t		i = 0;
+
+	while (i + 16 <= len)
+	{
+		__m128i		chunk = _mm_loadu_si128((const __m128i *) (src + i));
+		__m128i		hi = _mm_shuffle_epi8(lut, _mm_and_si128(_mm_srli_epi16(chunk, 4), lomask));
+		__m128i		lo = _mm_shuffle_epi8(lut, _mm_and_si128(chunk, lomask));
+
+		_mm_storeu_si128((__m128i *) (dst + 2 * i), _mm_unpacklo_epi8(hi, lo));
+		_mm_storeu_si128((__m128i *) (dst + 2 * i + 16), _mm_unpackhi_epi8(hi, lo));
+
+		i += 16;
+	}
+
+	return 2 * i + encode_kernels_scalar.hex_encode(dst + 2 * i, src + i, len - i);
+}
+
+TARGET_SSE42
+static size_t
+base64_decode_sse42(char *dst, const char *src, size_t len)
+{
+	const __m128i lut_lo = _mm_setr_epi8(0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11,
+										 0x11, 0x11, 0x13, 0x1a, 0x1b, 0x1b, 0x1b, 0x1a);
+	const __m128i lut_hi = _mm_setr_epi8(0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08,
+										 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10);
+	const __m128i lut_roll = _mm_setr_epi8(0, 16, 19, 4, -65, -65, -71, -71,
+										   0, 0, 0, 0, 0, 0, 0, 0);
+	const __m128i mask_2f = _mm_set1_epi8(0x2f);
+	const __m128i merge1 = _mm_set1_epi32(0x01400140);
+	const __m128i merge2 = _mm_set1_epi32(0x00011000);
+	const __m128i pack = _mm_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12,
+									   -1, -1, -1, -1);
+	size_t		i = 0;
+
+	/* 16 bytes are stored, but only 12 are valid */
+	while (i + 16 <= len)
+	{
+		__m128i		str = _mm_loadu_si128((const __m128i *) (src + i));
+		__m128i		hi_nibbles = _mm_and_si128(_mm_srli_epi32(str, 4), mask_2f);
+		__m128i		lo_nibbles = _mm_and_si128(str, mask_2f);
+		__m128i		hi = _mm_shuffle_epi8(lut_hi, hi_nibbles);
+		__m128i		lo = _mm_shuffle_epi8(lut_lo, lo_nibbles);
+		__m128i		roll;
+
+		/* some character is not from base64 alphabet */
+		if (!_mm_testz_si128(lo, hi))
+			break;
+
+		roll = _mm_shuffle_epi8(lut_roll,
+								_mm_add_epi8(_mm_cmpeq_epi8(str, mask_2f), hi_nibbles));
+		str = _mm_add_epi8(str, roll);
+
+		str = _mm_madd_epi16(_mm_maddubs_epi16(str, merge1), merge2);
+		str = _mm_shuffle_epi8(str, pack);
+
+		_mm_storeu_si128((__m128i *) (dst + i / 4 * 3), str);
+
+		i += 16;
+	}
+
+	return i + encode_kernels_scalar.base64_decode(dst + i / 4 * 3, src + i, len - i);
+}
+
+/*
+ * AVX2
+ */
+TARGET_AVX2
+static size_t
+escape_text_avx2(char *dst, const char *src, size_t len)
+{
+	const __m256i bslash = _mm256_set1_epi8('\\');
+	const __m256i nl = _mm256_set1_epi8('\n');
+	const __m256i cr = _mm256_set1_epi8('\r');
+	const __m256i tab = _mm256_set1_epi8('\t');
+	char	   *d = dst;
+	size_t		i = 0;
+
+	while (i + 32 <= len)
+	{
+		__m256i		chunk = _mm256_loadu_si256((const __m256i *) (src + i));
+		__m256i		special;
+		uint32		mask;
+		int			n;
+
+		special = _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(chunk, bslash),
+												  _mm256_cmpeq_epi8(chunk, nl)),
+								  _mm256_or_si256(_mm256_cmpeq_epi8(chunk, cr),
+												  _mm256_cmpeq_epi8(chunk, tab)));
+
+		/* the store is speculative, the escaped byte will be overwritten */
+		_mm256_storeu_si256((__m256i *) d, chunk);
+
+		mask = (uint32) _mm256_movemask_epi8(special);
+		if (mask == 0)
+		{
+			d += 32;
+			i += 32;
+			continue;
+		}
+
+		n = pg_rightmost_one_pos32(mask);
+		d += n;
+		i += n;
+
+		/* escape one byte, and continue after it */
+		d += encode_kernels_scalar.escape_text(d, src + i, 1);
+		i += 1;
+	}
+
+	return (d - dst) + encode_kernels_scalar.escape_text(d, src + i, len - i);
+}
+
+TARGET_AVX2
+static size_t
+hex_encode_avx2(char *dst, const char *src, size_t len)
+{
+	const __m256i lut = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *) hexdigits));
+	const __m256i lomask = _mm256_set1_epi8(0x0f);
+	size_t		i = 0;
+
+	while (i + 32 <= len)
+	{
+		__m256i		chunk = _mm256_loadu_si256((const __m256i *) (src + i));
+		__m256i		hi = _mm256_shuffle_epi8(lut, _mm256_and_si256(_mm256_srli_epi16(chunk, 4), lomask));
+		__m256i		lo = _mm256_shuffle_epi8(lut, _mm256_and_si256(chunk, lomask));
+		__m256i		a = _mm256_unpacklo_epi8(hi, lo);
+		__m256i		b = _mm256_unpackhi_epi8(hi, lo);
+
+		/* the unpack works inside 128bit lanes */
+		_mm256_storeu_si256((__m256i *) (dst + 2 * i), _mm256_permute2x128_si256(a, b, 0x20));
+		_mm256_storeu_si256((__m256i *) (dst + 2 * i + 32), _mm256_permute2x128_si256(a, b, 0x31));
+
+		i += 32;
+	}
+
+	return 2 * i + hex_encode_sse42(dst + 2 * i, src + i, len - i);
+}
+
+TARGET_AVX2
+static size_t
+hex_decode_avx2(char *dst, const char *src, size_t len)
+{
+	const __m256i c0 = _mm256_set1_epi8('0' - 1);
+	const __m256i c9 = _mm256_set1_epi8('9' + 1);
+	const __m256i ca = _mm256_set1_epi8('a' - 1);
+	const __m256i cf = _mm256_set1_epi8('f' + 1);
+	const __m256i lower = _mm256_set1_epi8(0x20);
+	const __m256i lobyte = _mm256_set1_epi16(0x00ff);
+	size_t		i = 0;
+
+	while (i + 32 <= len)
+	{
+		__m256i		chunk = _mm256_loadu_si256((const __m256i *) (src + i));
+		__m256i		lc = _mm256_or_si256(chunk, lower);
+		__m256i		digits;
+		__m256i		alphas;
+		__m256i		val;
+
+		digits = _mm256_and_si256(_mm256_cmpgt_epi8(chunk, c0),
+								  _mm256_cmpgt_epi8(c9, chunk));
+		alphas = _mm256_and_si256(_mm256_cmpgt_epi8(lc, ca),
+								  _mm256_cmpgt_epi8(cf, lc));
+
+		if ((uint32) _mm256_movemask_epi8(_mm256_or_si256(digits, alphas)) != 0xffffffff)
+			break;
+
+		val = _mm256_or_si256(_mm256_and_si256(digits,
+											   _mm256_sub_epi8(chunk, _mm256_set1_epi8('0'))),
+							  _mm256_and_si256(alphas,
+											   _mm256_sub_epi8(lc, _mm256_set1_epi8('a' - 10))));
+
+		/* first digit of pair is in low byte of 16bit lane */
+		val = _mm256_or_si256(_mm256_slli_epi16(_mm256_and_si256(val, lobyte), 4),
+							  _mm256_srli_epi16(val, 8));
+
+		/* pack inside lanes, then move valid quadwords together */
+		val = _mm256_permute4x64_epi64(_mm256_packus_epi16(val, val), 0x08);
+
+		_mm_storeu_si128((__m128i *) (dst + i / 2), _mm256_castsi256_si128(val));
+
+		i += 32;
+	}
+
+	return i + encode_kernels_sse2.hex_decode(dst + i / 2, src + i, len - i);
+}
+
+TARGET_AVX2
+static size_t
+base64_decode_avx2(char *dst, const char *src, size_t len)
+{
+	const __m256i lut_lo = _mm256_setr_epi8(0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11,
+											0x11, 0x11, 0x13, 0x1a, 0x1b, 0x1b, 0x1b, 0x1a,
+											0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11,
+											0x11, 0x11, 0x13, 0x1a, 0x1b, 0x1b, 0x1b, 0x1a);
+	const __m256i lut_hi = _mm256_setr_epi8(0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08,
+											0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10,
+											0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08,
+											0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10);
+	const __m256i lut_roll = _mm256_setr_epi8(0, 16, 19, 4, -65, -65, -71, -71,
+											  0, 0, 0, 0, 0, 0, 0, 0,
+											  0, 16, 19, 4, -65, -65, -71, -71,
+											  0, 0, 0, 0, 0, 0, 0, 0);
+	const __m256i mask_2f = _mm256_set1_epi8(0x2f);
+	const __m256i merge1 = _mm256_set1_epi32(0x01400140);
+	const __m256i merge2 = _mm256_set1_epi32(0x00011000);
+	const __m256i pack = _mm256_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12,
+										  -1, -1, -1, -1,
+										  2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12,
+										  -1, -1, -1, -1);
+	const __m256i compact = _mm256_setr_epi32(0, 1, 2, 4, 5, 6, 7, 7);
+	size_t		i = 0;
+
+	/* 32 bytes are stored, but only 24 are valid */
+	while (i + 32 <= len)
+	{
+		__m256i		str = _mm256_loadu_si256((const __m256i *) (src + i));
+		__m256i		hi_nibbles = _mm256_and_si256(_mm256_srli_epi32(str, 4), mask_2f);
+		__m256i		lo_nibbles = _mm256_and_si256(str, mask_2f);
+		__m256i		hi = _mm256_shuffle_epi8(lut_hi, hi_nibbles);
+		__m256i		lo = _mm256_shuffle_epi8(lut_lo, lo_nibbles);
+		__m256i		roll;
+
+		/* some character is not from base64 alphabet */
+		if (!_mm256_testz_si256(lo, hi))
+			break;
+
+		roll = _mm256_shuffle_epi8(lut_roll,
+								   _mm256_add_epi8(_mm256_cmpeq_epi8(str, mask_2f), hi_nibbles));
+		str = _mm256_add_epi8(str, roll);
+
+		str = _mm256_madd_epi16(_mm256_maddubs_epi16(str, merge1), merge2);
+		str = _mm256_shuffle_epi8(str, pack);
+		str = _mm256_permutevar8x32_epi32(str, compact);
+
+		_mm256_storeu_si256((__m256i *) (dst + i / 4 * 3), str);
+
+		i += 32;
+	}
+
+	return i + base64_decode_sse42(dst + i / 4 * 3, src + i, len - i);
+}
+
+/*
+ * AVX-512 (with byte and word instructions). The decoders are used from
+ * AVX2.
+ */
+TARGET_AVX512
+static size_t
+escape_text_avx512(char *dst, const char *src, size_t len)
+{
+	const __m512i bslash = _mm512_set1_epi8('\\');
+	const __m512i nl = _mm512_set1_epi8('\n');
+	const __m512i cr = _mm512_set1_epi8('\r');
+	const __m512i tab = _mm512_set1_epi8('\t');
+	char	   *d = dst;
+	size_t		i = 0;
+
+	while (i + 64 <= len)
+	{
+		__m512i		chunk = _mm512_loadu_si512((const void *) (src + i));
+		uint64		mask;
+		int			n;
+
+		mask = _mm512_cmpeq_epi8_mask(chunk, bslash) |
+			_mm512_cmpeq_epi8_mask(chunk, nl) |
+			_mm512_cmpeq_epi8_mask(chunk, cr) |
+			_mm512_cmpeq_epi8_mask(chunk, tab);
+
+		/* the store is speculative, the escaped byte will be overwritten */
+		_mm512_storeu_si512((void *) d, chunk);
+
+		if (mask == 0)
+		{
+			d += 64;
+			i += 64;
+			continue;
+		}
+
+		n = pg_rightmost_one_pos64(mask);
+		d += n;
+		i += n;
+
+		d += encode_kernels_scalar.escape_text(d, src + i, 1);
+		i += 1;
+	}
+
+	return (d - dst) + escape_text_avx2(d, src + i, len - i);
+}
+
+TARGET_AVX512
+static size_t
+hex_encode_avx512(char *dst, const char *src, size_t len)
+{
+	const __m512i lut = _mm512_broadcast_i32x4(_mm_loadu_si128((const __m128i *) hexdigits));
+	const __m512i lomask = _mm512_set1_epi8(0x0f);
+	const __m512i first = _mm512_setr_epi64(0, 1, 8, 9, 2, 3, 10, 11);
+	const __m512i second = _mm512_setr_epi64(4, 5, 12, 13, 6, 7, 14, 15);
+	size_t		i = 0;
+
+	while (i + 64 <= len)
+	{
+		__m512i		chunk = _mm512_loadu_si512((const void *) (src + i));
+		__m512i		hi = _mm512_shuffle_epi8(lut, _mm512_and_si512(_mm512_srli_epi16(chunk, 4), lomask));
+		__m512i		lo = _mm512_shuffle_epi8(lut, _mm512_and_si512(chunk, lomask));
+		__m512i		a = _mm512_unpacklo_epi8(hi, lo);
+		__m512i		b = _mm512_unpackhi_epi8(hi, lo);
+
+		/* the unpack works inside 128bit lanes */
+		_mm512_storeu_si512((void *) (dst + 2 * i), _mm512_permutex2var_epi64(a, first, b));
+		_mm512_storeu_si512((void *) (dst + 2 * i + 64), _mm512_permutex2var_epi64(a, second, b));
+
+		i += 64;
+	}
+
+	return 2 * i + hex_encode_avx2(dst + 2 * i, src + i, len - i);
+}
+
+static bool
+cpu_has_sse42(void)
+{
+	return __builtin_cpu_supports("sse4.2");
+}
+
+static bool
+cpu_has_avx2(void)
+{
+	return __builtin_cpu_supports("avx2");
+}
+
+static bool
+cpu_has_avx512(void)
+{
+	return __builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw");
+}
+
+static const EncodeKernels encode_kernels_sse42 = {
+	"sse42",
+	NULL,						/* SSE2 implementation is used */
+	hex_encode_sse42,
+	NULL,
+	base64_decode_sse42
+};
+
+static const EncodeKernels encode_kernels_avx2 = {
+	"avx2",
+	escape_text_avx2,
+	hex_encode_avx2,
+	hex_decode_avx2,
+	base64_decode_avx2
+};
+
+static const EncodeKernels encode_kernels_avx512 = {
+	"avx512",
+	escape_text_avx512,
+	hex_encode_avx512,
+	hex_decode_avx2,
+	base64_decode_avx2
+};
+
+#endif							/* USE_X86_KERNELS */
+
+#ifdef USE_NEON_KERNELS
+
+/*
+ * NEON - the decoders are scalar
+ */
+static size_t
+escape_text_neon(char *dst, const char *src, size_t len)
+{
+	const uint8x16_t bslash = vdupq_n_u8('\\');
+	const uint8x16_t nl = vdupq_n_u8('\n');
+	const uint8x16_t cr = vdupq_n_u8('\r');
+	const uint8x16_t tab = vdupq_n_u8('\t');
+	char	   *d = dst;
+	size_t		i = 0;
+
+	while (i + 16 <= len)
+	{
+		uint8x16_t	chunk = vld1q_u8((const uint8_t *) (src + i));
+		uint8x16_t	special;
+		uint64		mask;
+		int			n;
+
+		special = vorrq_u8(vorrq_u8(vceqq_u8(chunk, bslash), vceqq_u8(chunk, nl)),
+						   vorrq_u8(vceqq_u8(chunk, cr), vceqq_u8(chunk, tab)));
+
+		/* the store is speculative, the escaped byte will be overwritten */
+		vst1q_u8((uint8_t *) d, chunk);
+
+		if (vmaxvq_u8(special) == 0)
+		{
+			d += 16;
+			i += 16;
+			continue;
+		}
+
+		/* four bits of mask per byte */
+		mask = vget_lane_u64(vreinterpret_u64_u8(vshrn_n_u16(vreinterpretq_u16_u8(special), 4)), 0);
+
+		n = pg_rightmost_one_pos64(mask) / 4;
+		d += n;
+		i += n;
+
+		d += encode_kernels_scalar.escape_text(d, src + i, 1);
+		i += 1;
+	}
+
+	return (d - dst) + encode_kernels_scalar.escape_text(d, src + i, len - i);
+}
+
+static size_t
+hex_encode_neon(char *dst, const char *src, size_t len)
+{
+	const uint8x16_t lut = vld1q_u8((const uint8_t *) hexdigits);
+	const uint8x16_t lomask = vdupq_n_u8(0x0f);
+	size_t		i = 0;
+
+	while (i + 16 <= len)
+	{
+		uint8x16_t	chunk = vld1q_u8((const uint8_t *) (src + i));
+		uint8x16x2_t digits;
+
+		digits.val[0] = vqtbl1q_u8(lut, vshrq_n_u8(chunk, 4));
+		digits.val[1] = vqtbl1q_u8(lut, vandq_u8(chunk, lomask));
+
+		/* interleaving store */
+		vst2q_u8((uint8_t *) (dst + 2 * i), digits);
+
+		i += 16;
+	}
+
+	return 2 * i + encode_kernels_scalar.hex_encode(dst + 2 * i, src + i, len - i);
+}
+
+static bool
+cpu_has_neon(void)
+{
+#if defined(__linux__)
+	return (getauxval(AT_HWCAP) & HWCAP_ASIMD) != 0;
+#else
+	return true;
+#endif
+}
+
+static const EncodeKernels encode_kernels_neon = {
+	"neon",
+	escape_text_neon,
+	hex_encode_neon,
+	NULL,
+	NULL
+};
+
+#endif							/* USE_NEON_KERNELS */
+
+typedef struct KernelsChoice
+{
+	const EncodeKernels *kernels;
+	const EncodeKernels *fallback;	/* used for not implemented kernels */
+	bool		(*supported) (void);
+} KernelsChoice;
+
+/* ordered from the slowest */
+static const KernelsChoice choices[] = {
+	{&encode_kernels_scalar, NULL, NULL},
+#ifdef __SSE2__
+	{&encode_kernels_sse2, NULL, NULL},
+#endif
+#ifdef USE_X86_KERNELS
+	{&encode_kernels_sse42, &encode_kernels_sse2, cpu_has_sse42},
+	{&encode_kernels_avx2, NULL, cpu_has_avx2},
+	{&encode_kernels_avx512, NULL, cpu_has_avx512},
+#endif
+#ifdef USE_NEON_KERNELS
+	{&encode_kernels_neon, &encode_kernels_scalar, cpu_has_neon},
+#endif
+	{NULL}
+};
+
+#define MAX_KERNELS		lengthof(choices)
+
+/* complete tables of supported implementations */
+static EncodeKernels supported_kernels[MAX_KERNELS];
+static const EncodeKernels *supported_list[MAX_KERNELS + 1];
+static bool kernels_ready = false;
+
+static void
+init_supported_kernels(void)
+{
+	int			n = 0;
+	int			i;
+
+#ifdef USE_X86_KERNELS
+	__builtin_cpu_init();
+#endif
+
+	for (i = 0; choices[i].kernels; i++)
+	{
+		const KernelsChoice *choice = &choices[i];
+		EncodeKernels *k = &supported_kernels[n];
+
+		if (choice->supported && !choice->supported())
+			continue;
+
+		*k = *choice->kernels;
+
+		if (choice->fallback)
+		{
+			if (!k->escape_text)
+				k->escape_text = choice->fallback->escape_text;
+			if (!k->hex_encode)
+				k->hex_encode = choice->fallback->hex_encode;
+			if (!k->hex_decode)
+				k->hex_decode = choice->fallback->hex_decode;
+			if (!k->base64_decode)
+				k->base64_decode = choice->fallback->base64_decode;
+		}
+
+		supported_list[n++] = k;
+	}
+
+	supported_list[n] = NULL;
+	kernels_ready = true;
+}
+
+/*
+ * Returns NULL terminated list of implementations supported by this CPU,
+ * from the slowest.
+ */
+const EncodeKernels *const *
+encode_supported_kernels(void)
+{
+	if (!kernels_ready)
+		init_supported_kernels();
+
+	return supported_list;
+}
+
+/*
+ * Select implementation by name ("auto" is the best supported). Returns
+ * false when implementation is unknown or not supported by this CPU.
+ */
+bool
+encode_select_kernels(const char *name)
+{
+	const EncodeKernels *const *list = encode_supported_kernels();
+	int			i;
+
+	if (name == NULL || strcmp(name, "auto") == 0)
+	{
+		for (i = 0; list[i]; i++)
+			encode_kernels = list[i];
+
+		return true;
+	}
+
+	for (i = 0; list[i]; i++)
+	{
+		if (strcmp(list[i]->name, name) == 0)
+		{
+			encode_kernels = list[i];
+			return true;
+		}
+	}
+
+	return false;
+}
@@ -0,0 +1,1186 @@
+/*-------------------------------------------------------------------------
+ *
+ * fifo.c
+ *	  concurrent import of documents from more FIFO inputs
+ *
+ * The FIFOs are read by main thread multiplexed by poll(), so a slow
+ * producer doesn't block other producers. The input can be regular file
+ * too, the compressed file is decompressed by more threads to pipe. Every stream has own batch
+ * of documents. The batch is passed by queue to worker threads when it
+ * is full, or when its first document waits longer than max delay (so
+ * the documents are imported quickly under low load, and the batches
+ * grow under high load). Every worker imports the batches by its own
+ * connection. The connections are opened by nonblocking way in the same
+ * poll loop, and the worker starts immediately when its connection is
+ * ready, so the import doesn't wait for all connections.
+ *
+ * Local producers can pass documents by file descriptors (of files or
+ * memfds) over Unix socket (SCM_RIGHTS). Every passed file is one
+ * document. The memfd sealed against shrinking and writing is mapped to
+ * memory, and the worker reads it from there, so the document is not
+ * copied by socket or to the batch buffer. Other files (and TEXT
+ * documents, that have to be terminated by zero byte) are copied to the
+ * batch, so the producer cannot break the import by truncating of file.
+ * The import from socket ends by SIGINT or SIGTERM.
+ *
+ * IDENTIFICATION
+ *   fifo.c
+ *
+ *-------------------------------------------------------------------------
+ */
+#include "postgres_fe.h"
+
+#ifndef WIN32
+
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+#endif
+
+#include "portability/instr_time.h"
+
+#include "pgimportdoc.h"
+
+/* max size of document (like import of one document) */
+#define MAX_DOCUMENT_SIZE	((int64) 1024 * 1024 * 1024)
+
+#ifndef WIN32
+
+/* max number of producers connected to socket */
+#define MAX_FD_CLIENTS		64
+
+/* max number of file descriptors passed by one message */
+#define MAX_PASSED_FDS		16
+
+/*
+ * Documents of one batch are stored in one buffer, or they are mapped
+ * files passed by socket. Every document in buffer is terminated by zero
+ * byte, because text parameters are passed to libpq as strings.
+ */
+typedef struct DocBatch
+{
+	struct DocBatch *next;
+	int			ndocs;
+	int			maxdocs;
+	instr_time	created;		/* arrival of first document */
+	size_t	   *offsets;
+	size_t	   *lengths;
+	char	  **mapped;			/* mapped document or NULL */
+	PQExpBufferData data;
+} DocBatch;
+
+typedef struct FifoStream
+{
+	const char *path;
+	int			fd;
+	bool		eof;
+	PQExpBufferData buf;		/* not yet framed data */
+	size_t		scanned;		/* there is not delimiter before */
+	DocBatch   *batch;
+	int64		ndocs;
+	Decompressor *dc;			/* fd is pipe with decompressed data */
+} FifoStream;
+
+/*
+ * Unix socket for passing of file descriptors
+ */
+typedef struct FdSocket
+{
+	int			listener;
+	int			clients[MAX_FD_CLIENTS];
+	int			nclients;
+	FifoStream *stream;			/* documents are added to this batch */
+	PQExpBufferData copied;		/* document read from not sealed file */
+} FdSocket;
+
+typedef struct BatchQueue
+{
+	pthread_mutex_t mutex;
+	pthread_cond_t not_empty;
+	pthread_cond_t not_full;
+	DocBatch   *head;
+	DocBatch   *tail;
+	int			len;
+	int			maxlen;
+	bool		done;			/* no more batches will be pushed */
+	bool		failed;			/* some worker failed */
+} BatchQueue;
+
+typedef struct FifoWorker
+{
+	pthread_t	thread;
+	PGconn	   *conn;
+	BatchQueue *queue;
+	const struct _param *param;
+} FifoWorker;
+
+static DocBatch *
+new_batch(int maxdocs)
+{
+	DocBatch   *batch = pg_malloc0(sizeof(DocBatch));
+
+	batch->maxdocs = maxdocs;
+	INSTR_TIME_SET_CURRENT(batch->created);
+	batch->offsets = pg_malloc(maxdocs * sizeof(size_t));
+	batch->lengths = pg_malloc(maxdocs * sizeof(size_t));
+	batch->mapped = pg_malloc0(maxdocs * sizeof(char *));
+	initPQExpBuffer(&batch->data);
+
+	return batch;
+}
+
+static void
+free_batch(DocBatch *batch)
+{
+	int			i;
+
+	for (i = 0; i < batch->ndocs; i++)
+		if (batch->mapped[i])
+			munmap(batch->mapped[i], batch->lengths[i]);
+
+	pg_free(batch->mapped);
+	pg_free(batch->offsets);
+	pg_free(batch->lengths);
+	termPQExpBuffer(&batch->data);
+	pg_free(batch);
+}
+
+/*
+ * Push batch to queue. Waits when the queue is full. Returns false,
+ * when some worker failed.
+ */
+static bool
+queue_push(BatchQueue *queue, DocBatch *batch)
+{
+	bool		result;
+
+	pthread_mutex_lock(&queue->mutex);
+
+	while (queue->len >= queue->maxlen && !queue->failed)
+		pthread_cond_wait(&queue->not_full, &queue->mutex);
+
+	result = !queue->failed;
+
+	if (result)
+	{
+		batch->next = NULL;
+		if (queue->tail)
+			queue->tail->next = batch;
+		else
+			queue->head = batch;
+		queue->tail = batch;
+		queue->len += 1;
+
+		pthread_cond_signal(&queue->not_empty);
+	}
+
+	pthread_mutex_unlock(&queue->mutex);
+
+	if (!result)
+		free_batch(batch);
+
+	return result;
+}
+
+/*
+ * Returns next batch, or NULL when there are not any other batches.
+ */
+static DocBatch *
+queue_pop(BatchQueue *queue)
+{
+	DocBatch   *batch = NULL;
+
+	pthread_mutex_lock(&queue->mutex);
+
+	while (!queue->head && !queue->done && !queue->failed)
+		pthread_cond_wait(&queue->not_empty, &queue->mutex);
+
+	if (queue->head && !queue->failed)
+	{
+		batch = queue->head;
+		queue->head = batch->next;
+		if (!queue->head)
+			queue->tail = NULL;
+		queue->len -= 1;
+
+		pthread_cond_signal(&queue->not_full);
+	}
+
+	pthread_mutex_unlock(&queue->mutex);
+
+	return batch;
+}
+
+static void
+queue_set(BatchQueue *queue, bool done, bool failed)
+{
+	pthread_mutex_lock(&queue->mutex);
+
+	queue->done |= done;
+	queue->failed |= failed;
+
+	pthread_cond_broadcast(&queue->not_empty);
+	pthread_cond_broadcast(&queue->not_full);
+
+	pthread_mutex_unlock(&queue->mutex);
+}
+
+static bool
+queue_failed(BatchQueue *queue)
+{
+	bool		result;
+
+	pthread_mutex_lock(&queue->mutex);
+	result = queue->failed;
+	pthread_mutex_unlock(&queue->mutex);
+
+	return result;
+}
+
+static void *
+fifo_worker(void *arg)
+{
+	FifoWorker *worker = (FifoWorker *) arg;
+	BatchImporter bi;
+	DocBatch   *batch;
+	bool		failed = false;
+
+	if (batch_begin(&bi, worker->conn, worker->param, 1) != 0)
+	{
+		queue_set(worker->queue, false, true);
+		return NULL;
+	}
+
+	while (!failed && (batch = queue_pop(worker->queue)) != NULL)
+	{
+		int			i;
+
+		for (i = 0; i < batch->ndocs && !failed; i++)
+			failed = batch_add(&bi,
+							   batch->mapped[i] ? batch->mapped[i] :
+							   batch->data.data + batch->offsets[i],
+							   batch->lengths[i],
+							   NULL) != 0;
+
+		if (!failed)
+			failed = batch_flush(&bi) != 0;
+
+		free_batch(batch);
+	}
+
+	if (!failed)
+		failed = batch_end(&bi) != 0;
+
+	if (failed)
+		queue_set(worker->queue, false, true);
+
+	return NULL;
+}
+
+/*
+ * Append document to stream's batch, and pass the full batch to workers.
+ * The mapped document is not copied, it is unmapped with batch.
+ */
+static bool
+add_document(FifoStream *stream, BatchQueue *queue,
+			 const char *data, size_t len, char *mapped,
+			 const struct _param * param)
+{
+	DocBatch   *batch;
+
+	workload_record(len);
+
+	if (!stream->batch)
+		stream->batch = new_batch(param->batch_size);
+
+	batch = stream->batch;
+
+	batch->offsets[batch->ndocs] = batch->data.len;
+	batch->lengths[batch->ndocs] = len;
+	batch->mapped[batch->ndocs] = mapped;
+	batch->ndocs += 1;
+
+	if (!mapped)
+	{
+		appendBinaryPQExpBuffer(&batch->data, data, len);
+		appendPQExpBufferChar(&batch->data, '\0');
+	}
+
+	if (PQExpBufferBroken(&batch->data))
+	{
+		fprintf(stderr, "%s: Out of memory\n", param->progname);
+		return false;
+	}
+
+	stream->ndocs += 1;
+
+	if (batch->ndocs >= batch->maxdocs)
+	{
+		stream->batch = NULL;
+		return queue_push(queue, batch);
+	}
+
+	return true;
+}
+
+/*
+ * Cut complete documents from stream's buffer. When "eof" is true, then
+ * the rest of data is last document.
+ */
+static bool
+frame_documents(FifoStream *stream, BatchQueue *queue, bool eof,
+				const struct _param * param)
+{
+	PQExpBuffer buf = &stream->buf;
+	size_t		pos = 0;
+
+	for (;;)
+	{
+		if (param->framing == FRAMING_LENGTH)
+		{
+			uint32		len;
+			unsigned char *hdr = (unsigned char *) buf->data + pos;
+
+			if (buf->len - pos < 4)
+				break;
+
+			len = ((uint32) hdr[0] << 24) | ((uint32) hdr[1] << 16) |
+				((uint32) hdr[2] << 8) | (uint32) hdr[3];
+
+			/* don't wait for data of garbage length (text in framed FIFO) */
+			if (len > MAX_DOCUMENT_SIZE)
+			{
+				fprintf(stderr, "%s: invalid frame length in '%s'\n",
+						param->progname, stream->path);
+				return false;
+			}
+
+			if (buf->len - pos - 4 < len)
+				break;
+
+			if (!add_document(stream, queue, buf->data + pos + 4, len, NULL, param))
+				return false;
+
+			pos += 4 + len;
+		}
+		else
+		{
+			char		delim = param->framing == FRAMING_NUL ? '\0' : '\n';
+			size_t		start = Max(pos, stream->scanned);
+			char	   *end;
+			size_t		len;
+
+			end = memchr(buf->data + start, delim, buf->len - start);
+			if (!end)
+			{
+				stream->scanned = buf->len;
+				break;
+			}
+
+			len = end - (buf->data + pos);
+
+			/* empty lines are ignored */
+			if (len > 0 || param->framing == FRAMING_NUL)
+			{
+				if (!add_document(stream, queue, buf->data + pos, len, NULL, param))
+					return false;
+			}
+
+			pos += len + 1;
+		}
+	}
+
+	if (eof && pos < buf->len)
+	{
+		if (param->framing == FRAMING_LENGTH)
+		{
+			fprintf(stderr, "%s: incomplete document at end of '%s'\n",
+					param->progname, stream->path);
+			return false;
+		}
+
+		if (!add_document(stream, queue, buf->data + pos, buf->len - pos, NULL,
+							  param))
+			return false;
+
+		pos = buf->len;
+	}
+
+	/* remove processed data */
+	if (pos > 0)
+	{
+		memmove(buf->data, buf->data + pos, buf->len - pos);
+		buf->len -= pos;
+		buf->data[buf->len] = '\0';
+		stream->scanned = stream->scanned > pos ? stream->scanned - pos : 0;
+	}
+
+	if (eof && stream->batch)
+	{
+		DocBatch   *batch = stream->batch;
+
+		stream->batch = NULL;
+		return queue_push(queue, batch);
+	}
+
+	return true;
+}
+
+/*
+ * Returns the time in ms to deadline of the oldest not full batch, or -1
+ * when there are not any waiting documents.
+ */
+static int
+batch_timeout(FifoStream *streams, int nstreams, const struct _param * param)
+{
+	instr_time	now;
+	int			timeout = -1;
+	int			i;
+
+	INSTR_TIME_SET_CURRENT(now);
+
+	for (i = 0; i < nstreams; i++)
+	{
+		instr_time	waited;
+		double		remain;
+
+		if (!streams[i].batch)
+			continue;
+
+		waited = now;
+		INSTR_TIME_SUBTRACT(waited, streams[i].batch->created);
+		remain = param->max_delay - INSTR_TIME_GET_MILLISEC(waited);
+
+		if (remain <= 0)
+			return 0;
+
+		/* round up, so the deadline is reached after poll */
+		if (timeout == -1 || (int) remain + 1 < timeout)
+			timeout = (int) remain + 1;
+	}
+
+	return timeout;
+}
+
+/*
+ * Pass not full batches waiting longer than max delay to workers
+ */
+static bool
+push_expired_batches(FifoStream *streams, int nstreams, BatchQueue *queue,
+					 const struct _param * param)
+{
+	instr_time	now;
+	int			i;
+
+	INSTR_TIME_SET_CURRENT(now);
+
+	for (i = 0; i < nstreams; i++)
+	{
+		DocBatch   *batch = streams[i].batch;
+		instr_time	waited;
+
+		if (!batch)
+			continue;
+
+		waited = now;
+		INSTR_TIME_SUBTRACT(waited, batch->created);
+
+		if (INSTR_TIME_GET_MILLISEC(waited) >= param->max_delay)
+		{
+			streams[i].batch = NULL;
+			if (!queue_push(queue, batch))
+				return false;
+		}
+	}
+
+	return true;
+}
+
+/*
+ * Read available data from stream. Returns false on error.
+ */
+static bool
+read_stream(FifoStream *stream, BatchQueue *queue,
+			const struct _param * param)
+{
+	PQExpBuffer buf = &stream->buf;
+	ssize_t		n;
+
+	if (!enlargePQExpBuffer(buf, COPY_CHUNK_SIZE))
+	{
+		fprintf(stderr, "%s: Out of memory\n", param->progname);
+		return false;
+	}
+
+	n = read(stream->fd, buf->data + buf->len, COPY_CHUNK_SIZE);
+	if (n < 0)
+	{
+		if (errno == EAGAIN || errno == EINTR)
+			return true;
+
+		fprintf(stderr, "%s: Cannot read data '%s': %s\n",
+				param->progname, stream->path, strerror(errno));
+		return false;
+	}
+
+	if (n == 0)
+	{
+		stream->eof = true;
+		close(stream->fd);
+
+		/* EOF is the end of data only when the decompression didn't fail */
+		if (stream->dc && decompress_failed(stream->dc))
+			return false;
+
+		if (param->verbose)
+			fprintf(stdout, "Stream '%s' closed after " INT64_FORMAT " documents\n",
+					stream->path, stream->ndocs);
+	}
+	else
+	{
+		buf->len += n;
+		buf->data[buf->len] = '\0';
+	}
+
+	return frame_documents(stream, queue, stream->eof, param);
+}
+
+/* set by SIGINT or SIGTERM, the import from socket ends */
+static volatile sig_atomic_t terminate_requested = false;
+
+static void
+terminate_handler(SIGNAL_ARGS)
+{
+	terminate_requested = true;
+}
+
+/*
+ * Create listening socket. The stale socket file is removed.
+ */
+static bool
+open_fd_socket(FdSocket *fs, const struct _param * param)
+{
+	struct sockaddr_un addr;
+	struct stat st;
+	struct sigaction act;
+
+	fs->nclients = 0;
+
+	if (strlen(param->fd_socket) >= sizeof(addr.sun_path))
+	{
+		fprintf(stderr, "%s: socket path '%s' is too long\n",
+				param->progname, param->fd_socket);
+		return false;
+	}
+
+	if (stat(param->fd_socket, &st) == 0 && S_ISSOCK(st.st_mode))
+		unlink(param->fd_socket);
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strlcpy(addr.sun_path, param->fd_socket, sizeof(addr.sun_path));
+
+	fs->listener = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fs->listener < 0 ||
+		bind(fs->listener, (struct sockaddr *) &addr, sizeof(addr)) != 0 ||
+		listen(fs->listener, MAX_FD_CLIENTS) != 0 ||
+		fcntl(fs->listener, F_SETFL, O_NONBLOCK) != 0)
+	{
+		fprintf(stderr, "%s: Unable to listen on '%s': %s\n",
+				param->progname, param->fd_socket, strerror(errno));
+		if (fs->listener >= 0)
+			close(fs->listener);
+		fs->listener = -1;
+		return false;
+	}
+
+	/* the service runs until it is stopped */
+	memset(&act, 0, sizeof(act));
+	act.sa_handler = terminate_handler;
+	sigemptyset(&act.sa_mask);
+	sigaction(SIGINT, &act, NULL);
+	sigaction(SIGTERM, &act, NULL);
+
+	if (param->verbose)
+		fprintf(stdout, "Listening for documents on '%s'\n", param->fd_socket);
+
+	return true;
+}
+
+static void
+close_fd_socket(FdSocket *fs, const struct _param * param)
+{
+	int			i;
+
+	for (i = 0; i < fs->nclients; i++)
+		close(fs->clients[i]);
+
+	if (fs->listener >= 0)
+	{
+		close(fs->listener);
+		unlink(param->fd_socket);
+	}
+
+	fs->nclients = 0;
+	fs->listener = -1;
+
+	termPQExpBuffer(&fs->copied);
+}
+
+/*
+ * Accept new producer
+ */
+static void
+accept_fd_client(FdSocket *fs, const struct _param * param)
+{
+	int			client;
+
+	client = accept(fs->listener, NULL, NULL);
+	if (client < 0)
+		return;
+
+	if (fs->nclients >= MAX_FD_CLIENTS)
+	{
+		fprintf(stderr, "%s: warning: too much producers connected to '%s'\n",
+				param->progname, param->fd_socket);
+		close(client);
+		return;
+	}
+
+	fcntl(client, F_SETFL, O_NONBLOCK);
+	fs->clients[fs->nclients++] = client;
+}
+
+/*
+ * Returns true, when the content of file cannot be changed (memfd with
+ * seals against shrinking and writing).
+ */
+static bool
+is_sealed_file(int fd)
+{
+#ifdef F_GET_SEALS
+	int			seals = fcntl(fd, F_GET_SEALS);
+
+	return seals >= 0 &&
+		(seals & (F_SEAL_SHRINK | F_SEAL_WRITE)) == (F_SEAL_SHRINK | F_SEAL_WRITE);
+#else
+	return false;
+#endif
+}
+
+/*
+ * Read content of passed file to buffer. The file offset is shared with
+ * producer, so the file is read from start by pread.
+ */
+static bool
+read_passed_file(int fd, size_t size, PQExpBuffer buf,
+				 const struct _param * param)
+{
+	resetPQExpBuffer(buf);
+
+	if (!enlargePQExpBuffer(buf, size))
+	{
+		fprintf(stderr, "%s: Out of memory\n", param->progname);
+		return false;
+	}
+
+	/* the file can be truncated by producer, then it is shorter */
+	while ((size_t) buf->len < size)
+	{
+		ssize_t		n = pread(fd, buf->data + buf->len, size - buf->len, buf->len);
+
+		if (n < 0 && errno == EINTR)
+			continue;
+
+		if (n < 0)
+		{
+			fprintf(stderr, "%s: warning: cannot read passed document: %s\n",
+					param->progname, strerror(errno));
+			return false;
+		}
+
+		if (n == 0)
+			break;
+
+		buf->len += n;
+	}
+
+	buf->data[buf->len] = '\0';
+
+	return true;
+}
+
+/*
+ * Add passed file as document. The sealed files are mapped, other files
+ * are copied. The errors of producer's files are reported as warnings,
+ * the import continues.
+ */
+static bool
+add_passed_file(FdSocket *fs, int fd, BatchQueue *queue,
+				const struct _param * param)
+{
+	struct stat st;
+	char	   *mapped = NULL;
+	bool		result;
+
+	if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode))
+	{
+		fprintf(stderr, "%s: warning: passed file descriptor is not regular file or memfd\n",
+				param->progname);
+		close(fd);
+		return true;
+	}
+
+	if (st.st_size > MAX_DOCUMENT_SIZE)
+	{
+		fprintf(stderr, "%s: warning: passed document is too big (greather than 1GB)\n",
+				param->progname);
+		close(fd);
+		return true;
+	}
+
+	/*
+	 * The mapping of file changed by producer can crash the import (SIGBUS
+	 * after truncating), and TEXT documents have to be terminated by zero
+	 * byte, so only sealed memfds with binary content are mapped.
+	 */
+	if (st.st_size == 0 || param->fmt == FORMAT_TEXT || !is_sealed_file(fd))
+	{
+		if (!read_passed_file(fd, st.st_size, &fs->copied, param))
+		{
+			close(fd);
+
+			/* only out of memory is fatal */
+			return !PQExpBufferBroken(&fs->copied);
+		}
+
+		close(fd);
+
+		return add_document(fs->stream, queue, fs->copied.data,
+							fs->copied.len, NULL, param);
+	}
+
+	mapped = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	if (mapped == MAP_FAILED)
+	{
+		fprintf(stderr, "%s: warning: cannot map passed document: %s\n",
+				param->progname, strerror(errno));
+		close(fd);
+		return true;
+	}
+
+	/* the mapping holds the file */
+	close(fd);
+
+	result = add_document(fs->stream, queue, mapped, st.st_size, mapped,
+						  param);
+
+	return result;
+}
+
+/*
+ * Receive file descriptors from producer. Returns false on fatal error,
+ * the connection of producer is closed when it is finished (or broken).
+ */
+static bool
+read_fd_client(FdSocket *fs, int idx, BatchQueue *queue,
+			   const struct _param * param)
+{
+	char		data[MAX_PASSED_FDS];
+	char		control[CMSG_SPACE(MAX_PASSED_FDS * sizeof(int))];
+	struct msghdr msg;
+	struct iovec iov;
+	struct cmsghdr *cmsg;
+	ssize_t		n;
+	bool		result = true;
+
+	iov.iov_base = data;
+	iov.iov_len = sizeof(data);
+
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = control;
+	msg.msg_controllen = sizeof(control);
+
+	n = recvmsg(fs->clients[idx], &msg, 0);
+	if (n < 0 && (errno == EAGAIN || errno == EINTR))
+		return true;
+
+	if (msg.msg_flags & MSG_CTRUNC)
+		fprintf(stderr, "%s: warning: more than %d file descriptors passed by one message, some are lost\n",
+				param->progname, MAX_PASSED_FDS);
+
+	for (cmsg = n > 0 ? CMSG_FIRSTHDR(&msg) : NULL;
+		 cmsg != NULL;
+		 cmsg = CMSG_NXTHDR(&msg, cmsg))
+	{
+		int			fds[MAX_PASSED_FDS];
+		int			nfds;
+		int			i;
+
+		if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS)
+			continue;
+
+		nfds = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+		memcpy(fds, CMSG_DATA(cmsg), nfds * sizeof(int));
+
+		for (i = 0; i < nfds; i++)
+		{
+			if (result)
+				result = add_passed_file(fs, fds[i], queue, param);
+			else
+				close(fds[i]);
+		}
+	}
+
+	/* producer closed the connection */
+	if (n <= 0)
+	{
+		close(fs->clients[idx]);
+		fs->clients[idx] = fs->clients[--fs->nclients];
+	}
+
+	return result;
+}
+
+/*
+ * Start worker thread for established connection
+ */
+static bool
+start_worker(FifoWorker *worker, PGconn *conn, BatchQueue *queue,
+			 const struct _param * param)
+{
+	sigset_t	sigset;
+	sigset_t	oldset;
+	int			rc;
+
+	worker->conn = conn;
+	worker->queue = queue;
+	worker->param = param;
+
+	/* SIGINT and SIGTERM have to be delivered to the poll loop */
+	sigemptyset(&sigset);
+	sigaddset(&sigset, SIGINT);
+	sigaddset(&sigset, SIGTERM);
+	pthread_sigmask(SIG_BLOCK, &sigset, &oldset);
+
+	rc = pthread_create(&worker->thread, NULL, fifo_worker, worker);
+
+	pthread_sigmask(SIG_SETMASK, &oldset, NULL);
+
+	if (rc != 0)
+	{
+		fprintf(stderr, "%s: cannot create thread: %s\n",
+				param->progname, strerror(rc));
+		PQfinish(conn);
+		worker->conn = NULL;
+		return false;
+	}
+
+	return true;
+}
+
+/*
+ * Import documents from all FIFOs until all producers close them.
+ */
+int
+import_fifos(const char *database, const struct _param * param)
+{
+	FifoStream *streams;
+	FifoWorker *workers;
+	AsyncConnection *pending;
+	struct pollfd *fds;
+	BatchQueue	queue;
+	FdSocket	fs;
+	int			nstreams = param->nfifos;
+	int			nworkers = 0;
+	int			npending = 0;
+	int			npolled;
+	int			nopen;
+	bool		failed = false;
+	int			i;
+
+	/* documents from socket have own stream */
+	if (param->fd_socket)
+		nstreams += 1;
+
+	streams = pg_malloc0(nstreams * sizeof(FifoStream));
+	fds = pg_malloc((param->nfifos + 1 + MAX_FD_CLIENTS + param->jobs) *
+					sizeof(struct pollfd));
+	workers = pg_malloc0(param->jobs * sizeof(FifoWorker));
+	pending = pg_malloc0(param->jobs * sizeof(AsyncConnection));
+
+	memset(&queue, 0, sizeof(queue));
+	pthread_mutex_init(&queue.mutex, NULL);
+	pthread_cond_init(&queue.not_empty, NULL);
+	pthread_cond_init(&queue.not_full, NULL);
+	queue.maxlen = 2 * param->jobs;
+
+	for (i = 0; i < param->nfifos; i++)
+	{
+		FifoStream *stream = &streams[i];
+
+		stream->path = param->fifos[i];
+		initPQExpBuffer(&stream->buf);
+
+		/* don't wait for writer */
+		stream->fd = open(stream->path, O_RDONLY | O_NONBLOCK);
+		if (stream->fd < 0)
+		{
+			fprintf(stderr, "%s: Unable to open '%s': %s\n",
+					param->progname, stream->path, strerror(errno));
+			stream->eof = true;
+			failed = true;
+		}
+		else if (decompress_start(&stream->dc, stream->path, &stream->fd, param) != 0)
+			failed = true;
+	}
+
+	fs.listener = -1;
+	fs.nclients = 0;
+	fs.stream = NULL;
+	initPQExpBuffer(&fs.copied);
+
+	if (param->fd_socket)
+	{
+		fs.stream = &streams[param->nfifos];
+		fs.stream->path = param->fd_socket;
+		fs.stream->fd = -1;
+		initPQExpBuffer(&fs.stream->buf);
+
+		if (!failed && !open_fd_socket(&fs, param))
+			failed = true;
+	}
+
+	/*
+	 * First connection is opened synchronously, so the password is prompted
+	 * (when it is necessary) before other connections are started.
+	 */
+	if (!failed)
+	{
+		PGconn	   *conn = connect_database(database, param);
+
+		if (!conn || !start_worker(&workers[0], conn, &queue, param))
+			failed = true;
+		else
+			nworkers = 1;
+	}
+
+	for (i = 1; i < param->jobs && !failed; i++)
+	{
+		if (!connect_database_start(&pending[npending], database, param))
+			failed = true;
+		else
+			npending += 1;
+	}
+
+	nopen = failed ? 0 : param->nfifos;
+
+	/* socket is open until the import is stopped */
+	if (fs.listener >= 0)
+		nopen += 1;
+
+	while (nopen > 0 && !failed)
+	{
+		int			nfds = 0;
+		int			socket_base;
+		int			nclients = fs.nclients;
+		int			pending_base;
+		int			rc;
+
+		for (i = 0; i < param->nfifos; i++)
+		{
+			if (streams[i].eof)
+				continue;
+
+			fds[nfds].fd = streams[i].fd;
+			fds[nfds].events = POLLIN;
+			fds[nfds].revents = 0;
+			nfds++;
+		}
+
+		/* listener is followed by connected producers */
+		socket_base = nfds;
+		if (fs.listener >= 0)
+		{
+			fds[nfds].fd = fs.listener;
+			fds[nfds].events = POLLIN;
+			fds[nfds].revents = 0;
+			nfds++;
+
+			for (i = 0; i < nclients; i++)
+			{
+				fds[nfds].fd = fs.clients[i];
+				fds[nfds].events = POLLIN;
+				fds[nfds].revents = 0;
+				nfds++;
+			}
+		}
+
+		pending_base = nfds;
+		for (i = 0; i < npending; i++)
+		{
+			fds[nfds].fd = PQsocket(pending[i].conn);
+			fds[nfds].events = pending[i].status == PGRES_POLLING_READING ?
+				POLLIN : POLLOUT;
+			fds[nfds].revents = 0;
+			nfds++;
+		}
+
+		rc = poll(fds, nfds, batch_timeout(streams, nstreams, param));
+
+		if (terminate_requested)
+		{
+			if (param->verbose)
+				fprintf(stdout, "Import is stopped, waiting batches are imported\n");
+
+			/* import not full batches of all streams */
+			for (i = 0; i < nstreams && !failed; i++)
+			{
+				DocBatch   *batch = streams[i].batch;
+
+				streams[i].batch = NULL;
+				if (batch && !queue_push(&queue, batch))
+					failed = true;
+			}
+
+			break;
+		}
+
+		if (rc < 0)
+		{
+			if (errno == EINTR)
+				continue;
+
+			fprintf(stderr, "%s: poll failed: %s\n",
+					param->progname, strerror(errno));
+			failed = true;
+			break;
+		}
+
+		nfds = 0;
+		for (i = 0; i < param->nfifos && !failed; i++)
+		{
+			FifoStream *stream = &streams[i];
+
+			if (stream->eof)
+				continue;
+
+			if (fds[nfds++].revents & (POLLIN | POLLHUP | POLLERR))
+			{
+				if (!read_stream(stream, &queue, param))
+					failed = true;
+				else if (stream->eof)
+					nopen -= 1;
+			}
+		}
+
+		if (fs.listener >= 0 && !failed)
+		{
+			/* the producer can be removed, so they are processed from end */
+			for (i = nclients - 1; i >= 0 && !failed; i--)
+			{
+				if (fds[socket_base + 1 + i].revents & (POLLIN | POLLHUP | POLLERR))
+					failed = !read_fd_client(&fs, i, &queue, param);
+			}
+
+			if (fds[socket_base].revents & POLLIN)
+				accept_fd_client(&fs, param);
+		}
+
+		if (!failed && !push_expired_batches(streams, nstreams, &queue, param))
+			failed = true;
+
+		/* continue in connecting, start workers for ready connections */
+		npolled = npending;
+		npending = 0;
+		for (i = 0; i < npolled; i++)
+		{
+			AsyncConnection *ac = &pending[i];
+
+			if (failed || fds[pending_base + i].revents == 0)
+			{
+				pending[npending++] = *ac;
+				continue;
+			}
+
+			rc = connect_database_poll(ac, database, param);
+			if (rc < 0)
+				failed = true;
+			else if (rc == 0)
+				pending[npending++] = *ac;
+			else if (!start_worker(&workers[nworkers], ac->conn, &queue, param))
+				failed = true;
+			else
+				nworkers += 1;
+		}
+
+		if (queue_failed(&queue))
+			failed = true;
+	}
+
+	close_fd_socket(&fs, param);
+
+	queue_set(&queue, true, failed);
+
+	/* the import is done, connections not ready yet are not necessary */
+	for (i = 0; i < npending; i++)
+		PQfinish(pending[i].conn);
+
+	for (i = 0; i < nworkers; i++)
+	{
+		pthread_join(workers[i].thread, NULL);
+		PQfinish(workers[i].conn);
+	}
+
+	if (queue_failed(&queue))
+		failed = true;
+
+	/* release not processed batches */
+	while (queue.head)
+	{
+		DocBatch   *batch = queue.head;
+
+		queue.head = batch->next;
+		free_batch(batch);
+	}
+
+	for (i = 0; i < nstreams; i++)
+	{
+		if (!streams[i].eof && streams[i].fd >= 0)
+			close(streams[i].fd);
+		if (streams[i].dc)
+			decompress_end(streams[i].dc);
+		if (streams[i].batch)
+			free_batch(streams[i].batch);
+		termPQExpBuffer(&streams[i].buf);
+	}
+
+	pg_free(streams);
+	pg_free(fds);
+	pg_free(workers);
+	pg_free(pending);
+
+	return failed ? -1 : 0;
+}
+
+#else							/* WIN32 */
+
+int
+import_fifos(const char *database, const struct _param * param)
+{
+	fprintf(stderr, "%s: FIFO inputs are not supported on this platform\n",
+			param->progname);
+
+	return -1;
+}
+
+#endif							/* WIN32 */
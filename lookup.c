@@ -0,0 +1,322 @@
+/*-------------------------------------------------------------------------
+ *
+ * lookup.c
+ *	  lookups of already imported documents
+ *
+ * Before import of document the lookup query is executed with same
+ * parameters like the command (document, values of headers), and the
+ * document is skipped when the query returns some row. The lookups use
+ * own connection - to the read host (usually hot standby), so the load
+ * of primary is reduced, or to the primary, when the read host is not
+ * specified. With canonical hash the query gets the hash (text) instead
+ * of document.
+ *
+ * The replica can be behind the primary. The position of WAL of primary
+ * is taken at start and after every committed batch, and the lookups
+ * wait until the replica replays it, so the recent writes are visible.
+ * When the replica doesn't replay it in time, the lookups use the
+ * primary.
+ *
+ * IDENTIFICATION
+ *   lookup.c
+ *
+ *-------------------------------------------------------------------------
+ */
+#include "postgres_fe.h"
+
+#include "portability/instr_time.h"
+
+#include "pgimportdoc.h"
+
+#if PG_VERSION_NUM >= 110000
+
+#include "catalog/pg_type_d.h"
+
+#else
+
+#include "catalog/pg_type.h"
+
+#endif
+
+#define LOOKUP_STMT_NAME	"pgimportdoc_lookup"
+
+/* interval of checking of replay position */
+#define REPLAY_CHECK_INTERVAL	1000	/* usec */
+
+/*
+ * Returns the result of query with one value, or NULL on error (malloced)
+ */
+static char *
+lookup_value(PGconn *conn, const char *query, const char *param1,
+			 const struct _param * param)
+{
+	PGresult   *result;
+	char	   *value = NULL;
+
+	result = PQexecParams(conn, query, param1 ? 1 : 0, NULL, &param1,
+						  NULL, NULL, 0);
+
+	if (PQresultStatus(result) != PGRES_TUPLES_OK || PQntuples(result) != 1)
+		fprintf(stderr, "%s: Error: %s\n",
+				param->progname, PQresultErrorMessage(result));
+	else
+		value = pg_strdup(PQgetisnull(result, 0, 0) ? "" : PQgetvalue(result, 0, 0));
+
+	PQclear(result);
+
+	return value;
+}
+
+/*
+ * Prepare the lookup query on lookup connection
+ */
+static int
+lookup_prepare(Lookup *lk)
+{
+	const struct _param *param = lk->param;
+	Oid			ptypes[MAX_HEADERS + 1];
+	PGresult   *result;
+	int			i;
+
+	if (param->canonical_hash != CANONICAL_NONE)
+		ptypes[0] = TEXTOID;
+	else if (param->fmt == FORMAT_XML)
+		ptypes[0] = XMLOID;
+	else if (param->fmt == FORMAT_BYTEA)
+		ptypes[0] = BYTEAOID;
+	else
+		ptypes[0] = TEXTOID;
+
+	/* all parameters have known type, so they need not be used */
+	for (i = 1; i < lk->nparams; i++)
+		ptypes[i] = TEXTOID;
+
+	result = PQprepare(lk->conn, LOOKUP_STMT_NAME, param->skip_existing,
+					   lk->nparams, ptypes);
+
+	if (PQresultStatus(result) != PGRES_COMMAND_OK)
+	{
+		fprintf(stderr, "%s: Error: %s\n",
+				param->progname, PQresultErrorMessage(result));
+		PQclear(result);
+		return -1;
+	}
+
+	PQclear(result);
+
+	return 0;
+}
+
+/*
+ * Use the primary for lookups
+ */
+static int
+lookup_use_primary(Lookup *lk)
+{
+	if (lk->conn)
+		PQfinish(lk->conn);
+
+	lk->on_replica = false;
+	lk->wait_lsn[0] = '\0';
+
+	lk->conn = connect_database(PQdb(lk->primary), lk->param);
+	if (!lk->conn)
+		return -1;
+
+	return lookup_prepare(lk);
+}
+
+/*
+ * Store current position of WAL of primary. The lookups on replica
+ * wait until it is replayed.
+ */
+int
+lookup_sync(Lookup *lk)
+{
+	char	   *lsn;
+
+	if (!lk->on_replica)
+		return 0;
+
+	lsn = lookup_value(lk->primary,
+					   PQserverVersion(lk->primary) >= 100000 ?
+					   "SELECT pg_catalog.pg_current_wal_lsn()" :
+					   "SELECT pg_catalog.pg_current_xlog_location()",
+					   NULL, lk->param);
+	if (!lsn)
+		return -1;
+
+	strlcpy(lk->wait_lsn, lsn, sizeof(lk->wait_lsn));
+	pg_free(lsn);
+
+	return 0;
+}
+
+/*
+ * Wait until replica replays the stored position of primary
+ */
+static int
+lookup_wait_replay(Lookup *lk)
+{
+	const struct _param *param = lk->param;
+	instr_time	start;
+
+	INSTR_TIME_SET_CURRENT(start);
+
+	for (;;)
+	{
+		instr_time	now;
+		char	   *replayed;
+		bool		done;
+
+		replayed = lookup_value(lk->conn,
+								PQserverVersion(lk->conn) >= 100000 ?
+								"SELECT pg_catalog.pg_wal_lsn_diff(pg_catalog.pg_last_wal_replay_lsn(), $1) >= 0" :
+								"SELECT pg_catalog.pg_xlog_location_diff(pg_catalog.pg_last_xlog_replay_location(), $1) >= 0",
+								lk->wait_lsn, param);
+		if (!replayed)
+			return -1;
+
+		done = strcmp(replayed, "t") == 0;
+		pg_free(replayed);
+
+		if (done)
+			break;
+
+		INSTR_TIME_SET_CURRENT(now);
+		INSTR_TIME_SUBTRACT(now, start);
+
+		if (INSTR_TIME_GET_MILLISEC(now) >= param->max_replay_wait)
+		{
+			fprintf(stderr, "%s: warning: read host replays WAL more than %d ms, primary is used for lookups\n",
+					param->progname, param->max_replay_wait);
+			return lookup_use_primary(lk);
+		}
+
+		pg_usleep(REPLAY_CHECK_INTERVAL);
+	}
+
+	lk->wait_lsn[0] = '\0';
+
+	return 0;
+}
+
+/*
+ * Open lookup connection and prepare lookup query. The nparams is number
+ * of parameters of lookup (document and values of headers).
+ */
+int
+lookup_begin(Lookup *lk, PGconn *primary, const struct _param * param,
+			 int nparams)
+{
+	char	   *in_recovery;
+
+	memset(lk, 0, sizeof(Lookup));
+	initPQExpBuffer(&lk->text);
+
+	lk->primary = primary;
+	lk->param = param;
+	lk->nparams = nparams;
+
+	if (!param->read_host)
+		return lookup_use_primary(lk);
+
+	lk->conn = connect_read_database(PQdb(primary), param);
+	if (!lk->conn)
+		return -1;
+
+	in_recovery = lookup_value(lk->conn, "SELECT pg_catalog.pg_is_in_recovery()",
+							   NULL, param);
+	if (!in_recovery)
+		return -1;
+
+	lk->on_replica = strcmp(in_recovery, "t") == 0;
+	pg_free(in_recovery);
+
+	if (param->verbose)
+		fprintf(stdout, "Lookups use read host \"%s\"%s\n", param->read_host,
+				lk->on_replica ? " (hot standby)" : "");
+
+	if (lookup_prepare(lk) != 0)
+		return -1;
+
+	/* the documents imported before start should be visible */
+	return lookup_sync(lk);
+}
+
+/*
+ * Returns 1 when the document is imported already, 0 when not, -1 on error
+ */
+int
+lookup_exists(Lookup *lk, const char *data, size_t len,
+			  const char *const *params)
+{
+	const struct _param *param = lk->param;
+	const char *pvalues[MAX_HEADERS + 1];
+	int			plengths[MAX_HEADERS + 1];
+	int			pformats[MAX_HEADERS + 1];
+	PGresult   *result;
+	int			rc;
+	int			i;
+
+	if (lk->wait_lsn[0] != '\0' && lookup_wait_replay(lk) != 0)
+		return -1;
+
+	pvalues[0] = data;
+	plengths[0] = len;
+	pformats[0] = param->fmt == FORMAT_TEXT ||
+		param->canonical_hash != CANONICAL_NONE ? 0 : 1;
+
+	/* libpq reads text parameter to zero byte, the length is ignored */
+	if (pformats[0] == 0)
+	{
+		resetPQExpBuffer(&lk->text);
+		appendBinaryPQExpBuffer(&lk->text, data, len);
+
+		if (PQExpBufferBroken(&lk->text))
+		{
+			fprintf(stderr, "%s: Out of memory\n", param->progname);
+			return -1;
+		}
+
+		pvalues[0] = lk->text.data;
+	}
+
+	for (i = 1; i < lk->nparams; i++)
+	{
+		pvalues[i] = params[i - 1];
+		plengths[i] = 0;
+		pformats[i] = 0;
+	}
+
+	result = PQexecPrepared(lk->conn, LOOKUP_STMT_NAME,
+							lk->nparams, pvalues, plengths, pformats, 0);
+
+	if (PQresultStatus(result) != PGRES_TUPLES_OK)
+	{
+		fprintf(stderr, "%s: Error: %s\n",
+				param->progname, PQresultErrorMessage(result));
+		PQclear(result);
+		return -1;
+	}
+
+	rc = PQntuples(result) > 0 ? 1 : 0;
+
+	PQclear(result);
+
+	return rc;
+}
+
+/*
+ * Close lookup connection
+ */
+void
+lookup_end(Lookup *lk)
+{
+	if (lk->conn)
+		PQfinish(lk->conn);
+
+	lk->conn = NULL;
+
+	termPQExpBuffer(&lk->text);
+}
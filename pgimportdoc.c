@@ -14,15 +14,23 @@
 
 #include <sys/stat.h>
 #include <fcntl.h>
+#include <pthread.h>
 #include <unistd.h>
+#ifndef WIN32
+#include <netdb.h>
+#include <sys/socket.h>
+#endif
 #ifdef HAVE_TERMIOS_H
 #include <termios.h>
 #endif
 
+#include "getopt_long.h"
 #include "libpq-fe.h"
 #include "pg_getopt.h"
 #include "pqexpbuffer.h"
 
+#include "pgimportdoc.h"
+
 #if PG_VERSION_NUM >= 140000
 
 #include "common/string.h"
@@ -41,170 +49,306 @@
 
 #define BUFSIZE			1024
 
-enum trivalue
-{
-	TRI_DEFAULT,
-	TRI_NO,
-	TRI_YES
-};
+static void usage(const char *progname);
 
-enum format
+/*
+ * Returns true when command is COPY statement. Then the document is
+ * streamed to server as one field of COPY text format.
+ */
+bool
+is_copy_command(const char *command)
 {
-	FORMAT_XML,
-	FORMAT_TEXT,
-	FORMAT_BYTEA
-};
+	while (isspace((unsigned char) *command))
+		command++;
 
-struct _param
-{
-	char	   *pg_user;
-	enum trivalue pg_prompt;
-	char	   *pg_port;
-	char	   *pg_host;
-	const char *progname;
-	int			verbose;
-	enum format fmt;
-	char	   *command;
-	bool		use_stdin;
-	char	   *filename;
-	char	   *encoding;
-};
+	return pg_strncasecmp(command, "copy", 4) == 0 &&
+		(command[4] == '\0' || isspace((unsigned char) command[4]));
+}
 
-static void usage(const char *progname);
 /*
- * This imports stdin to target database
+ * Stream input to COPY FROM STDIN command. The document is escaped
+ * (or hex encoded for BYTEA) by chunks, so it is not necessary to hold
+ * whole document in memory.
  */
 static int
-pgimportdoc(const char *database, const struct _param * param)
+import_copy(PGconn *conn, FILE *input, const struct _param * param)
 {
-	PGconn	   *conn;
-	bool		new_pass;
-	static bool have_password = false;
-	FILE	   *input;
-	char		buffer[BUFSIZE];
-	size_t		size;
-	PQExpBufferData data;
-	PGresult	*result = NULL;
-	Oid			ptypes[10];
-	int			pformats[10];
-	const char * pvalues[10];
-	int			plengths[10];
+	PGresult   *result;
 	ExecStatusType status;
+	char	   *buffer;
+	char	   *decbuf;
+	char	   *escbuf;
+	size_t		size;
+	int64		total = 0;
+	const char *errormsg = NULL;
+	DecodeState dstate;
+	int			(*putdata) (PGconn *conn, const char *buffer, int nbytes);
+	const char *send_error = "cannot send data";
 
-#if PG_VERSION_NUM >= 140000
+	result = PQexec(conn, param->command);
+	status = PQresultStatus(result);
 
-	char	   *password = NULL;
+	if (param->verbose)
+		fprintf(stdout, "Result status: %s\n", PQresStatus(status));
 
-#elif PG_VERSION_NUM >= 100000
+	if (status != PGRES_COPY_IN)
+	{
+		fprintf(stderr, "%s: Unexpected result status: %s\n",
+				param->progname, PQresStatus(status));
+		fprintf(stderr, "%s: Error: %s\n",
+				param->progname, PQresultErrorMessage(result));
+		PQclear(result);
+		return -1;
+	}
 
-	static char password[100];
+	if (PQbinaryTuples(result))
+	{
+		fprintf(stderr, "%s: only text format of COPY is supported\n",
+				param->progname);
+		PQclear(result);
+		PQputCopyEnd(conn, "binary format is not supported by pgimportdoc");
+		PQclear(PQgetResult(conn));
+		return -1;
+	}
 
-#else
+	PQclear(result);
 
-	char	   *password = NULL;
+	putdata = PQputCopyData;
+	if (param->direct_copy && copy_direct_start(conn, param))
+		putdata = copy_direct_put;
 
-#endif
+	buffer = pg_malloc(COPY_CHUNK_SIZE);
+	decbuf = pg_malloc(COPY_CHUNK_SIZE);
+	escbuf = pg_malloc(2 * COPY_CHUNK_SIZE);
 
+	decode_init(&dstate, param->input_encoding);
 
+	/* bytea value in hex format, the backslash has to be escaped */
+	if (param->fmt == FORMAT_BYTEA)
+	{
+		if (putdata(conn, "\\\\x", 3) != 1)
+			errormsg = send_error;
+	}
 
-	/* Note: password can be carried over from a previous call */
-	if (param->pg_prompt == TRI_YES && !have_password)
+	while (!errormsg && (size = fread(buffer, 1, COPY_CHUNK_SIZE, input)) > 0)
 	{
+		const char *chunk = buffer;
+		size_t		len;
 
-#if PG_VERSION_NUM >= 140000
+		if (param->input_encoding != INPUT_ENCODING_NONE)
+		{
+			ssize_t		declen = decode_chunk(&dstate, decbuf, buffer, size);
 
-		password = simple_prompt("Password: ", false);
+			if (declen < 0)
+			{
+				fprintf(stderr, "%s: invalid %s input data\n",
+						param->progname,
+						param->input_encoding == INPUT_ENCODING_BASE64 ? "base64" : "hex");
+				errormsg = "invalid input data";
+				break;
+			}
 
-#elif PG_VERSION_NUM >= 100000
+			chunk = decbuf;
+			size = declen;
+		}
 
-		simple_prompt("Password: ", password, sizeof(password), false);
+		/* size of document, like in INSERT path (decoded) */
+		total += size;
 
-#else
+		if (param->fmt == FORMAT_BYTEA)
+			len = hex_encode_bytes(escbuf, chunk, size);
+		else
+			len = copy_escape_text(escbuf, chunk, size);
 
-		password = simple_prompt("Password: ", 100, false);
+		if (putdata(conn, escbuf, len) != 1)
+			errormsg = send_error;
+	}
 
-#endif
+	if (!errormsg && ferror(input))
+	{
+		fprintf(stderr, "%s: Cannot read data '%s': %s\n",
+				param->progname,
+				param->filename ? param->filename : "stdin",
+				strerror(errno));
+		errormsg = "cannot read input";
+	}
 
-		have_password = true;
+	if (!errormsg && !decode_finish(&dstate))
+	{
+		fprintf(stderr, "%s: incomplete encoded input data\n",
+				param->progname);
+		errormsg = "incomplete input data";
 	}
 
-	/*
-	 * Start the connection.  Loop until we have a password if requested by
-	 * backend.
-	 */
-	do
+	pg_free(buffer);
+	pg_free(decbuf);
+	pg_free(escbuf);
+
+	if (!errormsg && putdata(conn, "\n", 1) != 1)
+		errormsg = send_error;
+
+	/* the protocol can be broken by partially sent message */
+	if (errormsg == send_error && putdata == copy_direct_put)
 	{
-#define PARAMS_ARRAY_SIZE	   7
+		fprintf(stderr, "%s: Cannot send data: %s\n",
+				param->progname, strerror(errno));
+		return -1;
+	}
 
-		const char *keywords[PARAMS_ARRAY_SIZE];
-		const char *values[PARAMS_ARRAY_SIZE];
+	if (PQputCopyEnd(conn, errormsg) != 1)
+	{
+		fprintf(stderr, "%s: Error: %s\n",
+				param->progname, PQerrorMessage(conn));
+		return -1;
+	}
+
+	if (param->verbose)
+		fprintf(stdout, "Streamed data of size: " INT64_FORMAT "\n", total);
 
-		keywords[0] = "host";
-		values[0] = param->pg_host;
-		keywords[1] = "port";
-		values[1] = param->pg_port;
-		keywords[2] = "user";
-		values[2] = param->pg_user;
-		keywords[3] = "password";
-		values[3] = have_password ? password : NULL;
-		keywords[4] = "dbname";
-		values[4] = database;
-		keywords[5] = "fallback_application_name";
-		values[5] = param->progname;
-		keywords[6] = NULL;
-		values[6] = NULL;
-
-		new_pass = false;
+	if (!errormsg)
+		workload_record(total);
 
-		conn = PQconnectdbParams(keywords, values, true);
-		if (!conn)
-		{
-			fprintf(stderr, "Connection to database \"%s\" failed\n",
-					database);
-			return -1;
-		}
+	result = PQgetResult(conn);
+	status = PQresultStatus(result);
 
-		if (PQstatus(conn) == CONNECTION_BAD &&
-			PQconnectionNeedsPassword(conn) &&
-			!have_password &&
-			param->pg_prompt != TRI_NO)
-		{
-			PQfinish(conn);
+	if (param->verbose)
+		fprintf(stdout, "Result status: %s\n", PQresStatus(status));
 
-#if PG_VERSION_NUM >= 140000
+	if (status != PGRES_COMMAND_OK)
+	{
+		fprintf(stderr, "%s: Unexpected result status: %s\n",
+				param->progname, PQresStatus(status));
+		fprintf(stderr, "%s: Error: %s\n",
+				param->progname, PQresultErrorMessage(result));
+		PQclear(result);
+		return -1;
+	}
+
+	PQclear(result);
+
+	/* consume possible remaining results */
+	while ((result = PQgetResult(conn)) != NULL)
+		PQclear(result);
+
+	return errormsg ? -1 : 0;
+}
+
+/* the password is shared by all connections */
+static char *saved_password = NULL;
+static pthread_mutex_t connect_mutex = PTHREAD_MUTEX_INITIALIZER;
 
-		if (password)
-			free(password);
+/* -1 not checked yet, 1 when host is local and Unix socket can be used */
+static int	use_local_socket = -1;
+
+/*
+ * Returns malloced password
+ */
+static char *
+prompt_password(void)
+{
+#if PG_VERSION_NUM >= 140000
 
-		password = simple_prompt("Password: ", false);
+	return simple_prompt("Password: ", false);
 
 #elif PG_VERSION_NUM >= 100000
 
-			simple_prompt("Password: ", password, sizeof(password), false);
+	char		password[100];
 
-#else
+	simple_prompt("Password: ", password, sizeof(password), false);
 
-			if (password)
-				free(password);
+	return pg_strdup(password);
 
-			password = simple_prompt("Password: ", 100, false);
+#else
+
+	return simple_prompt("Password: ", 100, false);
 
 #endif
+}
 
-			have_password = true;
-			new_pass = true;
-		}
-	} while (new_pass);
+/*
+ * Returns true when host name is resolved to address of this machine.
+ * Only local address can be bound by socket.
+ */
+static bool
+host_is_local(const char *host)
+{
+#ifndef WIN32
 
-	/* check to see that the backend connection was successfully made */
-	if (PQstatus(conn) == CONNECTION_BAD)
+	struct addrinfo hints;
+	struct addrinfo *addrs;
+	struct addrinfo *ai;
+	bool		result = false;
+
+	/* socket directory, or list of hosts */
+	if (host == NULL || is_absolute_path(host) || host[0] == '@' ||
+		strchr(host, ',') != NULL)
+		return false;
+
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+
+	if (getaddrinfo(host, NULL, &hints, &addrs) != 0)
+		return false;
+
+	for (ai = addrs; ai && !result; ai = ai->ai_next)
 	{
-		fprintf(stderr, "Connection to database \"%s\" failed:\n%s",
-				database, PQerrorMessage(conn));
-		PQfinish(conn);
-		return -1;
+		int			sock = socket(ai->ai_family, SOCK_STREAM, 0);
+
+		if (sock < 0)
+			continue;
+
+		result = bind(sock, ai->ai_addr, ai->ai_addrlen) == 0;
+		close(sock);
 	}
 
+	freeaddrinfo(addrs);
+
+	return result;
+
+#else
+
+	return false;
+
+#endif
+}
+
+#define PARAMS_ARRAY_SIZE	   7
+
+/*
+ * Fill connection parameters
+ */
+static void
+connect_params(const char **keywords, const char **values,
+			   const char *database, const struct _param * param,
+			   const char *password, bool try_socket)
+{
+	keywords[0] = "host";
+	values[0] = try_socket ? DEFAULT_PGSOCKET_DIR : param->pg_host;
+	keywords[1] = "port";
+	values[1] = param->pg_port;
+	keywords[2] = "user";
+	values[2] = param->pg_user;
+	keywords[3] = "password";
+	values[3] = password;
+	keywords[4] = "dbname";
+	values[4] = database;
+	keywords[5] = "fallback_application_name";
+	values[5] = param->progname;
+	keywords[6] = NULL;
+	values[6] = NULL;
+}
+
+/*
+ * Set client encoding of established connection. Returns NULL (and
+ * closes the connection) on error.
+ */
+static PGconn *
+setup_connection(PGconn *conn, const char *database,
+				 const struct _param * param)
+{
+	ExecStatusType status;
+
 	if (param->verbose)
 	{
 		fprintf(stdout, "Connected to database \"%s\"\n", database);
@@ -245,56 +389,290 @@ pgimportdoc(const char *database, const struct _param * param)
 					param->progname, PQresStatus(status));
 			fprintf(stderr, "%s: Error: %s\n",
 					param->progname, PQresultErrorMessage(setencresult));
+			PQclear(setencresult);
+			termPQExpBuffer(&setencoding);
 			PQfinish(conn);
-			return -1;
+			return NULL;
 		}
 
 		PQclear(setencresult);
 		termPQExpBuffer(&setencoding);
 	}
 
-	if (param->use_stdin)
+	return conn;
+}
+
+/*
+ * Connect to target database and set client encoding. Returns NULL
+ * when connection is not possible. It can be called from more threads
+ * at the same time, the password is prompted only once. With option
+ * --prefer-socket and the host is local machine, then the Unix socket is
+ * used instead TCP (when the server allows it). The socket in default
+ * directory can belong to other server than the one listening on the
+ * host, so it is not used without the option.
+ */
+static PGconn *
+connect_host(const char *database, const struct _param * param,
+			 bool prefer_socket)
+{
+	PGconn	   *conn;
+	bool		retry;
+	bool		try_socket = false;
+	char	   *password = NULL;
+
+	pthread_mutex_lock(&connect_mutex);
+
+	if (prefer_socket && !param->prefer_socket)
+		prefer_socket = false;
+
+	if (prefer_socket && use_local_socket == -1)
 	{
-		input = stdin;
+		use_local_socket = DEFAULT_PGSOCKET_DIR[0] != '\0' &&
+			host_is_local(param->pg_host);
+
+		if (use_local_socket && param->verbose)
+			fprintf(stdout, "Host \"%s\" is local, Unix socket is preferred\n",
+					param->pg_host);
 	}
-	else
+
+	if (prefer_socket)
+		try_socket = use_local_socket == 1;
+
+	/* Note: password can be carried over from a previous call */
+	if (param->pg_prompt == TRI_YES && !saved_password)
+		saved_password = prompt_password();
+
+	if (saved_password)
+		password = pg_strdup(saved_password);
+
+	pthread_mutex_unlock(&connect_mutex);
+
+	/*
+	 * Start the connection.  Loop until we have a password if requested by
+	 * backend.
+	 */
+	do
 	{
-		struct stat		fst;
+		const char *keywords[PARAMS_ARRAY_SIZE];
+		const char *values[PARAMS_ARRAY_SIZE];
 
-		canonicalize_path(param->filename);
+		connect_params(keywords, values, database, param, password, try_socket);
 
-		input = fopen(param->filename,"rb");
-		if (NULL == input)
+		retry = false;
+
+		conn = PQconnectdbParams(keywords, values, true);
+		if (!conn)
 		{
-			fprintf(stderr, "%s: Unable to open '%s': %s\n",
-				param->progname, param->filename, strerror(errno));
-			PQfinish(conn);
-			return -1;
+			fprintf(stderr, "Connection to database \"%s\" failed\n",
+					database);
+			if (password)
+				free(password);
+			return NULL;
 		}
 
-		if (fstat(fileno(input), &fst) != -1)
+		if (PQstatus(conn) == CONNECTION_BAD &&
+			PQconnectionNeedsPassword(conn) &&
+			!password &&
+			param->pg_prompt != TRI_NO)
 		{
-			if (S_ISREG(fst.st_mode) && fst.st_size > ((int64) 1024) * 1024 * 1024)
-			{
-				fprintf(stderr, "%s: '%s' is too big (greather than 1GB)\n",
-					param->progname, param->filename);
-				PQfinish(conn);
-				return -1;
-			}
+			PQfinish(conn);
+
+			pthread_mutex_lock(&connect_mutex);
+
+			/* other connection could get the password already */
+			if (!saved_password)
+				saved_password = prompt_password();
+			password = pg_strdup(saved_password);
+
+			pthread_mutex_unlock(&connect_mutex);
+
+			retry = true;
 		}
-		else
+		else if (PQstatus(conn) == CONNECTION_BAD && try_socket)
 		{
-			fprintf(stderr, "%s: %s\n",
-				param->progname, strerror(errno));
+			/* the server doesn't accept this connection by socket, use TCP */
 			PQfinish(conn);
+
+			pthread_mutex_lock(&connect_mutex);
+			use_local_socket = 0;
+			pthread_mutex_unlock(&connect_mutex);
+
+			if (param->verbose)
+				fprintf(stdout, "Connection by Unix socket failed, host \"%s\" is used\n",
+						param->pg_host);
+
+			try_socket = false;
+			retry = true;
+		}
+	} while (retry);
+
+	if (password)
+		free(password);
+
+	/* check to see that the backend connection was successfully made */
+	if (PQstatus(conn) == CONNECTION_BAD)
+	{
+		fprintf(stderr, "Connection to database \"%s\" failed:\n%s",
+				database, PQerrorMessage(conn));
+		PQfinish(conn);
+		return NULL;
+	}
+
+	return setup_connection(conn, database, param);
+}
+
+PGconn *
+connect_database(const char *database, const struct _param * param)
+{
+	PGconn	   *conn = connect_host(database, param, true);
+
+	/* wait events of backend can be sampled */
+	if (conn)
+		sampler_register(conn);
+
+	return conn;
+}
+
+/*
+ * Connect to read host (usually hot standby) with same user and password.
+ * The Unix socket is not used, it is for the primary host.
+ */
+PGconn *
+connect_read_database(const char *database, const struct _param * param)
+{
+	struct _param rparam = *param;
+
+	rparam.pg_host = param->read_host;
+
+	return connect_host(database, &rparam, false);
+}
+
+/*
+ * Start nonblocking connection. It should be used after connect_database,
+ * that prompts password (when it is necessary) and decides about usage
+ * of Unix socket. Returns false when the connection cannot be started.
+ */
+bool
+connect_database_start(AsyncConnection *ac, const char *database,
+					   const struct _param * param)
+{
+	const char *keywords[PARAMS_ARRAY_SIZE];
+	const char *values[PARAMS_ARRAY_SIZE];
+
+	pthread_mutex_lock(&connect_mutex);
+
+	ac->try_socket = use_local_socket == 1;
+	connect_params(keywords, values, database, param, saved_password,
+				   ac->try_socket);
+
+	ac->conn = PQconnectStartParams(keywords, values, true);
+
+	pthread_mutex_unlock(&connect_mutex);
+
+	/* the socket should be writable first */
+	ac->status = PGRES_POLLING_WRITING;
+
+	if (!ac->conn || PQstatus(ac->conn) == CONNECTION_BAD)
+	{
+		fprintf(stderr, "Connection to database \"%s\" failed:\n%s",
+				database, ac->conn ? PQerrorMessage(ac->conn) : "\n");
+		PQfinish(ac->conn);
+		ac->conn = NULL;
+		return false;
+	}
+
+	return true;
+}
+
+/*
+ * Continue in nonblocking connection, when its socket is ready for
+ * ac->status. Returns 1 when connection is established (and encoding is
+ * set), 0 when it is in progress, -1 on failure.
+ */
+int
+connect_database_poll(AsyncConnection *ac, const char *database,
+					  const struct _param * param)
+{
+	ac->status = PQconnectPoll(ac->conn);
+
+	if (ac->status == PGRES_POLLING_OK)
+	{
+		ac->conn = setup_connection(ac->conn, database, param);
+		if (!ac->conn)
 			return -1;
+
+		sampler_register(ac->conn);
+		return 1;
+	}
+	else if (ac->status == PGRES_POLLING_FAILED)
+	{
+		if (ac->try_socket)
+		{
+			PQfinish(ac->conn);
+			ac->conn = NULL;
+
+			pthread_mutex_lock(&connect_mutex);
+			use_local_socket = 0;
+			pthread_mutex_unlock(&connect_mutex);
+
+			return connect_database_start(ac, database, param) ? 0 : -1;
 		}
+
+		fprintf(stderr, "Connection to database \"%s\" failed:\n%s",
+				database, PQerrorMessage(ac->conn));
+		PQfinish(ac->conn);
+		ac->conn = NULL;
+
+		return -1;
 	}
 
+	return 0;
+}
+
+/*
+ * Import whole input as one document by INSERT (UPDATE) command
+ */
+static int
+import_document(PGconn *conn, FILE *input, const struct _param * param)
+{
+	char		buffer[BUFSIZE];
+	size_t		size;
+	PQExpBufferData data;
+	PQExpBufferData value;
+	char	   *base_id = NULL;
+	PGresult	*result = NULL;
+	Oid			ptypes[10];
+	int			pformats[10];
+	const char * pvalues[10];
+	int			plengths[10];
+	ExecStatusType status;
+	DecodeState dstate;
+
 	initPQExpBuffer(&data);
 
+	decode_init(&dstate, param->input_encoding);
+
 	while ((size = fread(buffer, 1, sizeof(buffer), input)) > 0)
-		appendBinaryPQExpBuffer(&data, buffer, size);
+	{
+		if (param->input_encoding != INPUT_ENCODING_NONE)
+		{
+			char		decbuf[BUFSIZE];
+			ssize_t		declen;
+
+			declen = decode_chunk(&dstate, decbuf, buffer, size);
+			if (declen < 0)
+			{
+				fprintf(stderr, "%s: invalid %s input data\n",
+						param->progname,
+						param->input_encoding == INPUT_ENCODING_BASE64 ? "base64" : "hex");
+				return -1;
+			}
+
+			appendBinaryPQExpBuffer(&data, decbuf, declen);
+		}
+		else
+			appendBinaryPQExpBuffer(&data, buffer, size);
+	}
 
 	if (ferror(input))
 	{
@@ -302,25 +680,81 @@ pgimportdoc(const char *database, const struct _param * param)
 				param->progname,
 				param->filename ? param->filename : "stdin",
 				strerror(errno));
-		PQfinish(conn);
 		return -1;
 	}
 	else if (PQExpBufferDataBroken(data))
 	{
 		fprintf(stderr, "%s: Out of memory\n",
 				param->progname);
-		PQfinish(conn);
 		return -1;
 	}
-
-	fclose(input);
+	else if (!decode_finish(&dstate))
+	{
+		fprintf(stderr, "%s: incomplete encoded input data\n",
+				param->progname);
+		return -1;
+	}
 
 	if (param->verbose)
 	{
 		fprintf(stdout, "Buffered data of size: %ld\n", data.len);
 	}
 
-	if (param->fmt == FORMAT_XML || param->fmt == FORMAT_BYTEA)
+	workload_record(data.len);
+
+	initPQExpBuffer(&value);
+
+	if (param->delta_cache &&
+		delta_prepare(data.data, data.len, &value, &base_id, param) != 0)
+	{
+		return -1;
+	}
+
+	if (param->delta_cache)
+	{
+		/* delta or full version, and id of base version */
+		ptypes[0] = BYTEAOID;
+		plengths[0] = value.len;
+		pformats[0] = 1;
+		pvalues[0] = value.data;
+
+		ptypes[1] = 0;
+		plengths[1] = 0;
+		pformats[1] = 0;
+		pvalues[1] = base_id;
+
+		result = PQexecParams(conn,
+								param->command,
+								2, ptypes, pvalues, plengths, pformats,
+								0);
+	}
+	else if (param->compress != COMPRESS_OFF)
+	{
+		const char *cdata = data.data;
+		size_t		clen = data.len;
+
+		/* compressed document, and name of codec */
+		pvalues[1] = compress_document(&value, &cdata, &clen, param);
+		if (!pvalues[1])
+		{
+			return -1;
+		}
+
+		ptypes[0] = BYTEAOID;
+		plengths[0] = clen;
+		pformats[0] = 1;
+		pvalues[0] = cdata;
+
+		ptypes[1] = 0;
+		plengths[1] = 0;
+		pformats[1] = 0;
+
+		result = PQexecParams(conn,
+								param->command,
+								2, ptypes, pvalues, plengths, pformats,
+								0);
+	}
+	else if (param->fmt == FORMAT_XML || param->fmt == FORMAT_BYTEA)
 	{
 		ptypes[0] = param->fmt == FORMAT_XML ? XMLOID : BYTEAOID;
 		plengths[0] = data.len;
@@ -355,7 +789,6 @@ pgimportdoc(const char *database, const struct _param * param)
 				param->progname, PQresStatus(status));
 		fprintf(stderr, "%s: Error: %s\n",
 				param->progname, PQresultErrorMessage(result));
-		PQfinish(conn);
 		return -1;
 	}
 
@@ -373,12 +806,176 @@ pgimportdoc(const char *database, const struct _param * param)
 		}
 	}
 
-	PQclear(result);
+	/* returned id is base for next version */
+	if (param->delta_cache)
+	{
+		int			rc;
+
+		if (status != PGRES_TUPLES_OK || PQntuples(result) < 1 ||
+			PQgetisnull(result, 0, 0))
+		{
+			fprintf(stderr, "%s: command should return id of imported version (use RETURNING)\n",
+					param->progname);
+			rc = -1;
+		}
+		else
+			rc = delta_store(data.data, data.len, PQgetvalue(result, 0, 0),
+							 base_id != NULL, param);
+
+		if (rc != 0)
+		{
+			PQclear(result);
+			return -1;
+		}
+	}
+
+	PQclear(result);
+
+	if (base_id)
+		pg_free(base_id);
+	termPQExpBuffer(&value);
+	termPQExpBuffer(&data);
+
+	return 0;
+}
+
+/*
+ * This imports stdin to target database
+ */
+static int
+pgimportdoc(const char *database, const struct _param * param)
+{
+	PGconn	   *conn;
+	FILE	   *input;
+	int			rc;
+
+	/* FIFO inputs are imported by more connections */
+	if (param->nfifos > 0 || param->fd_socket)
+	{
+		if (param->attach == NULL)
+			return import_fifos(database, param);
+
+		/* the partition is created and attached by own connection */
+		conn = connect_database(database, param);
+		if (!conn)
+			return -1;
+
+		rc = bulk_begin(conn, param);
+		if (rc == 0)
+			rc = bulk_end(conn, param, import_fifos(database, param));
+
+		PQfinish(conn);
+
+		return rc;
+	}
+
+	conn = connect_database(database, param);
+	if (!conn)
+		return -1;
+
+	/* every exit after this point should call bulk_end */
+	if (bulk_begin(conn, param) != 0)
+	{
+		PQfinish(conn);
+		return -1;
+	}
+
+	if (param->split == SPLIT_MAILDIR)
+	{
+		canonicalize_path(param->filename);
+
+		rc = import_maildir(conn, param);
+		rc = bulk_end(conn, param, rc);
+		PQfinish(conn);
+
+		return rc;
+	}
+
+	if (param->split == SPLIT_SQLITE)
+	{
+		canonicalize_path(param->filename);
+
+		rc = import_sqlite(conn, param);
+		rc = bulk_end(conn, param, rc);
+		PQfinish(conn);
+
+		return rc;
+	}
+
+	if (param->use_stdin)
+	{
+		input = stdin;
+	}
+	else
+	{
+		struct stat		fst;
+
+		canonicalize_path(param->filename);
+
+		input = fopen(param->filename,"rb");
+		if (NULL == input)
+		{
+			fprintf(stderr, "%s: Unable to open '%s': %s\n",
+				param->progname, param->filename, strerror(errno));
+			rc = bulk_end(conn, param, -1);
+			PQfinish(conn);
+			return rc;
+		}
+
+		if (fstat(fileno(input), &fst) != -1)
+		{
+			/* mail archive is not imported as one document */
+			if (param->split == SPLIT_NONE &&
+				S_ISREG(fst.st_mode) && fst.st_size > ((int64) 1024) * 1024 * 1024)
+			{
+				fprintf(stderr, "%s: '%s' is too big (greather than 1GB)\n",
+					param->progname, param->filename);
+				rc = bulk_end(conn, param, -1);
+				fclose(input);
+				PQfinish(conn);
+				return rc;
+			}
+		}
+		else
+		{
+			fprintf(stderr, "%s: %s\n",
+				param->progname, strerror(errno));
+			rc = bulk_end(conn, param, -1);
+			fclose(input);
+			PQfinish(conn);
+			return rc;
+		}
+	}
+
+	if (param->split == SPLIT_MBOX)
+	{
+		rc = import_mbox(conn, input, param);
+		rc = bulk_end(conn, param, rc);
+
+		fclose(input);
+		PQfinish(conn);
+
+		return rc;
+	}
+
+	if (is_copy_command(param->command))
+	{
+		rc = import_copy(conn, input, param);
+		rc = bulk_end(conn, param, rc);
+
+		fclose(input);
+		PQfinish(conn);
+
+		return rc;
+	}
+
+	rc = import_document(conn, input, param);
+	rc = bulk_end(conn, param, rc);
 
-	termPQExpBuffer(&data);
+	fclose(input);
 	PQfinish(conn);
 
-	return 0;
+	return rc;
 }
 
 static void
@@ -391,12 +988,101 @@ usage(const char *progname)
 	printf("  -?, --help     show this help, then exit\n");
 	printf("  -E ENCODING    import text data in encoding ENCODING\n");
 	printf("  -v             write a lot of progress messages\n");
-	printf("  -c COMMAND     INSERT, UPDATE command with parameter\n");
+	printf("  -c COMMAND     INSERT, UPDATE command with parameter or COPY FROM STDIN\n");
 	printf("  -f NAME        file NAME of imported document, default is stdin\n");
 	printf("  -t TYPE        type specification [ XML | TEXT | BYTEA ], default is TEXT\n");
+	printf("  --input-encoding=ENCODING\n"
+		   "                 decode BYTEA input data [ base64 | hex ]\n");
+	printf("  --split=MODE   import every mail of archive [ mbox | maildir ], or every\n"
+		   "                 row of SQLite database [ sqlite ] as one document\n");
+	printf("  --header=NAME  pass value of mail header NAME as next parameter\n");
+	printf("  --sqlite-query=QUERY\n"
+		   "                 query returning document in first column, values of other\n"
+		   "                 columns are passed as next parameters\n");
+	printf("  --sqlite-blob=TABLE.COLUMN\n"
+		   "                 read document from blob COLUMN of row of TABLE with rowid\n"
+		   "                 returned in first column of query (incremental blob I/O)\n");
+	printf("  --fifo=NAME    read documents from FIFO NAME (can be used more times),\n"
+		   "                 compressed file (zstd, gzip) is decompressed in parallel\n");
+	printf("  --fd-socket=PATH\n"
+		   "                 receive documents as file descriptors passed by Unix\n"
+		   "                 socket PATH, runs until SIGINT or SIGTERM\n");
+	printf("  --framing=TYPE separation of documents in FIFO [ newline | nul | length ],\n"
+		   "                 default is newline\n");
+	printf("  -j, --jobs=NUM use NUM connections for import from FIFOs\n");
+	printf("  --decompress-jobs=NUM\n"
+		   "                 use NUM threads for decompression of one input,\n"
+		   "                 default is number of jobs\n");
+	printf("  --max-delay=MS import not full batch from FIFO after MS milliseconds,\n"
+		   "                 default is %d\n", DEFAULT_MAX_DELAY);
+	printf("  --record=FILE  store workload profile (without content of documents)\n");
+	printf("  --replay=FILE  import synthetic documents by workload profile\n");
+	printf("  --delta-cache=DIR\n"
+		   "                 import delta against previous version of document stored\n"
+		   "                 in DIR, id of previous version is passed as $2\n");
+	printf("  --delta-key=NAME\n"
+		   "                 name of document in delta cache, default is name of file\n");
+	printf("  --keyframe-interval=N\n"
+		   "                 import full version after N - 1 deltas, default is %d\n",
+		   DEFAULT_KEYFRAME_INTERVAL);
+	printf("  --compress=CODEC\n"
+		   "                 compress BYTEA documents [ auto | lz4 | zstd[:LEVEL] ],\n"
+		   "                 name of used codec is passed as last parameter\n");
+	printf("  --compress-target=MBPS\n"
+		   "                 minimal speed of codec selected by auto compression,\n"
+		   "                 default is %d MB/s\n", DEFAULT_COMPRESS_TARGET);
+	printf("  --freeze       import by COPY FREEZE in one transaction, the table is\n"
+		   "                 truncated or created at start of transaction\n");
+	printf("  --truncate=TABLE\n"
+		   "                 truncate TABLE before import in freeze mode\n");
+	printf("  --create-sql=COMMAND\n"
+		   "                 create table by COMMAND before import in freeze mode\n");
+	printf("  --attach=PARENT\n"
+		   "                 load new table, and attach it as partition of PARENT\n");
+	printf("  --partition=TABLE\n"
+		   "                 name of new table in attach mode\n");
+	printf("  --partition-from=VALUE, --partition-to=VALUE\n"
+		   "                 range bound of new partition\n");
+	printf("  --sequence=NAME\n"
+		   "                 pass id reserved from sequence NAME as $2 (or second\n"
+		   "                 column of COPY), ids are reserved by batches\n");
+	printf("  --direct-copy  write COPY data of one document directly to socket\n"
+		   "                 (not for SSL connections)\n");
+	printf("  --skip-existing=QUERY\n"
+		   "                 skip document, when QUERY with same parameters like\n"
+		   "                 command returns some row\n");
+	printf("  --canonical-hash=FORM\n"
+		   "                 pass hash of canonical form [ xml | json ] of document\n"
+		   "                 after values of headers, it is used by --skip-existing\n"
+		   "                 instead of document\n");
+	printf("  --schema=FILE  validate documents against XML Schema or JSON Schema\n"
+		   "                 in FILE before import\n");
+	printf("  --reject-dir=DIR\n"
+		   "                 write invalid documents to DIR, and continue\n");
+	printf("  --large-objects\n"
+		   "                 store documents as large objects created by batches,\n"
+		   "                 OID of large object is passed as $1\n");
+	printf("  --max-replay-wait=MS\n"
+		   "                 max wait for replay of recent writes on read host,\n"
+		   "                 default is %d\n", DEFAULT_MAX_REPLAY_WAIT);
+	printf("  --batch-size=N number of documents imported in one transaction\n"
+		   "                 or by one COPY command, default is %d\n", DEFAULT_BATCH_SIZE);
+	printf("  --server-profile\n"
+		   "                 report statistics of statements executed during import\n"
+		   "                 (from pg_stat_statements)\n");
+	printf("  --sample-waits=MS\n"
+		   "                 sample wait events of import connections every MS\n"
+		   "                 milliseconds, and report histogram\n");
+	printf("  --simd=LEVEL   force implementation of encoding kernels [ auto | scalar |\n"
+		   "                 sse2 | sse42 | avx2 | avx512 | neon ], default is auto\n");
 	printf("\nConnection options:\n");
 	printf("  -h HOSTNAME    database server host or socket directory\n");
 	printf("  -p PORT        database server port\n");
+	printf("  --prefer-socket\n"
+		   "                 use Unix socket in default directory when HOSTNAME is\n"
+		   "                 local machine\n");
+	printf("  --read-host=HOSTNAME\n"
+		   "                 server (hot standby) used for lookups\n");
 	printf("  -U USERNAME    user name to connect as\n");
 	printf("  -w             never prompt for password\n");
 	printf("  -W             force password prompt\n");
@@ -412,6 +1098,51 @@ main(int argc, char **argv)
 	int			c;
 	int			port;
 	const char *progname;
+	int			optindex;
+	bool		streaming;
+
+	static struct option long_options[] = {
+		{"input-encoding", required_argument, NULL, 1},
+		{"split", required_argument, NULL, 2},
+		{"header", required_argument, NULL, 3},
+		{"batch-size", required_argument, NULL, 4},
+		{"fifo", required_argument, NULL, 5},
+		{"framing", required_argument, NULL, 6},
+		{"jobs", required_argument, NULL, 'j'},
+		{"record", required_argument, NULL, 7},
+		{"replay", required_argument, NULL, 8},
+		{"simd", required_argument, NULL, 9},
+		{"max-delay", required_argument, NULL, 10},
+		{"delta-cache", required_argument, NULL, 11},
+		{"delta-key", required_argument, NULL, 12},
+		{"keyframe-interval", required_argument, NULL, 13},
+		{"compress", required_argument, NULL, 14},
+		{"compress-target", required_argument, NULL, 15},
+		{"freeze", no_argument, NULL, 16},
+		{"truncate", required_argument, NULL, 17},
+		{"create-sql", required_argument, NULL, 18},
+		{"attach", required_argument, NULL, 19},
+		{"partition", required_argument, NULL, 20},
+		{"partition-from", required_argument, NULL, 21},
+		{"partition-to", required_argument, NULL, 22},
+		{"sequence", required_argument, NULL, 23},
+		{"direct-copy", no_argument, NULL, 24},
+		{"read-host", required_argument, NULL, 25},
+		{"skip-existing", required_argument, NULL, 26},
+		{"max-replay-wait", required_argument, NULL, 27},
+		{"fd-socket", required_argument, NULL, 28},
+		{"server-profile", no_argument, NULL, 29},
+		{"sample-waits", required_argument, NULL, 30},
+		{"canonical-hash", required_argument, NULL, 31},
+		{"schema", required_argument, NULL, 32},
+		{"reject-dir", required_argument, NULL, 33},
+		{"decompress-jobs", required_argument, NULL, 34},
+		{"large-objects", no_argument, NULL, 35},
+		{"sqlite-query", required_argument, NULL, 36},
+		{"sqlite-blob", required_argument, NULL, 37},
+		{"prefer-socket", no_argument, NULL, 38},
+		{NULL, 0, NULL, 0}
+	};
 
 	progname = get_progname(argv[0]);
 
@@ -421,12 +1152,56 @@ main(int argc, char **argv)
 	param.pg_prompt = TRI_DEFAULT;
 	param.fmt = FORMAT_TEXT;
 	param.pg_host = NULL;
+	param.prefer_socket = false;
 	param.pg_port = NULL;
 	param.progname = progname;
 	param.use_stdin = true;
 	param.filename = NULL;
 	param.command = NULL;
 	param.encoding = NULL;
+	param.input_encoding = INPUT_ENCODING_NONE;
+	param.split = SPLIT_NONE;
+	param.batch_size = DEFAULT_BATCH_SIZE;
+	param.headers = NULL;
+	param.nheaders = 0;
+	param.fifos = NULL;
+	param.nfifos = 0;
+	param.framing = FRAMING_NEWLINE;
+	param.jobs = 1;
+	param.max_delay = DEFAULT_MAX_DELAY;
+	param.delta_cache = NULL;
+	param.delta_key = NULL;
+	param.keyframe_interval = DEFAULT_KEYFRAME_INTERVAL;
+	param.compress = COMPRESS_OFF;
+	param.compress_level = 3;
+	param.compress_target = DEFAULT_COMPRESS_TARGET;
+	param.freeze = false;
+	param.truncate = NULL;
+	param.create_sql = NULL;
+	param.attach = NULL;
+	param.partition = NULL;
+	param.partition_from = NULL;
+	param.partition_to = NULL;
+	param.sequence = NULL;
+	param.direct_copy = false;
+	param.read_host = NULL;
+	param.skip_existing = NULL;
+	param.max_replay_wait = DEFAULT_MAX_REPLAY_WAIT;
+	param.fd_socket = NULL;
+	param.server_profile = false;
+	param.sample_interval = 0;
+	param.canonical_hash = CANONICAL_NONE;
+	param.schema = NULL;
+	param.reject_dir = NULL;
+	param.decompress_jobs = 0;
+	param.large_objects = false;
+	param.sqlite_query = NULL;
+	param.sqlite_blob = NULL;
+	param.record = NULL;
+	param.replay = NULL;
+
+	/* use the fastest kernels supported by this CPU */
+	encode_select_kernels(NULL);
 
 	/* Process command-line arguments */
 	if (argc > 1)
@@ -445,7 +1220,8 @@ main(int argc, char **argv)
 
 	while (1)
 	{
-		c = getopt(argc, argv, "E:h:f:U:p:c:t:vwW");
+		c = getopt_long(argc, argv, "E:h:f:j:U:p:c:t:vwW",
+						long_options, &optindex);
 		if (c == -1)
 			break;
 
@@ -508,10 +1284,290 @@ main(int argc, char **argv)
 			case 'h':
 				param.pg_host = pg_strdup(optarg);
 				break;
+			case 1:
+				if (pg_strcasecmp(optarg, "base64") == 0)
+					param.input_encoding = INPUT_ENCODING_BASE64;
+				else if (pg_strcasecmp(optarg, "hex") == 0)
+					param.input_encoding = INPUT_ENCODING_HEX;
+				else
+				{
+					fprintf(stderr,
+							"%s: only base64 or hex input encodings are supported\n",
+							progname);
+					exit(1);
+				}
+				break;
+			case 2:
+				if (strcmp(optarg, "mbox") == 0)
+					param.split = SPLIT_MBOX;
+				else if (strcmp(optarg, "maildir") == 0)
+					param.split = SPLIT_MAILDIR;
+				else if (strcmp(optarg, "sqlite") == 0)
+				{
+#ifdef USE_SQLITE
+					param.split = SPLIT_SQLITE;
+#else
+					fprintf(stderr,
+							"%s: split mode \"sqlite\" is not supported by this build\n",
+							progname);
+					exit(1);
+#endif
+				}
+				else
+				{
+					fprintf(stderr,
+							"%s: only mbox, maildir or sqlite split modes are supported\n",
+							progname);
+					exit(1);
+				}
+				break;
+			case 3:
+				if (param.nheaders >= MAX_HEADERS)
+				{
+					fprintf(stderr, "%s: too much headers (maximum is %d)\n",
+							progname, MAX_HEADERS);
+					exit(1);
+				}
+				if (!param.headers)
+					param.headers = pg_malloc(MAX_HEADERS * sizeof(char *));
+				param.headers[param.nheaders++] = pg_strdup(optarg);
+				break;
+			case 4:
+				param.batch_size = strtol(optarg, NULL, 10);
+				if (param.batch_size < 1)
+				{
+					fprintf(stderr, "%s: invalid batch size: %s\n", progname, optarg);
+					exit(1);
+				}
+				break;
+			case 5:
+				if (param.nfifos >= MAX_FIFOS)
+				{
+					fprintf(stderr, "%s: too much FIFO inputs (maximum is %d)\n",
+							progname, MAX_FIFOS);
+					exit(1);
+				}
+				if (!param.fifos)
+					param.fifos = pg_malloc(MAX_FIFOS * sizeof(char *));
+				param.fifos[param.nfifos++] = pg_strdup(optarg);
+				break;
+			case 6:
+				if (strcmp(optarg, "newline") == 0)
+					param.framing = FRAMING_NEWLINE;
+				else if (strcmp(optarg, "nul") == 0)
+					param.framing = FRAMING_NUL;
+				else if (strcmp(optarg, "length") == 0)
+					param.framing = FRAMING_LENGTH;
+				else
+				{
+					fprintf(stderr,
+							"%s: only newline, nul or length framing is supported\n",
+							progname);
+					exit(1);
+				}
+				break;
+			case 7:
+				param.record = pg_strdup(optarg);
+				break;
+			case 8:
+				param.replay = pg_strdup(optarg);
+				break;
+			case 9:
+				if (!encode_select_kernels(optarg))
+				{
+					fprintf(stderr, "%s: SIMD level \"%s\" is unknown or not supported by this CPU\n",
+							progname, optarg);
+					exit(1);
+				}
+				break;
+			case 10:
+				param.max_delay = strtol(optarg, NULL, 10);
+				if (param.max_delay < 0)
+				{
+					fprintf(stderr, "%s: invalid max delay: %s\n", progname, optarg);
+					exit(1);
+				}
+				break;
+			case 11:
+				param.delta_cache = pg_strdup(optarg);
+				canonicalize_path(param.delta_cache);
+				break;
+			case 12:
+				param.delta_key = pg_strdup(optarg);
+				break;
+			case 13:
+				param.keyframe_interval = strtol(optarg, NULL, 10);
+				if (param.keyframe_interval < 1)
+				{
+					fprintf(stderr, "%s: invalid keyframe interval: %s\n", progname, optarg);
+					exit(1);
+				}
+				break;
+			case 14:
+				if (pg_strcasecmp(optarg, "auto") == 0)
+					param.compress = COMPRESS_AUTO;
+				else if (pg_strcasecmp(optarg, "lz4") == 0)
+					param.compress = COMPRESS_LZ4;
+				else if (pg_strncasecmp(optarg, "zstd", 4) == 0 &&
+						 (optarg[4] == '\0' || optarg[4] == ':'))
+				{
+					param.compress = COMPRESS_ZSTD;
+					if (optarg[4] == ':')
+					{
+						char	   *endptr;
+
+						errno = 0;
+						param.compress_level = strtol(optarg + 5, &endptr, 10);
+						if (errno != 0 || endptr == optarg + 5 || *endptr != '\0')
+						{
+							fprintf(stderr, "%s: invalid compression level: %s\n",
+									progname, optarg);
+							exit(1);
+						}
+					}
+				}
+				else
+				{
+					fprintf(stderr, "%s: invalid compression: %s\n", progname, optarg);
+					exit(1);
+				}
+
+				if (!compress_supported(param.compress))
+				{
+					fprintf(stderr, "%s: compression \"%s\" is not supported by this build\n",
+							progname, optarg);
+					exit(1);
+				}
+
+				if (param.compress == COMPRESS_ZSTD &&
+					!compress_zstd_level_valid(param.compress_level))
+				{
+					fprintf(stderr, "%s: compression level %d is out of range of zstd\n",
+							progname, param.compress_level);
+					exit(1);
+				}
+				break;
+			case 15:
+				param.compress_target = atof(optarg);
+				if (param.compress_target <= 0)
+				{
+					fprintf(stderr, "%s: invalid compression target: %s\n", progname, optarg);
+					exit(1);
+				}
+				break;
+			case 16:
+				param.freeze = true;
+				break;
+			case 17:
+				param.truncate = pg_strdup(optarg);
+				break;
+			case 18:
+				param.create_sql = pg_strdup(optarg);
+				break;
+			case 19:
+				param.attach = pg_strdup(optarg);
+				break;
+			case 20:
+				param.partition = pg_strdup(optarg);
+				break;
+			case 21:
+				param.partition_from = pg_strdup(optarg);
+				break;
+			case 22:
+				param.partition_to = pg_strdup(optarg);
+				break;
+			case 23:
+				param.sequence = pg_strdup(optarg);
+				break;
+			case 24:
+				param.direct_copy = true;
+				break;
+			case 25:
+				param.read_host = pg_strdup(optarg);
+				break;
+			case 26:
+				param.skip_existing = pg_strdup(optarg);
+				break;
+			case 27:
+				param.max_replay_wait = strtol(optarg, NULL, 10);
+				if (param.max_replay_wait < 0)
+				{
+					fprintf(stderr, "%s: invalid max replay wait: %s\n", progname, optarg);
+					exit(1);
+				}
+				break;
+			case 28:
+				param.fd_socket = pg_strdup(optarg);
+				break;
+			case 29:
+				param.server_profile = true;
+				break;
+			case 30:
+				param.sample_interval = strtol(optarg, NULL, 10);
+				if (param.sample_interval <= 0)
+				{
+					fprintf(stderr, "%s: invalid sampling interval: %s\n", progname, optarg);
+					exit(1);
+				}
+				break;
+			case 31:
+				if (pg_strcasecmp(optarg, "xml") == 0)
+					param.canonical_hash = CANONICAL_XML;
+				else if (pg_strcasecmp(optarg, "json") == 0)
+					param.canonical_hash = CANONICAL_JSON;
+				else
+				{
+					fprintf(stderr, "%s: invalid canonical form: %s\n", progname, optarg);
+					exit(1);
+				}
+				break;
+			case 32:
+				param.schema = pg_strdup(optarg);
+				break;
+			case 33:
+				param.reject_dir = pg_strdup(optarg);
+				break;
+			case 34:
+				param.decompress_jobs = strtol(optarg, NULL, 10);
+				if (param.decompress_jobs <= 0)
+				{
+					fprintf(stderr, "%s: invalid number of decompression jobs: %s\n", progname, optarg);
+					exit(1);
+				}
+				break;
+			case 35:
+				param.large_objects = true;
+				break;
+			case 36:
+				param.sqlite_query = pg_strdup(optarg);
+				break;
+			case 37:
+				if (strchr(optarg, '.') == NULL)
+				{
+					fprintf(stderr, "%s: blob should be specified as TABLE.COLUMN: %s\n", progname, optarg);
+					exit(1);
+				}
+				param.sqlite_blob = pg_strdup(optarg);
+				break;
+			case 38:
+				param.prefer_socket = true;
+				break;
+			case 'j':
+				param.jobs = strtol(optarg, NULL, 10);
+				if (param.jobs < 1 || param.jobs > 1024)
+				{
+					fprintf(stderr, "%s: invalid number of jobs: %s\n", progname, optarg);
+					exit(1);
+				}
+				break;
 		}
 	}
 
-	if (param.command == NULL)
+	/* documents are read from FIFOs or passed by socket */
+	streaming = param.nfifos > 0 || param.fd_socket != NULL;
+
+	/* replay can use command stored in workload profile */
+	if (param.command == NULL && param.replay == NULL)
 	{
 		fprintf(stderr, "pgimportdoc: missing required argument: -c COMMAND\n");
 		fprintf(stderr, _("Try \"%s --help\" for more information.\n"), progname);
@@ -531,6 +1587,254 @@ main(int argc, char **argv)
 		fprintf(stderr, "pgimportdoc: warning: encoding is used only for type TEXT\n");
 	}
 
+	if (param.input_encoding != INPUT_ENCODING_NONE && param.fmt != FORMAT_BYTEA)
+	{
+		fprintf(stderr, "pgimportdoc: input encoding can be used only for type BYTEA\n");
+		exit(1);
+	}
+
+	if (param.split != SPLIT_NONE && param.input_encoding != INPUT_ENCODING_NONE)
+	{
+		fprintf(stderr, "pgimportdoc: input encoding cannot be used with split mode\n");
+		exit(1);
+	}
+
+	if (param.split == SPLIT_MAILDIR && param.use_stdin)
+	{
+		fprintf(stderr, "pgimportdoc: maildir directory should be specified by -f NAME\n");
+		exit(1);
+	}
+
+	if (param.split == SPLIT_SQLITE && param.use_stdin)
+	{
+		fprintf(stderr, "pgimportdoc: SQLite database should be specified by -f NAME\n");
+		exit(1);
+	}
+
+	if ((param.split == SPLIT_SQLITE) != (param.sqlite_query != NULL))
+	{
+		fprintf(stderr, "pgimportdoc: sqlite split mode requires --sqlite-query, and the query can be used only in sqlite split mode\n");
+		exit(1);
+	}
+
+	if (param.sqlite_blob != NULL && param.split != SPLIT_SQLITE)
+	{
+		fprintf(stderr, "pgimportdoc: blob can be read only in sqlite split mode\n");
+		exit(1);
+	}
+
+	if (param.split == SPLIT_SQLITE && param.record != NULL)
+	{
+		fprintf(stderr, "pgimportdoc: workload profile cannot be recorded in sqlite split mode\n");
+		exit(1);
+	}
+
+	if (streaming &&
+		(param.split != SPLIT_NONE || !param.use_stdin ||
+		 param.input_encoding != INPUT_ENCODING_NONE))
+	{
+		fprintf(stderr, "pgimportdoc: FIFO inputs cannot be used with -f, split mode or input encoding\n");
+		exit(1);
+	}
+
+	if ((param.split == SPLIT_NONE || param.split == SPLIT_SQLITE) &&
+		param.nheaders > 0)
+	{
+		fprintf(stderr, "pgimportdoc: headers can be used only with mbox or maildir split mode\n");
+		exit(1);
+	}
+
+	if (param.replay != NULL &&
+		(param.record != NULL || streaming || param.split != SPLIT_NONE ||
+		 !param.use_stdin))
+	{
+		fprintf(stderr, "pgimportdoc: replay cannot be used with other inputs or with record\n");
+		exit(1);
+	}
+
+	if (param.compress != COMPRESS_OFF &&
+		(param.fmt != FORMAT_BYTEA || param.delta_cache != NULL ||
+		 (param.split == SPLIT_NONE && !streaming && param.replay == NULL &&
+		  is_copy_command(param.command))))
+	{
+		fprintf(stderr, "pgimportdoc: compression can be used only for BYTEA documents, not with delta cache or with COPY of one document\n");
+		exit(1);
+	}
+
+	if (param.delta_cache != NULL)
+	{
+		if (param.fmt != FORMAT_BYTEA || param.split != SPLIT_NONE ||
+			streaming || param.replay != NULL ||
+			is_copy_command(param.command))
+		{
+			fprintf(stderr, "pgimportdoc: delta cache can be used only for one BYTEA document imported by INSERT\n");
+			exit(1);
+		}
+
+		/* the name of file is default key */
+		if (param.delta_key == NULL && !param.use_stdin)
+		{
+			const char *sep = last_dir_separator(param.filename);
+
+			param.delta_key = pg_strdup(sep ? sep + 1 : param.filename);
+		}
+
+		if (param.delta_key == NULL || *param.delta_key == '\0' ||
+			first_dir_separator(param.delta_key) != NULL)
+		{
+			fprintf(stderr, "pgimportdoc: delta key should be specified by --delta-key NAME (without directory)\n");
+			exit(1);
+		}
+	}
+
+	if ((param.truncate != NULL || param.create_sql != NULL) && !param.freeze)
+	{
+		fprintf(stderr, "pgimportdoc: truncate or create command can be used only in freeze mode\n");
+		exit(1);
+	}
+
+	if (param.freeze)
+	{
+		/* COPY FREEZE requires table truncated or created in same transaction */
+		if (streaming || param.replay != NULL ||
+			!is_copy_command(param.command) ||
+			!command_has_word(param.command, "freeze"))
+		{
+			fprintf(stderr, "pgimportdoc: freeze mode requires COPY ... FREEZE command, and cannot be used with FIFO inputs or replay\n");
+			exit(1);
+		}
+
+		if ((param.truncate != NULL) + (param.create_sql != NULL) +
+			(param.attach != NULL) != 1)
+		{
+			fprintf(stderr, "pgimportdoc: freeze mode requires either --truncate TABLE, --create-sql COMMAND or --attach PARENT\n");
+			exit(1);
+		}
+	}
+
+	if ((param.attach != NULL || param.partition != NULL ||
+		 param.partition_from != NULL || param.partition_to != NULL) &&
+		(param.attach == NULL || param.partition == NULL ||
+		 param.partition_from == NULL || param.partition_to == NULL ||
+		 param.replay != NULL))
+	{
+		fprintf(stderr, "pgimportdoc: attach mode requires --attach, --partition, --partition-from and --partition-to, and cannot be used with replay\n");
+		exit(1);
+	}
+
+	if (param.sequence != NULL &&
+		param.split == SPLIT_NONE && !streaming && param.replay == NULL)
+	{
+		fprintf(stderr, "pgimportdoc: sequence can be used only when documents are imported by batches (split mode, FIFO inputs or replay)\n");
+		exit(1);
+	}
+
+	if (param.direct_copy &&
+		(param.replay != NULL || param.split != SPLIT_NONE || streaming ||
+		 !is_copy_command(param.command)))
+	{
+		fprintf(stderr, "pgimportdoc: direct copy can be used only for COPY of one document\n");
+		exit(1);
+	}
+
+	/*
+	 * In freeze mode the lookups (by other connection) would wait on lock
+	 * of truncated table, and don't see the rows of uncommitted batches.
+	 */
+	if (param.skip_existing != NULL &&
+		((param.split == SPLIT_NONE && !streaming && param.replay == NULL) ||
+		 param.freeze))
+	{
+		fprintf(stderr, "pgimportdoc: skip existing can be used only when documents are imported by batches (split mode, FIFO inputs or replay), and not in freeze mode\n");
+		exit(1);
+	}
+
+	if (param.canonical_hash != CANONICAL_NONE &&
+		param.split == SPLIT_NONE && !streaming && param.replay == NULL)
+	{
+		fprintf(stderr, "pgimportdoc: canonical hash can be used only when documents are imported by batches (split mode, FIFO inputs or replay)\n");
+		exit(1);
+	}
+
+	if (param.schema != NULL &&
+		((param.split == SPLIT_NONE && !streaming) || param.fmt == FORMAT_BYTEA))
+	{
+		fprintf(stderr, "pgimportdoc: schema can be used only for XML or text documents imported by batches (split mode or FIFO inputs)\n");
+		exit(1);
+	}
+
+	if (param.reject_dir != NULL && param.schema == NULL)
+	{
+		fprintf(stderr, "pgimportdoc: reject directory is used only for documents invalid against --schema\n");
+		exit(1);
+	}
+
+	if (param.large_objects &&
+		((param.split == SPLIT_NONE && !streaming && param.replay == NULL) ||
+		 param.freeze))
+	{
+		fprintf(stderr, "pgimportdoc: large objects can be used only when documents are imported by batches (split mode, FIFO inputs or replay), and not in freeze mode\n");
+		exit(1);
+	}
+
+	if (param.decompress_jobs > 0 && param.nfifos == 0)
+	{
+		fprintf(stderr, "pgimportdoc: decompression jobs can be used only with FIFO inputs\n");
+		exit(1);
+	}
+
+	if (param.read_host != NULL && param.skip_existing == NULL)
+	{
+		fprintf(stderr, "pgimportdoc: read host is used only for lookups of --skip-existing\n");
+		exit(1);
+	}
+
+	if (param.server_profile && profile_begin(argv[argc - 1], &param) != 0)
+		exit(1);
+
+	if (param.sample_interval > 0 && sampler_start(argv[argc - 1], &param) != 0)
+		exit(1);
+
+	if (param.schema != NULL && schema_load(&param) != 0)
+		exit(1);
+
+	if (param.replay != NULL)
+	{
+		rc = import_replay(argv[argc - 1], &param);
+		sampler_stop(&param);
+		profile_end(&param);
+
+		return rc;
+	}
+
+	if (param.record != NULL)
+	{
+		const char *mode;
+
+		if (streaming)
+			mode = "fifo";
+		else if (param.split == SPLIT_MBOX)
+			mode = "mbox";
+		else if (param.split == SPLIT_MAILDIR)
+			mode = "maildir";
+		else if (is_copy_command(param.command))
+			mode = "copy";
+		else
+			mode = "single";
+
+		if (workload_record_open(param.record, mode, &param) != 0)
+			exit(1);
+	}
+
 	rc = pgimportdoc(argv[argc - 1], &param);
+
+	if (workload_record_close(&param) != 0)
+		rc = -1;
+
+	schema_unload();
+
+	sampler_stop(&param);
+	profile_end(&param);
+
 	return rc;
 }
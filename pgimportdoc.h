@@ -0,0 +1,388 @@
+/*-------------------------------------------------------------------------
+ *
+ * pgimportdoc.h
+ *	  shared declarations of pgimportdoc modules
+ *
+ * IDENTIFICATION
+ *   pgimportdoc.h
+ *
+ *-------------------------------------------------------------------------
+ */
+#ifndef PGIMPORTDOC_H
+#define PGIMPORTDOC_H
+
+#include "libpq-fe.h"
+#include "pqexpbuffer.h"
+
+/*
+ * Size of chunk of input data processed by streaming (COPY) paths.
+ */
+#define COPY_CHUNK_SIZE		(64 * 1024)
+
+/*
+ * Default number of documents imported in one transaction (or by one
+ * COPY command), when the input is split to more documents.
+ */
+#define DEFAULT_BATCH_SIZE	1000
+
+/*
+ * Default max time (in ms) of waiting of streamed document in not full
+ * batch. Under low load the documents are imported quickly, under high
+ * load the batches are full.
+ */
+#define DEFAULT_MAX_DELAY	20
+
+/* full version of document is imported after N - 1 deltas */
+#define DEFAULT_KEYFRAME_INTERVAL	16
+
+/* default target throughput (MB/s) of adaptive compression */
+#define DEFAULT_COMPRESS_TARGET		100
+
+/* max wait (in ms) for replay of recent writes on read host */
+#define DEFAULT_MAX_REPLAY_WAIT		10000
+
+/* length of hex encoded hash (SHA-256) of canonical form of document */
+#define CANONICAL_HASH_LEN	64
+
+/* maximal number of mail headers passed as parameters */
+#define MAX_HEADERS			16
+
+/* maximal number of FIFO inputs */
+#define MAX_FIFOS			64
+
+enum trivalue
+{
+	TRI_DEFAULT,
+	TRI_NO,
+	TRI_YES
+};
+
+enum format
+{
+	FORMAT_XML,
+	FORMAT_TEXT,
+	FORMAT_BYTEA
+};
+
+/*
+ * Encoding of input data. The decoded data are passed to server.
+ */
+typedef enum InputEncoding
+{
+	INPUT_ENCODING_NONE,
+	INPUT_ENCODING_BASE64,
+	INPUT_ENCODING_HEX
+} InputEncoding;
+
+/*
+ * Input can be split to more documents
+ */
+typedef enum SplitMode
+{
+	SPLIT_NONE,
+	SPLIT_MBOX,
+	SPLIT_MAILDIR,
+	SPLIT_SQLITE
+} SplitMode;
+
+/*
+ * How documents are separated in one stream (FIFO)
+ */
+typedef enum Framing
+{
+	FRAMING_NEWLINE,			/* one document per line */
+	FRAMING_NUL,				/* documents are separated by zero byte */
+	FRAMING_LENGTH				/* 4 bytes length (network order) and data */
+} Framing;
+
+/*
+ * Compression of BYTEA documents
+ */
+typedef enum CompressMode
+{
+	COMPRESS_OFF,
+	COMPRESS_AUTO,				/* selected by entropy and speed */
+	COMPRESS_LZ4,
+	COMPRESS_ZSTD
+} CompressMode;
+
+/*
+ * Canonical form of documents used for hash
+ */
+typedef enum CanonicalForm
+{
+	CANONICAL_NONE,
+	CANONICAL_XML,
+	CANONICAL_JSON
+} CanonicalForm;
+
+typedef struct Canonicalizer Canonicalizer;
+
+typedef struct SchemaValidator SchemaValidator;
+
+typedef struct Decompressor Decompressor;
+
+struct _param
+{
+	char	   *pg_user;
+	enum trivalue pg_prompt;
+	char	   *pg_port;
+	char	   *pg_host;
+	bool		prefer_socket;	/* use Unix socket when host is local */
+	const char *progname;
+	int			verbose;
+	enum format fmt;
+	char	   *command;
+	bool		use_stdin;
+	char	   *filename;
+	char	   *encoding;
+	InputEncoding input_encoding;
+	SplitMode	split;
+	int			batch_size;
+	char	  **headers;		/* names of mail headers passed as $2, $3, .. */
+	int			nheaders;
+	char	  **fifos;			/* paths of FIFO inputs */
+	int			nfifos;
+	Framing		framing;
+	int			jobs;			/* number of connections */
+	int			decompress_jobs;	/* threads decompressing one input */
+	int			max_delay;		/* max wait of document in batch in ms */
+	char	   *delta_cache;	/* directory with previous versions */
+	char	   *delta_key;		/* name of document in delta cache */
+	int			keyframe_interval;	/* full version after N - 1 deltas */
+	CompressMode compress;
+	int			compress_level;	/* level of forced zstd */
+	double		compress_target;	/* minimal compression speed in MB/s */
+	bool		freeze;			/* import by COPY FREEZE in one transaction */
+	char	   *truncate;		/* table truncated in freeze mode */
+	char	   *create_sql;		/* command creating table in freeze mode */
+	char	   *attach;			/* parent of loaded partition */
+	char	   *partition;		/* loaded table, attached after load */
+	char	   *partition_from;	/* range bound of partition */
+	char	   *partition_to;
+	char	   *sequence;		/* ids of documents are taken from sequence */
+	bool		direct_copy;	/* COPY data are written directly to socket */
+	char	   *read_host;		/* host used for lookups */
+	char	   *skip_existing;	/* lookup query of imported documents */
+	int			max_replay_wait;	/* max wait for replay on read host in ms */
+	CanonicalForm canonical_hash;	/* hash of canonical form is passed */
+	char	   *schema;			/* XML Schema or JSON Schema of documents */
+	char	   *reject_dir;		/* directory of invalid documents */
+	bool		large_objects;	/* documents are stored as large objects */
+	char	   *sqlite_query;	/* query returning documents from SQLite */
+	char	   *sqlite_blob;	/* TABLE.COLUMN read by incremental blob I/O */
+	char	   *fd_socket;		/* socket for passing of documents by fd */
+	bool		server_profile;	/* report pg_stat_statements of import */
+	int			sample_interval;	/* sampling of wait events in ms, or 0 */
+	char	   *record;			/* file of captured workload profile */
+	char	   *replay;			/* file of replayed workload profile */
+};
+
+/*
+ * Lookups of imported documents on read host or on primary
+ */
+typedef struct Lookup
+{
+	PGconn	   *conn;			/* connection used for lookups */
+	PGconn	   *primary;		/* connection used for import */
+	const struct _param *param;
+	int			nparams;		/* document and values of headers */
+	bool		on_replica;		/* lookups wait for replay */
+	char		wait_lsn[64];	/* position of primary, not replayed yet */
+	PQExpBufferData text;		/* zero terminated copy of text parameter */
+} Lookup;
+
+/*
+ * Imports more documents by batches. A batch is one transaction with
+ * prepared statement executions, or one COPY command when the command
+ * is COPY FROM STDIN. Additional parameters are passed as text.
+ */
+typedef struct BatchImporter
+{
+	PGconn	   *conn;
+	const struct _param *param;
+	int			nparams;		/* document and additional parameters */
+	bool		use_copy;
+	bool		in_batch;		/* transaction or COPY is active */
+	int			batch_docs;		/* documents in current batch */
+	int64		total_docs;
+	int64		total_bytes;
+	PQExpBufferData row;		/* COPY row buffer */
+	PQExpBufferData compressed;	/* compressed document */
+	int64	   *ids;			/* ids reserved from sequence */
+	int			nids;
+	int			next_id;		/* first unused id */
+	Lookup		lookup;			/* used when skip_existing is specified */
+	Canonicalizer *canon;		/* used when canonical_hash is specified */
+	SchemaValidator *validator;	/* used when schema is specified */
+	int64		rejected_docs;	/* invalid documents */
+	int64		skipped_docs;	/* documents imported already */
+	uint64	   *batch_keys;		/* hashes of documents of current batch */
+	int			nbatch_keys;	/* size of hash table (power of 2) */
+	PQExpBufferData lo_array;	/* bytea[] of documents of new large objects */
+	int			lo_ndocs;		/* documents waiting for large objects */
+	size_t	   *lo_doclens;		/* original sizes of waiting documents */
+	char	  **lo_values;		/* additional parameters of waiting documents */
+	int64		total_los;		/* created large objects */
+} BatchImporter;
+
+/*
+ * State of streaming decoder. The input can be split to chunks in any
+ * place, so not yet decoded bits are held there.
+ */
+typedef struct DecodeState
+{
+	InputEncoding encoding;
+	uint32		bits;			/* not yet emitted bits */
+	int			nbits;			/* number of valid bits in "bits" */
+	bool		finished;		/* base64 padding was processed */
+} DecodeState;
+
+/*
+ * Implementations of encoding kernels. The block decoders decode clean
+ * prefix of input and return number of processed characters.
+ */
+typedef struct EncodeKernels
+{
+	const char *name;
+	size_t		(*escape_text) (char *dst, const char *src, size_t len);
+	size_t		(*hex_encode) (char *dst, const char *src, size_t len);
+	size_t		(*hex_decode) (char *dst, const char *src, size_t len);
+	size_t		(*base64_decode) (char *dst, const char *src, size_t len);
+} EncodeKernels;
+
+/*
+ * Connection opened by nonblocking way
+ */
+typedef struct AsyncConnection
+{
+	PGconn	   *conn;
+	PostgresPollingStatusType status;	/* what PQconnectPoll waits for */
+	bool		try_socket;		/* TCP will be tried after failure */
+} AsyncConnection;
+
+/* pgimportdoc.c */
+extern bool is_copy_command(const char *command);
+extern PGconn *connect_database(const char *database,
+								const struct _param * param);
+extern PGconn *connect_read_database(const char *database,
+									 const struct _param * param);
+extern bool connect_database_start(AsyncConnection *ac, const char *database,
+								   const struct _param * param);
+extern int	connect_database_poll(AsyncConnection *ac, const char *database,
+								  const struct _param * param);
+
+/* batch.c */
+extern int	batch_begin(BatchImporter *bi, PGconn *conn,
+						const struct _param * param, int nparams);
+extern int	batch_add(BatchImporter *bi, const char *data, size_t len,
+					  const char *const *params);
+extern int	batch_flush(BatchImporter *bi);
+extern int	batch_end(BatchImporter *bi);
+
+/* fifo.c */
+extern int	import_fifos(const char *database, const struct _param * param);
+
+/* decompress.c */
+extern int	decompress_start(Decompressor **result, const char *path, int *fd,
+							 const struct _param * param);
+extern bool decompress_failed(Decompressor *dc);
+extern void decompress_end(Decompressor *dc);
+
+/* split.c */
+extern int	import_mbox(PGconn *conn, FILE *input, const struct _param * param);
+extern int	import_maildir(PGconn *conn, const struct _param * param);
+
+/* sqlite.c */
+extern int	import_sqlite(PGconn *conn, const struct _param * param);
+
+/* compress.c */
+extern bool compress_supported(CompressMode mode);
+extern bool compress_zstd_level_valid(int level);
+extern const char *compress_document(PQExpBuffer buf, const char **data,
+									 size_t *len, const struct _param * param);
+
+/* bulk.c */
+extern bool command_has_word(const char *command, const char *word);
+extern int	bulk_begin(PGconn *conn, const struct _param * param);
+extern int	bulk_end(PGconn *conn, const struct _param * param, int rc);
+
+/* canon.c */
+extern Canonicalizer *canon_create(const struct _param * param);
+extern int	canon_hash(Canonicalizer *cn, const char *data, size_t len,
+					   char *hash);
+extern void canon_free(Canonicalizer *cn);
+
+/* schema.c */
+extern int	schema_load(const struct _param * param);
+extern void schema_unload(void);
+extern SchemaValidator *schema_validator_create(const struct _param * param);
+extern int	schema_validate(SchemaValidator *sv, const char *data, size_t len,
+							const char **error);
+extern void schema_validator_free(SchemaValidator *sv);
+extern int	schema_reject(const char *data, size_t len, const char *error,
+						  const struct _param * param);
+
+/* copysock.c */
+extern bool copy_direct_start(PGconn *conn, const struct _param * param);
+extern int	copy_direct_put(PGconn *conn, const char *buffer, int nbytes);
+
+/* lookup.c */
+extern int	lookup_begin(Lookup *lk, PGconn *primary,
+						 const struct _param * param, int nparams);
+extern int	lookup_sync(Lookup *lk);
+extern int	lookup_exists(Lookup *lk, const char *data, size_t len,
+						  const char *const *params);
+extern void lookup_end(Lookup *lk);
+
+/* profile.c */
+extern int	profile_begin(const char *database, const struct _param * param);
+extern void profile_end(const struct _param * param);
+
+/* sampler.c */
+extern void sampler_register(PGconn *conn);
+extern int	sampler_start(const char *database, const struct _param * param);
+extern void sampler_stop(const struct _param * param);
+
+/* delta.c */
+extern int	delta_prepare(const char *doc, size_t len, PQExpBuffer value,
+						  char **base_id, const struct _param * param);
+extern int	delta_store(const char *doc, size_t len, const char *id,
+						bool is_delta, const struct _param * param);
+
+/* workload.c */
+extern int	workload_record_open(const char *filename, const char *mode,
+								 const struct _param * param);
+extern void workload_record(int64 size);
+extern int	workload_record_close(const struct _param * param);
+extern int	import_replay(const char *database, const struct _param * param);
+
+/* encode.c */
+extern const EncodeKernels *encode_kernels;
+extern const EncodeKernels encode_kernels_scalar;
+#ifdef __SSE2__
+extern const EncodeKernels encode_kernels_sse2;
+#endif
+
+
+/*
+ * Both functions expect the target buffer is big enough - for any
+ * input the result is never longer than 2 * len bytes.
+ */
+extern size_t copy_escape_text(char *dst, const char *src, size_t len);
+extern size_t hex_encode_bytes(char *dst, const char *src, size_t len);
+
+/*
+ * The decoded data are never longer than input data. Returns -1 when
+ * input contains invalid character.
+ */
+extern void decode_init(DecodeState *state, InputEncoding encoding);
+extern ssize_t decode_chunk(DecodeState *state, char *dst,
+							const char *src, size_t len);
+extern bool decode_finish(DecodeState *state);
+
+/* encode_simd.c */
+extern const EncodeKernels *const *encode_supported_kernels(void);
+extern bool encode_select_kernels(const char *name);
+
+#endif							/* PGIMPORTDOC_H */
@@ -0,0 +1,193 @@
+/*-------------------------------------------------------------------------
+ *
+ * profile.c
+ *	  server side profile of import from pg_stat_statements
+ *
+ * The statistics of statements executed by the user in the database are
+ * stored before import to temporary table of own connection. After import
+ * the differences (calls, mean time, shared blocks hits and reads, WAL
+ * records) are reported for statements executed during import. The max
+ * time is kept only as maximum since reset of statistics, so it is
+ * reported only when it was raised during import (else "-"). With
+ * pg_stat_statements.track = all the statements executed by triggers
+ * are reported (as nested) too. The statements of other sessions of same
+ * user can be included.
+ *
+ * IDENTIFICATION
+ *   profile.c
+ *
+ *-------------------------------------------------------------------------
+ */
+#include "postgres_fe.h"
+
+#include "pgimportdoc.h"
+
+/* number of reported statements */
+#define PROFILE_STATEMENTS		20
+
+/* length of displayed query */
+#define PROFILE_QUERY_WIDTH		60
+
+static PGconn *profile_conn = NULL;
+
+/* quoted schema of pg_stat_statements */
+static char *profile_schema = NULL;
+
+/*
+ * Execute command without result, returns -1 on error
+ */
+static int
+profile_exec(const char *command, const struct _param * param)
+{
+	PGresult   *result;
+	int			rc = 0;
+
+	result = PQexec(profile_conn, command);
+
+	if (PQresultStatus(result) != PGRES_COMMAND_OK &&
+		PQresultStatus(result) != PGRES_TUPLES_OK)
+	{
+		fprintf(stderr, "%s: warning: server profile is not available: %s",
+				param->progname, PQresultErrorMessage(result));
+		rc = -1;
+	}
+
+	PQclear(result);
+
+	return rc;
+}
+
+/*
+ * Append the query of statistics of statements of current user in
+ * current database. The names of columns depend on version.
+ */
+static void
+append_statements(PQExpBuffer query)
+{
+	int			version = PQserverVersion(profile_conn);
+
+	appendPQExpBuffer(query,
+					  "SELECT queryid, %s AS toplevel, query, calls,"
+					  " %s AS total_time, %s AS max_time,"
+					  " shared_blks_hit, shared_blks_read, %s AS wal_records"
+					  " FROM %s.pg_stat_statements"
+					  " WHERE userid = (SELECT oid FROM pg_catalog.pg_roles WHERE rolname = current_user)"
+					  " AND dbid = (SELECT oid FROM pg_catalog.pg_database WHERE datname = current_database())",
+					  version >= 140000 ? "toplevel" : "true",
+					  version >= 130000 ? "total_exec_time" : "total_time",
+					  version >= 130000 ? "max_exec_time" : "max_time",
+					  version >= 130000 ? "wal_records" : "NULL::bigint",
+					  profile_schema);
+}
+
+/*
+ * Store statistics of statements before import. When pg_stat_statements
+ * is not available, then warning is raised, and profile is not reported.
+ */
+int
+profile_begin(const char *database, const struct _param * param)
+{
+	PQExpBufferData query;
+	PGresult   *result;
+
+	profile_conn = connect_database(database, param);
+	if (!profile_conn)
+		return -1;
+
+	result = PQexec(profile_conn,
+					"SELECT pg_catalog.quote_ident(n.nspname)"
+					"  FROM pg_catalog.pg_extension e"
+					"       JOIN pg_catalog.pg_namespace n ON n.oid = e.extnamespace"
+					" WHERE e.extname = 'pg_stat_statements'");
+
+	if (PQresultStatus(result) != PGRES_TUPLES_OK || PQntuples(result) != 1)
+	{
+		fprintf(stderr, "%s: warning: extension pg_stat_statements is not installed, server profile is not available\n",
+				param->progname);
+		PQclear(result);
+		PQfinish(profile_conn);
+		profile_conn = NULL;
+		return 0;
+	}
+
+	profile_schema = pg_strdup(PQgetvalue(result, 0, 0));
+	PQclear(result);
+
+	initPQExpBuffer(&query);
+	appendPQExpBufferStr(&query, "CREATE TEMP TABLE pgimportdoc_profile AS ");
+	append_statements(&query);
+
+	if (profile_exec(query.data, param) != 0)
+	{
+		PQfinish(profile_conn);
+		profile_conn = NULL;
+	}
+
+	termPQExpBuffer(&query);
+
+	return 0;
+}
+
+/*
+ * Report differences of statistics of statements executed during import
+ */
+void
+profile_end(const struct _param * param)
+{
+	PQExpBufferData query;
+	PGresult   *result;
+	int			i;
+
+	if (!profile_conn)
+		return;
+
+	initPQExpBuffer(&query);
+	appendPQExpBufferStr(&query, "WITH s AS (");
+	append_statements(&query);
+
+	appendPQExpBuffer(&query,
+					  ")"
+					  " SELECT s.calls - COALESCE(p.calls, 0),"
+					  "        round(((s.total_time - COALESCE(p.total_time, 0))"
+					  "              / (s.calls - COALESCE(p.calls, 0)))::numeric, 3),"
+					  "        CASE WHEN p.max_time IS NULL OR s.max_time > p.max_time"
+					  "             THEN round(s.max_time::numeric, 3)::text ELSE '-' END,"
+					  "        s.shared_blks_hit - COALESCE(p.shared_blks_hit, 0),"
+					  "        s.shared_blks_read - COALESCE(p.shared_blks_read, 0),"
+					  "        COALESCE((s.wal_records - COALESCE(p.wal_records, 0))::text, '-'),"
+					  "        CASE WHEN s.toplevel THEN '' ELSE '(nested) ' END"
+					  "        || left(regexp_replace(s.query, '\\s+', ' ', 'g'), %d)"
+					  "   FROM s LEFT JOIN pgimportdoc_profile p"
+					  "        ON p.queryid = s.queryid AND p.toplevel = s.toplevel"
+					  "  WHERE s.calls > COALESCE(p.calls, 0)"
+					  "    AND s.query NOT LIKE '%%pgimportdoc_profile%%'"
+					  "  ORDER BY s.total_time - COALESCE(p.total_time, 0) DESC"
+					  "  LIMIT %d",
+					  PROFILE_QUERY_WIDTH, PROFILE_STATEMENTS);
+
+	result = PQexec(profile_conn, query.data);
+
+	if (PQresultStatus(result) != PGRES_TUPLES_OK)
+		fprintf(stderr, "%s: warning: server profile is not available: %s",
+				param->progname, PQresultErrorMessage(result));
+	else
+	{
+		fprintf(stdout, "Server profile (pg_stat_statements):\n");
+		fprintf(stdout, "%10s %12s %12s %12s %12s %10s  %s\n",
+				"calls", "mean ms", "max ms", "blks hit", "blks read",
+				"wal recs", "query");
+
+		for (i = 0; i < PQntuples(result); i++)
+			fprintf(stdout, "%10s %12s %12s %12s %12s %10s  %s\n",
+					PQgetvalue(result, i, 0), PQgetvalue(result, i, 1),
+					PQgetvalue(result, i, 2), PQgetvalue(result, i, 3),
+					PQgetvalue(result, i, 4), PQgetvalue(result, i, 5),
+					PQgetvalue(result, i, 6));
+	}
+
+	PQclear(result);
+	termPQExpBuffer(&query);
+
+	PQfinish(profile_conn);
+	profile_conn = NULL;
+}
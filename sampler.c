@@ -0,0 +1,277 @@
+/*-------------------------------------------------------------------------
+ *
+ * sampler.c
+ *	  sampling of wait events of import connections
+ *
+ * The backend pids of all connections opened by pgimportdoc are
+ * registered. The sampler thread reads pg_stat_activity of these backends
+ * by own connection in fixed interval, and counts the wait events of
+ * active backends (the active backend without wait event is on CPU). The
+ * histogram of wait events is reported at end of import, so it is visible
+ * why the parallel import doesn't scale (extension locks, WAL writes, IO,
+ * LWLocks, ...).
+ *
+ * IDENTIFICATION
+ *   sampler.c
+ *
+ *-------------------------------------------------------------------------
+ */
+#include "postgres_fe.h"
+
+#include <pthread.h>
+#include <signal.h>
+#include <sys/time.h>
+
+#include "pgimportdoc.h"
+
+/* max number of sampled backends */
+#define MAX_SAMPLED_BACKENDS	1100
+
+/* max number of different wait events in histogram */
+#define MAX_WAIT_EVENTS			128
+
+typedef struct WaitEventCount
+{
+	char	   *name;			/* type:event or CPU */
+	int64		count;
+} WaitEventCount;
+
+static pthread_mutex_t sampler_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t sampler_stop_cond = PTHREAD_COND_INITIALIZER;
+
+static int	backend_pids[MAX_SAMPLED_BACKENDS];
+static int	nbackend_pids = 0;
+
+static bool sampler_running = false;
+static bool sampler_stopped = false;
+static pthread_t sampler_thread;
+static PGconn *sampler_conn = NULL;
+static const struct _param *sampler_param = NULL;
+
+static WaitEventCount wait_events[MAX_WAIT_EVENTS];
+static int	nwait_events = 0;
+static int64 nsamples = 0;
+
+/*
+ * Register backend of import connection. It can be called from more
+ * threads.
+ */
+void
+sampler_register(PGconn *conn)
+{
+	pthread_mutex_lock(&sampler_mutex);
+
+	if (nbackend_pids < MAX_SAMPLED_BACKENDS)
+		backend_pids[nbackend_pids++] = PQbackendPID(conn);
+
+	pthread_mutex_unlock(&sampler_mutex);
+}
+
+static void
+count_wait_event(const char *name)
+{
+	int			i;
+
+	for (i = 0; i < nwait_events; i++)
+	{
+		if (strcmp(wait_events[i].name, name) == 0)
+		{
+			wait_events[i].count += 1;
+			return;
+		}
+	}
+
+	if (nwait_events < MAX_WAIT_EVENTS)
+	{
+		wait_events[nwait_events].name = pg_strdup(name);
+		wait_events[nwait_events].count = 1;
+		nwait_events += 1;
+	}
+}
+
+/*
+ * Read wait events of registered backends
+ */
+static bool
+take_sample(const struct _param * param)
+{
+	PQExpBufferData pids;
+	const char *values[1];
+	PGresult   *result;
+	int			i;
+
+	initPQExpBuffer(&pids);
+	appendPQExpBufferChar(&pids, '{');
+
+	pthread_mutex_lock(&sampler_mutex);
+
+	for (i = 0; i < nbackend_pids; i++)
+		appendPQExpBuffer(&pids, "%s%d", i > 0 ? "," : "", backend_pids[i]);
+
+	pthread_mutex_unlock(&sampler_mutex);
+
+	appendPQExpBufferChar(&pids, '}');
+
+	values[0] = pids.data;
+
+	result = PQexecParams(sampler_conn,
+						  "SELECT COALESCE(wait_event_type || ':' || wait_event, 'CPU')"
+						  "  FROM pg_catalog.pg_stat_activity"
+						  " WHERE pid = ANY($1::int[]) AND state = 'active'"
+						  "   AND pid <> pg_catalog.pg_backend_pid()",
+						  1, NULL, values, NULL, NULL, 0);
+
+	termPQExpBuffer(&pids);
+
+	if (PQresultStatus(result) != PGRES_TUPLES_OK)
+	{
+		fprintf(stderr, "%s: warning: sampling of wait events failed: %s",
+				param->progname, PQresultErrorMessage(result));
+		PQclear(result);
+		return false;
+	}
+
+	for (i = 0; i < PQntuples(result); i++)
+		count_wait_event(PQgetvalue(result, i, 0));
+
+	nsamples += 1;
+
+	PQclear(result);
+
+	return true;
+}
+
+static void *
+sampler_main(void *arg)
+{
+	const struct _param *param = sampler_param;
+
+	pthread_mutex_lock(&sampler_mutex);
+
+	while (!sampler_stopped)
+	{
+		struct timeval now;
+		struct timespec deadline;
+		int64		usec;
+
+		pthread_mutex_unlock(&sampler_mutex);
+
+		if (!take_sample(param))
+			return NULL;
+
+		gettimeofday(&now, NULL);
+		usec = now.tv_usec + (int64) param->sample_interval * 1000;
+		deadline.tv_sec = now.tv_sec + usec / 1000000;
+		deadline.tv_nsec = (usec % 1000000) * 1000;
+
+		pthread_mutex_lock(&sampler_mutex);
+
+		if (!sampler_stopped)
+			pthread_cond_timedwait(&sampler_stop_cond, &sampler_mutex, &deadline);
+	}
+
+	pthread_mutex_unlock(&sampler_mutex);
+
+	return NULL;
+}
+
+/*
+ * Start sampler thread with own connection
+ */
+int
+sampler_start(const char *database, const struct _param * param)
+{
+	sigset_t	sigset;
+	sigset_t	oldset;
+	int			rc;
+
+	sampler_conn = connect_database(database, param);
+	if (!sampler_conn)
+		return -1;
+
+	sampler_param = param;
+
+	/* SIGINT and SIGTERM are handled by main thread */
+	sigemptyset(&sigset);
+	sigaddset(&sigset, SIGINT);
+	sigaddset(&sigset, SIGTERM);
+	pthread_sigmask(SIG_BLOCK, &sigset, &oldset);
+
+	rc = pthread_create(&sampler_thread, NULL, sampler_main, NULL);
+
+	pthread_sigmask(SIG_SETMASK, &oldset, NULL);
+
+	if (rc != 0)
+	{
+		fprintf(stderr, "%s: cannot create thread: %s\n",
+				param->progname, strerror(rc));
+		PQfinish(sampler_conn);
+		sampler_conn = NULL;
+		return -1;
+	}
+
+	sampler_running = true;
+
+	return 0;
+}
+
+static int
+compare_wait_events(const void *a, const void *b)
+{
+	const WaitEventCount *wa = (const WaitEventCount *) a;
+	const WaitEventCount *wb = (const WaitEventCount *) b;
+
+	if (wa->count != wb->count)
+		return wa->count > wb->count ? -1 : 1;
+
+	return strcmp(wa->name, wb->name);
+}
+
+/*
+ * Stop sampler thread and report histogram of wait events
+ */
+void
+sampler_stop(const struct _param * param)
+{
+	int64		total = 0;
+	int			i;
+
+	if (!sampler_running)
+		return;
+
+	pthread_mutex_lock(&sampler_mutex);
+	sampler_stopped = true;
+	pthread_cond_signal(&sampler_stop_cond);
+	pthread_mutex_unlock(&sampler_mutex);
+
+	pthread_join(sampler_thread, NULL);
+	sampler_running = false;
+
+	PQfinish(sampler_conn);
+	sampler_conn = NULL;
+
+	qsort(wait_events, nwait_events, sizeof(WaitEventCount), compare_wait_events);
+
+	for (i = 0; i < nwait_events; i++)
+		total += wait_events[i].count;
+
+	fprintf(stdout, "Wait events of import backends (" INT64_FORMAT " samples every %d ms):\n",
+			nsamples, param->sample_interval);
+
+	for (i = 0; i < nwait_events; i++)
+	{
+		double		percent = 100.0 * wait_events[i].count / total;
+		char		bar[51];
+		int			width = (int) (percent / 2);
+
+		memset(bar, '#', width);
+		bar[width] = '\0';
+
+		fprintf(stdout, "  %-40s %10" INT64_MODIFIER "d %6.1f%% %s\n",
+				wait_events[i].name, wait_events[i].count, percent, bar);
+
+		pg_free(wait_events[i].name);
+	}
+
+	nwait_events = 0;
+}
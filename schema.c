@@ -0,0 +1,1246 @@
+/*-------------------------------------------------------------------------
+ *
+ * schema.c
+ *	  validation of documents against XML Schema or JSON Schema
+ *
+ * The schema is loaded and compiled once at start. Every batch importer
+ * (worker thread) has own validator, so the validation is done in parallel
+ * on client side, and the server doesn't need to validate documents in
+ * triggers. The invalid documents are written to reject directory (when
+ * it is specified) with the reason in reject.log, else the import fails.
+ *
+ * The kind of schema is detected from its content - XML Schema (XSD) is
+ * validated by libxml2 (only when PostgreSQL is built with libxml), JSON
+ * Schema by own validator. It supports keywords type, enum, const,
+ * properties, required, additionalProperties, items, min/maxItems,
+ * uniqueItems, min/maxProperties, min/maxLength, minimum, maximum,
+ * exclusiveMinimum, exclusiveMaximum, multipleOf, allOf, anyOf, oneOf,
+ * not and local references ($ref "#/..."). Other keywords (pattern,
+ * format, ...) are ignored.
+ *
+ * IDENTIFICATION
+ *   schema.c
+ *
+ *-------------------------------------------------------------------------
+ */
+#include "postgres_fe.h"
+
+#include <math.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#ifdef USE_LIBXML
+#include <libxml/parser.h>
+#include <libxml/xmlschemas.h>
+#endif
+
+#include "pgimportdoc.h"
+
+/* max nesting of parsed JSON values */
+#define JSON_MAX_DEPTH		1000
+
+/* max nesting of validation (references can be recursive) */
+#define SCHEMA_MAX_DEPTH	200
+
+/* number of JSON nodes allocated together */
+#define NODE_BLOCK_SIZE		1024
+
+#ifdef USE_LIBXML
+
+/* the error structure is const since libxml2 2.12 */
+#if LIBXML_VERSION >= 21200
+#define XmlErrorPtr const xmlError *
+#else
+#define XmlErrorPtr xmlErrorPtr
+#endif
+
+#endif
+
+typedef enum SchemaKind
+{
+	SCHEMA_XSD,
+	SCHEMA_JSON
+} SchemaKind;
+
+typedef enum JsonType
+{
+	JSON_NULL,
+	JSON_BOOL,
+	JSON_NUMBER,
+	JSON_STRING,
+	JSON_ARRAY,
+	JSON_OBJECT
+} JsonType;
+
+/*
+ * Parsed JSON value. The strings point to source text.
+ */
+typedef struct JsonNode
+{
+	JsonType	type;
+	const char *str;			/* string (without quotes), number, literal */
+	size_t		len;
+	const char *key;			/* key of object member (without quotes) */
+	size_t		keylen;
+	int			nitems;			/* number of elements or members */
+	struct JsonNode *first;		/* first element or member */
+	struct JsonNode *next;		/* next element or member of parent */
+} JsonNode;
+
+typedef struct NodeBlock
+{
+	struct NodeBlock *next;
+	int			used;
+	JsonNode	nodes[NODE_BLOCK_SIZE];
+} NodeBlock;
+
+/*
+ * The nodes of one document are released together, the blocks are reused
+ * for next document.
+ */
+typedef struct NodePool
+{
+	NodeBlock  *first;
+	NodeBlock  *current;
+} NodePool;
+
+typedef struct JsonParser
+{
+	const char *p;
+	const char *end;
+	NodePool   *pool;
+	int			depth;
+} JsonParser;
+
+struct SchemaValidator
+{
+	const struct _param *param;
+	NodePool	pool;			/* nodes of validated JSON document */
+	int			quiet;			/* errors of subschemas are not reported */
+	char		path[256];		/* JSON pointer of validated value */
+	int			pathlen;
+	char		error[512];		/* first error of document */
+#ifdef USE_LIBXML
+	xmlParserCtxtPtr parser;
+	xmlSchemaValidCtxtPtr vctx;
+#endif
+};
+
+/* compiled schema, shared by all validators (read only) */
+static SchemaKind schema_kind;
+static char *schema_text = NULL;
+static NodePool schema_pool;
+static JsonNode *json_schema = NULL;
+
+#ifdef USE_LIBXML
+static xmlSchemaPtr xsd_schema = NULL;
+#endif
+
+/* reject directory is shared by all threads */
+static pthread_mutex_t reject_mutex = PTHREAD_MUTEX_INITIALIZER;
+static FILE *reject_log = NULL;
+static int64 nrejected = 0;
+
+static bool validate_json(SchemaValidator *sv, const JsonNode *schema,
+						  const JsonNode *value, int depth);
+
+static JsonNode *
+pool_alloc(NodePool *pool)
+{
+	NodeBlock  *block = pool->current;
+	JsonNode   *node;
+
+	if (!block || block->used == NODE_BLOCK_SIZE)
+	{
+		if (block && block->next)
+			block = block->next;
+		else
+		{
+			NodeBlock  *nblock = pg_malloc(sizeof(NodeBlock));
+
+			nblock->next = NULL;
+			if (block)
+				block->next = nblock;
+			else
+				pool->first = nblock;
+			block = nblock;
+		}
+
+		block->used = 0;
+		pool->current = block;
+	}
+
+	node = &block->nodes[block->used++];
+	memset(node, 0, sizeof(JsonNode));
+
+	return node;
+}
+
+static void
+pool_reset(NodePool *pool)
+{
+	pool->current = pool->first;
+	if (pool->first)
+		pool->first->used = 0;
+}
+
+static void
+pool_free(NodePool *pool)
+{
+	NodeBlock  *block = pool->first;
+
+	while (block)
+	{
+		NodeBlock  *next = block->next;
+
+		pg_free(block);
+		block = next;
+	}
+
+	pool->first = NULL;
+	pool->current = NULL;
+}
+
+static void
+json_skip_spaces(JsonParser *jp)
+{
+	while (jp->p < jp->end &&
+		   (*jp->p == ' ' || *jp->p == '\t' || *jp->p == '\n' || *jp->p == '\r'))
+		jp->p++;
+}
+
+/*
+ * Parse string (jp->p points to quote), the escapes are not decoded
+ */
+static bool
+json_parse_string(JsonParser *jp, const char **str, size_t *len)
+{
+	const char *start = ++jp->p;
+
+	while (jp->p < jp->end)
+	{
+		if (*jp->p == '\\')
+			jp->p += 2;
+		else if (*jp->p == '"')
+		{
+			*str = start;
+			*len = jp->p - start;
+			jp->p++;
+			return true;
+		}
+		else
+			jp->p++;
+	}
+
+	return false;
+}
+
+static bool
+json_parse_number(JsonParser *jp)
+{
+	const char *p = jp->p;
+	const char *end = jp->end;
+
+	if (p < end && *p == '-')
+		p++;
+	if (p >= end || !isdigit((unsigned char) *p))
+		return false;
+	while (p < end && isdigit((unsigned char) *p))
+		p++;
+
+	if (p < end && *p == '.')
+	{
+		p++;
+		if (p >= end || !isdigit((unsigned char) *p))
+			return false;
+		while (p < end && isdigit((unsigned char) *p))
+			p++;
+	}
+
+	if (p < end && (*p == 'e' || *p == 'E'))
+	{
+		p++;
+		if (p < end && (*p == '+' || *p == '-'))
+			p++;
+		if (p >= end || !isdigit((unsigned char) *p))
+			return false;
+		while (p < end && isdigit((unsigned char) *p))
+			p++;
+	}
+
+	jp->p = p;
+
+	return true;
+}
+
+static bool
+json_parse_literal(JsonParser *jp, const char *literal)
+{
+	size_t		len = strlen(literal);
+
+	if ((size_t) (jp->end - jp->p) < len || memcmp(jp->p, literal, len) != 0)
+		return false;
+
+	jp->p += len;
+
+	return true;
+}
+
+/*
+ * Returns parsed value, or NULL when the input is not valid JSON
+ */
+static JsonNode *
+json_parse_value(JsonParser *jp)
+{
+	JsonNode   *node;
+	const char *start;
+
+	json_skip_spaces(jp);
+	if (jp->p >= jp->end)
+		return NULL;
+
+	node = pool_alloc(jp->pool);
+	start = jp->p;
+
+	if (*jp->p == '{' || *jp->p == '[')
+	{
+		bool		is_object = *jp->p == '{';
+		char		close = is_object ? '}' : ']';
+		JsonNode  **tail = &node->first;
+
+		if (++jp->depth > JSON_MAX_DEPTH)
+			return NULL;
+
+		node->type = is_object ? JSON_OBJECT : JSON_ARRAY;
+		jp->p++;
+		json_skip_spaces(jp);
+
+		if (jp->p < jp->end && *jp->p == close)
+			jp->p++;
+		else
+		{
+			for (;;)
+			{
+				const char *key = NULL;
+				size_t		keylen = 0;
+				JsonNode   *item;
+
+				if (is_object)
+				{
+					json_skip_spaces(jp);
+					if (jp->p >= jp->end || *jp->p != '"' ||
+						!json_parse_string(jp, &key, &keylen))
+						return NULL;
+
+					json_skip_spaces(jp);
+					if (jp->p >= jp->end || *jp->p != ':')
+						return NULL;
+					jp->p++;
+				}
+
+				item = json_parse_value(jp);
+				if (!item)
+					return NULL;
+
+				item->key = key;
+				item->keylen = keylen;
+				*tail = item;
+				tail = &item->next;
+				node->nitems += 1;
+
+				json_skip_spaces(jp);
+				if (jp->p < jp->end && *jp->p == ',')
+				{
+					jp->p++;
+					continue;
+				}
+				if (jp->p < jp->end && *jp->p == close)
+				{
+					jp->p++;
+					break;
+				}
+				return NULL;
+			}
+		}
+
+		jp->depth--;
+
+		return node;
+	}
+
+	if (*jp->p == '"')
+	{
+		node->type = JSON_STRING;
+		if (!json_parse_string(jp, &node->str, &node->len))
+			return NULL;
+		return node;
+	}
+
+	if (json_parse_literal(jp, "true") || json_parse_literal(jp, "false"))
+		node->type = JSON_BOOL;
+	else if (json_parse_literal(jp, "null"))
+		node->type = JSON_NULL;
+	else if (json_parse_number(jp))
+		node->type = JSON_NUMBER;
+	else
+		return NULL;
+
+	node->str = start;
+	node->len = jp->p - start;
+
+	return node;
+}
+
+/*
+ * Parse whole document, returns NULL when it is not valid JSON
+ */
+static JsonNode *
+json_parse(NodePool *pool, const char *data, size_t len)
+{
+	JsonParser	jp;
+	JsonNode   *root;
+
+	jp.p = data;
+	jp.end = data + len;
+	jp.pool = pool;
+	jp.depth = 0;
+
+	root = json_parse_value(&jp);
+	if (!root)
+		return NULL;
+
+	json_skip_spaces(&jp);
+
+	return jp.p == jp.end ? root : NULL;
+}
+
+static double
+json_number(const JsonNode *node)
+{
+	char		buffer[128];
+	size_t		len = Min(node->len, sizeof(buffer) - 1);
+
+	/* the number is not terminated, strlcpy would scan rest of document */
+	memcpy(buffer, node->str, len);
+	buffer[len] = '\0';
+
+	return strtod(buffer, NULL);
+}
+
+static bool
+json_is_true(const JsonNode *node)
+{
+	return node->type == JSON_BOOL && node->str[0] == 't';
+}
+
+static bool
+json_equal_str(const char *a, size_t alen, const char *b, size_t blen)
+{
+	return alen == blen && memcmp(a, b, alen) == 0;
+}
+
+static const JsonNode *
+json_member(const JsonNode *object, const char *key, size_t keylen)
+{
+	const JsonNode *item;
+
+	if (object->type != JSON_OBJECT)
+		return NULL;
+
+	for (item = object->first; item; item = item->next)
+		if (json_equal_str(item->key, item->keylen, key, keylen))
+			return item;
+
+	return NULL;
+}
+
+/*
+ * Returns true when there is escaped UTF-16 surrogate (high or low) at p
+ */
+static bool
+json_is_surrogate(const char *p, const char *end, bool high)
+{
+	unsigned char c;
+
+	if (end - p < 6 || p[0] != '\\' || p[1] != 'u' ||
+		tolower((unsigned char) p[2]) != 'd')
+		return false;
+
+	c = tolower((unsigned char) p[3]);
+
+	if (high)
+		return c == '8' || c == '9' || c == 'a' || c == 'b';
+
+	return c >= 'c' && c <= 'f';
+}
+
+/*
+ * Number of characters of string, the escape sequence is one character,
+ * and the escaped surrogate pair too
+ */
+static int64
+json_string_length(const JsonNode *node)
+{
+	const char *p = node->str;
+	const char *end = p + node->len;
+	int64		length = 0;
+
+	while (p < end)
+	{
+		if (*p == '\\')
+		{
+			if (json_is_surrogate(p, end, true) &&
+				json_is_surrogate(p + 6, end, false))
+				p += 12;
+			else
+				p += p + 1 < end && p[1] == 'u' ? 6 : 2;
+		}
+		else
+		{
+			/* UTF-8 continuation bytes are not counted */
+			if ((*p & 0xC0) != 0x80)
+				length++;
+			p++;
+			continue;
+		}
+
+		length++;
+	}
+
+	return length;
+}
+
+/*
+ * Equality of JSON values, the order of members of object is ignored
+ */
+static bool
+json_equal(const JsonNode *a, const JsonNode *b)
+{
+	const JsonNode *ia;
+	const JsonNode *ib;
+
+	if (a->type != b->type)
+		return false;
+
+	switch (a->type)
+	{
+		case JSON_NULL:
+			return true;
+		case JSON_BOOL:
+			return json_is_true(a) == json_is_true(b);
+		case JSON_NUMBER:
+			return json_number(a) == json_number(b);
+		case JSON_STRING:
+			return json_equal_str(a->str, a->len, b->str, b->len);
+		case JSON_ARRAY:
+			if (a->nitems != b->nitems)
+				return false;
+			for (ia = a->first, ib = b->first; ia; ia = ia->next, ib = ib->next)
+				if (!json_equal(ia, ib))
+					return false;
+			return true;
+		case JSON_OBJECT:
+			if (a->nitems != b->nitems)
+				return false;
+			for (ia = a->first; ia; ia = ia->next)
+			{
+				ib = json_member(b, ia->key, ia->keylen);
+				if (!ib || !json_equal(ia, ib))
+					return false;
+			}
+			return true;
+	}
+
+	return false;
+}
+
+static bool
+json_has_type(const JsonNode *value, const JsonNode *type)
+{
+	if (type->type != JSON_STRING)
+		return false;
+
+#define TYPE_IS(name) json_equal_str(type->str, type->len, name, strlen(name))
+
+	switch (value->type)
+	{
+		case JSON_NULL:
+			return TYPE_IS("null");
+		case JSON_BOOL:
+			return TYPE_IS("boolean");
+		case JSON_STRING:
+			return TYPE_IS("string");
+		case JSON_ARRAY:
+			return TYPE_IS("array");
+		case JSON_OBJECT:
+			return TYPE_IS("object");
+		case JSON_NUMBER:
+			if (TYPE_IS("number"))
+				return true;
+			if (TYPE_IS("integer"))
+			{
+				double		number = json_number(value);
+
+				return number == floor(number);
+			}
+			return false;
+	}
+
+#undef TYPE_IS
+
+	return false;
+}
+
+/*
+ * Set error of document (only first error is reported)
+ */
+static bool
+schema_error(SchemaValidator *sv, const char *keyword)
+{
+	if (sv->quiet == 0 && sv->error[0] == '\0')
+		snprintf(sv->error, sizeof(sv->error),
+				 "value at \"%s\" doesn't match keyword \"%s\"",
+				 sv->pathlen > 0 ? sv->path : "/", keyword);
+
+	return false;
+}
+
+/*
+ * Append key or index to path of validated value, returns previous length
+ */
+static int
+path_push(SchemaValidator *sv, const char *key, size_t keylen, int index)
+{
+	int			pathlen = sv->pathlen;
+	int			n;
+
+	if (key)
+		n = snprintf(sv->path + pathlen, sizeof(sv->path) - pathlen,
+					 "/%.*s", (int) keylen, key);
+	else
+		n = snprintf(sv->path + pathlen, sizeof(sv->path) - pathlen,
+					 "/%d", index);
+
+	sv->pathlen = Min(pathlen + n, (int) sizeof(sv->path) - 1);
+
+	return pathlen;
+}
+
+static void
+path_pop(SchemaValidator *sv, int pathlen)
+{
+	sv->pathlen = pathlen;
+	sv->path[pathlen] = '\0';
+}
+
+/*
+ * Resolve local reference "#/a/b" (JSON pointer) in schema
+ */
+static const JsonNode *
+resolve_ref(const JsonNode *ref)
+{
+	const JsonNode *node = json_schema;
+	const char *p;
+	const char *end;
+
+	if (ref->type != JSON_STRING || ref->len < 1 || ref->str[0] != '#')
+		return NULL;
+
+	p = ref->str + 1;
+	end = ref->str + ref->len;
+
+	while (p < end && node)
+	{
+		const char *segment;
+		const char *segment_end;
+
+		if (*p != '/')
+			return NULL;
+
+		segment = ++p;
+		while (p < end && *p != '/')
+			p++;
+		segment_end = p;
+
+		if (node->type == JSON_ARRAY)
+		{
+			int			index = atoi(segment);
+
+			for (node = node->first; node && index > 0; index--)
+				node = node->next;
+		}
+		else
+			node = json_member(node, segment, segment_end - segment);
+	}
+
+	return node;
+}
+
+/*
+ * Validate value against every subschema of array. Returns number of
+ * matching subschemas. The errors of subschemas are not reported.
+ */
+static int
+count_valid(SchemaValidator *sv, const JsonNode *schemas,
+			const JsonNode *value, int depth)
+{
+	const JsonNode *item;
+	int			nvalid = 0;
+
+	if (schemas->type != JSON_ARRAY)
+		return 0;
+
+	sv->quiet++;
+
+	for (item = schemas->first; item; item = item->next)
+		if (validate_json(sv, item, value, depth + 1))
+			nvalid++;
+
+	sv->quiet--;
+
+	return nvalid;
+}
+
+static bool
+validate_keyword(SchemaValidator *sv, const JsonNode *schema,
+				 const JsonNode *kw, const JsonNode *value, int depth)
+{
+	const JsonNode *item;
+	int			i;
+
+#define KEYWORD_IS(name) json_equal_str(kw->key, kw->keylen, name, strlen(name))
+
+	if (KEYWORD_IS("type"))
+	{
+		if (kw->type == JSON_ARRAY)
+		{
+			for (item = kw->first; item; item = item->next)
+				if (json_has_type(value, item))
+					return true;
+			return false;
+		}
+
+		return json_has_type(value, kw);
+	}
+	else if (KEYWORD_IS("enum"))
+	{
+		if (kw->type == JSON_ARRAY)
+		{
+			for (item = kw->first; item; item = item->next)
+				if (json_equal(value, item))
+					return true;
+			return false;
+		}
+	}
+	else if (KEYWORD_IS("const"))
+		return json_equal(value, kw);
+	else if (KEYWORD_IS("$ref"))
+	{
+		const JsonNode *ref = resolve_ref(kw);
+
+		if (!ref)
+			return false;
+
+		return validate_json(sv, ref, value, depth + 1);
+	}
+	else if (KEYWORD_IS("allOf"))
+		return kw->type != JSON_ARRAY ||
+			count_valid(sv, kw, value, depth) == kw->nitems;
+	else if (KEYWORD_IS("anyOf"))
+		return kw->type != JSON_ARRAY || count_valid(sv, kw, value, depth) > 0;
+	else if (KEYWORD_IS("oneOf"))
+		return kw->type != JSON_ARRAY || count_valid(sv, kw, value, depth) == 1;
+	else if (KEYWORD_IS("not"))
+	{
+		bool		valid;
+
+		sv->quiet++;
+		valid = validate_json(sv, kw, value, depth + 1);
+		sv->quiet--;
+
+		return !valid;
+	}
+	else if (value->type == JSON_OBJECT)
+	{
+		if (KEYWORD_IS("properties") && kw->type == JSON_OBJECT)
+		{
+			for (item = value->first; item; item = item->next)
+			{
+				const JsonNode *prop = json_member(kw, item->key, item->keylen);
+
+				if (prop)
+				{
+					int			pathlen = path_push(sv, item->key, item->keylen, 0);
+					bool		valid = validate_json(sv, prop, item, depth + 1);
+
+					path_pop(sv, pathlen);
+					if (!valid)
+						return false;
+				}
+			}
+		}
+		else if (KEYWORD_IS("additionalProperties"))
+		{
+			const JsonNode *props = json_member(schema, "properties", 10);
+
+			for (item = value->first; item; item = item->next)
+			{
+				if (!props || !json_member(props, item->key, item->keylen))
+				{
+					int			pathlen;
+					bool		valid;
+
+					if (kw->type == JSON_BOOL && !json_is_true(kw))
+						return false;
+
+					pathlen = path_push(sv, item->key, item->keylen, 0);
+					valid = validate_json(sv, kw, item, depth + 1);
+
+					path_pop(sv, pathlen);
+					if (!valid)
+						return false;
+				}
+			}
+		}
+		else if (KEYWORD_IS("required") && kw->type == JSON_ARRAY)
+		{
+			for (item = kw->first; item; item = item->next)
+				if (item->type == JSON_STRING &&
+					!json_member(value, item->str, item->len))
+					return false;
+		}
+		else if (KEYWORD_IS("minProperties") && kw->type == JSON_NUMBER)
+			return value->nitems >= json_number(kw);
+		else if (KEYWORD_IS("maxProperties") && kw->type == JSON_NUMBER)
+			return value->nitems <= json_number(kw);
+	}
+	else if (value->type == JSON_ARRAY)
+	{
+		if (KEYWORD_IS("items"))
+		{
+			const JsonNode *subschema = kw->type == JSON_ARRAY ? kw->first : kw;
+
+			for (item = value->first, i = 0; item && subschema; item = item->next, i++)
+			{
+				int			pathlen = path_push(sv, NULL, 0, i);
+				bool		valid = validate_json(sv, subschema, item, depth + 1);
+
+				path_pop(sv, pathlen);
+				if (!valid)
+					return false;
+
+				/* tuple validation, the additional items are not checked */
+				if (kw->type == JSON_ARRAY)
+					subschema = subschema->next;
+			}
+		}
+		else if (KEYWORD_IS("minItems") && kw->type == JSON_NUMBER)
+			return value->nitems >= json_number(kw);
+		else if (KEYWORD_IS("maxItems") && kw->type == JSON_NUMBER)
+			return value->nitems <= json_number(kw);
+		else if (KEYWORD_IS("uniqueItems") && json_is_true(kw))
+		{
+			for (item = value->first; item; item = item->next)
+			{
+				const JsonNode *other;
+
+				for (other = item->next; other; other = other->next)
+					if (json_equal(item, other))
+						return false;
+			}
+		}
+	}
+	else if (value->type == JSON_STRING)
+	{
+		if (KEYWORD_IS("minLength") && kw->type == JSON_NUMBER)
+			return json_string_length(value) >= json_number(kw);
+		else if (KEYWORD_IS("maxLength") && kw->type == JSON_NUMBER)
+			return json_string_length(value) <= json_number(kw);
+	}
+	else if (value->type == JSON_NUMBER)
+	{
+		double		number = json_number(value);
+		const JsonNode *exclusive;
+
+		if (KEYWORD_IS("minimum") && kw->type == JSON_NUMBER)
+		{
+			/* draft 4 has boolean exclusiveMinimum */
+			exclusive = json_member(schema, "exclusiveMinimum", 16);
+			if (exclusive && json_is_true(exclusive))
+				return number > json_number(kw);
+			return number >= json_number(kw);
+		}
+		else if (KEYWORD_IS("maximum") && kw->type == JSON_NUMBER)
+		{
+			exclusive = json_member(schema, "exclusiveMaximum", 16);
+			if (exclusive && json_is_true(exclusive))
+				return number < json_number(kw);
+			return number <= json_number(kw);
+		}
+		else if (KEYWORD_IS("exclusiveMinimum") && kw->type == JSON_NUMBER)
+			return number > json_number(kw);
+		else if (KEYWORD_IS("exclusiveMaximum") && kw->type == JSON_NUMBER)
+			return number < json_number(kw);
+		else if (KEYWORD_IS("multipleOf") && kw->type == JSON_NUMBER)
+		{
+			double		quotient = number / json_number(kw);
+
+			return fabs(quotient - rint(quotient)) < 1e-9;
+		}
+	}
+
+#undef KEYWORD_IS
+
+	return true;
+}
+
+static bool
+validate_json(SchemaValidator *sv, const JsonNode *schema,
+			  const JsonNode *value, int depth)
+{
+	const JsonNode *kw;
+
+	if (depth > SCHEMA_MAX_DEPTH)
+		return schema_error(sv, "$ref");
+
+	/* boolean schema */
+	if (schema->type == JSON_BOOL)
+		return json_is_true(schema) ? true : schema_error(sv, "false");
+
+	if (schema->type != JSON_OBJECT)
+		return true;
+
+	for (kw = schema->first; kw; kw = kw->next)
+	{
+		if (!validate_keyword(sv, schema, kw, value, depth))
+		{
+			char		keyword[64];
+
+			snprintf(keyword, sizeof(keyword), "%.*s", (int) kw->keylen, kw->key);
+			return schema_error(sv, keyword);
+		}
+	}
+
+	return true;
+}
+
+#ifdef USE_LIBXML
+
+static void
+xsd_error(void *arg, XmlErrorPtr error)
+{
+	SchemaValidator *sv = (SchemaValidator *) arg;
+
+	if (sv->error[0] == '\0')
+	{
+		size_t		len;
+
+		snprintf(sv->error, sizeof(sv->error), "line %d: %s",
+				 error->line, error->message ? error->message : "");
+
+		/* libxml2 messages end by new line */
+		len = strlen(sv->error);
+		while (len > 0 && sv->error[len - 1] == '\n')
+			sv->error[--len] = '\0';
+	}
+}
+
+static int
+validate_xml(SchemaValidator *sv, const char *data, size_t len)
+{
+	xmlDocPtr	doc;
+	int			rc;
+
+	doc = xmlCtxtReadMemory(sv->parser, data, len, NULL, NULL,
+							XML_PARSE_NONET | XML_PARSE_NOERROR |
+							XML_PARSE_NOWARNING);
+	if (!doc)
+	{
+		XmlErrorPtr error = xmlCtxtGetLastError(sv->parser);
+
+		if (error)
+			xsd_error(sv, error);
+		else
+			strlcpy(sv->error, "document is not well-formed", sizeof(sv->error));
+
+		return 0;
+	}
+
+	rc = xmlSchemaValidateDoc(sv->vctx, doc);
+
+	xmlFreeDoc(doc);
+
+	if (rc < 0)
+	{
+		fprintf(stderr, "%s: internal error of XML schema validation\n",
+				sv->param->progname);
+		return -1;
+	}
+
+	return rc == 0 ? 1 : 0;
+}
+
+#endif
+
+/*
+ * Read and compile schema. The reject log is opened, when the reject
+ * directory is specified.
+ */
+int
+schema_load(const struct _param * param)
+{
+	PQExpBufferData buf;
+	FILE	   *f;
+	char		buffer[BUFSIZ];
+	size_t		n;
+	const char *p;
+
+	f = fopen(param->schema, "rb");
+	if (!f)
+	{
+		fprintf(stderr, "%s: Cannot read schema '%s': %s\n",
+				param->progname, param->schema, strerror(errno));
+		return -1;
+	}
+
+	initPQExpBuffer(&buf);
+
+	while ((n = fread(buffer, 1, sizeof(buffer), f)) > 0)
+		appendBinaryPQExpBuffer(&buf, buffer, n);
+
+	if (ferror(f) || PQExpBufferBroken(&buf))
+	{
+		fprintf(stderr, "%s: Cannot read schema '%s'\n",
+				param->progname, param->schema);
+		fclose(f);
+		termPQExpBuffer(&buf);
+		return -1;
+	}
+
+	fclose(f);
+
+	/* JSON Schema is object (or boolean), XML Schema starts by tag */
+	p = buf.data;
+	while (*p == ' ' || *p == '\t' || *p == '\n' || *p == '\r')
+		p++;
+
+	schema_kind = *p == '<' ? SCHEMA_XSD : SCHEMA_JSON;
+
+	if (schema_kind == SCHEMA_XSD)
+	{
+		termPQExpBuffer(&buf);
+
+#ifdef USE_LIBXML
+
+		{
+			xmlSchemaParserCtxtPtr pctx;
+
+			xmlInitParser();
+
+			pctx = xmlSchemaNewParserCtxt(param->schema);
+			if (pctx)
+			{
+				xsd_schema = xmlSchemaParse(pctx);
+				xmlSchemaFreeParserCtxt(pctx);
+			}
+
+			if (!xsd_schema)
+			{
+				fprintf(stderr, "%s: Cannot compile XML schema '%s'\n",
+						param->progname, param->schema);
+				return -1;
+			}
+		}
+
+#else
+
+		fprintf(stderr, "%s: XML schema is not supported by this build (libxml is required)\n",
+				param->progname);
+		return -1;
+
+#endif
+	}
+	else
+	{
+		schema_text = buf.data;
+
+		json_schema = json_parse(&schema_pool, schema_text, buf.len);
+		if (!json_schema ||
+			(json_schema->type != JSON_OBJECT && json_schema->type != JSON_BOOL))
+		{
+			fprintf(stderr, "%s: schema \"%s\" is not valid JSON Schema\n",
+					param->progname, param->schema);
+			return -1;
+		}
+	}
+
+	if (param->reject_dir)
+	{
+		char		path[MAXPGPATH];
+
+		snprintf(path, sizeof(path), "%s/reject.log", param->reject_dir);
+
+		reject_log = fopen(path, "a");
+		if (!reject_log)
+		{
+			fprintf(stderr, "%s: Cannot write '%s': %s\n",
+					param->progname, path, strerror(errno));
+			return -1;
+		}
+	}
+
+	if (param->verbose)
+		fprintf(stdout, "Documents are validated against %s \"%s\"\n",
+				schema_kind == SCHEMA_XSD ? "XML Schema" : "JSON Schema",
+				param->schema);
+
+	return 0;
+}
+
+void
+schema_unload(void)
+{
+#ifdef USE_LIBXML
+
+	if (xsd_schema)
+		xmlSchemaFree(xsd_schema);
+	xsd_schema = NULL;
+
+#endif
+
+	pool_free(&schema_pool);
+	json_schema = NULL;
+
+	if (schema_text)
+		pg_free(schema_text);
+	schema_text = NULL;
+
+	if (reject_log)
+		fclose(reject_log);
+	reject_log = NULL;
+}
+
+SchemaValidator *
+schema_validator_create(const struct _param * param)
+{
+	SchemaValidator *sv = pg_malloc0(sizeof(SchemaValidator));
+
+	sv->param = param;
+
+#ifdef USE_LIBXML
+
+	if (schema_kind == SCHEMA_XSD)
+	{
+		sv->parser = xmlNewParserCtxt();
+		sv->vctx = xmlSchemaNewValidCtxt(xsd_schema);
+
+		if (!sv->parser || !sv->vctx)
+		{
+			fprintf(stderr, "%s: Cannot create XML schema validator\n",
+					param->progname);
+			schema_validator_free(sv);
+			return NULL;
+		}
+
+		xmlSchemaSetValidStructuredErrors(sv->vctx, xsd_error, sv);
+	}
+
+#endif
+
+	return sv;
+}
+
+/*
+ * Returns 1 when the document is valid, 0 when it is not valid (the reason
+ * is returned in error), -1 on internal error.
+ */
+int
+schema_validate(SchemaValidator *sv, const char *data, size_t len,
+				const char **error)
+{
+	sv->error[0] = '\0';
+	*error = sv->error;
+
+#ifdef USE_LIBXML
+
+	if (schema_kind == SCHEMA_XSD)
+		return validate_xml(sv, data, len);
+
+#endif
+
+	{
+		JsonNode   *doc;
+		bool		valid;
+
+		pool_reset(&sv->pool);
+
+		doc = json_parse(&sv->pool, data, len);
+		if (!doc)
+		{
+			strlcpy(sv->error, "document is not valid JSON", sizeof(sv->error));
+			return 0;
+		}
+
+		sv->quiet = 0;
+		sv->pathlen = 0;
+		sv->path[0] = '\0';
+
+		valid = validate_json(sv, json_schema, doc, 0);
+
+		return valid ? 1 : 0;
+	}
+}
+
+void
+schema_validator_free(SchemaValidator *sv)
+{
+#ifdef USE_LIBXML
+
+	if (sv->vctx)
+		xmlSchemaFreeValidCtxt(sv->vctx);
+	if (sv->parser)
+		xmlFreeParserCtxt(sv->parser);
+
+#endif
+
+	pool_free(&sv->pool);
+	pg_free(sv);
+}
+
+/*
+ * Write invalid document to reject directory, and the reason to log
+ */
+int
+schema_reject(const char *data, size_t len, const char *error,
+			  const struct _param * param)
+{
+	char		filename[64];
+	char		path[MAXPGPATH];
+	FILE	   *f;
+	int64		n;
+
+	pthread_mutex_lock(&reject_mutex);
+
+	n = ++nrejected;
+	snprintf(filename, sizeof(filename), "reject_%d_" INT64_FORMAT ".%s",
+			 (int) getpid(), n, schema_kind == SCHEMA_XSD ? "xml" : "json");
+
+	fprintf(reject_log, "%s: %s\n", filename, error);
+	fflush(reject_log);
+
+	pthread_mutex_unlock(&reject_mutex);
+
+	snprintf(path, sizeof(path), "%s/%s", param->reject_dir, filename);
+
+	f = fopen(path, "wb");
+	if (!f ||
+		fwrite(data, 1, len, f) != len ||
+		fclose(f) != 0)
+	{
+		fprintf(stderr, "%s: Cannot write '%s': %s\n",
+				param->progname, path, strerror(errno));
+		return -1;
+	}
+
+	return 0;
+}
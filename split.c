@@ -0,0 +1,387 @@
+/*-------------------------------------------------------------------------
+ *
+ * split.c
+ *	  splitting of mail archives (mbox files, maildir directories)
+ *
+ * Every mail message is imported as one document. Values of selected
+ * headers can be passed as additional parameters. Only one message is
+ * held in memory.
+ *
+ * IDENTIFICATION
+ *   split.c
+ *
+ *-------------------------------------------------------------------------
+ */
+#include "postgres_fe.h"
+
+#include <dirent.h>
+#include <sys/stat.h>
+
+#include "pgimportdoc.h"
+
+/*
+ * Read one line (including newline) to buf. Returns false on EOF.
+ */
+static bool
+read_line(FILE *input, PQExpBuffer buf)
+{
+	char		chunk[BUFSIZ];
+
+	resetPQExpBuffer(buf);
+
+	while (fgets(chunk, sizeof(chunk), input) != NULL)
+	{
+		size_t		len = strlen(chunk);
+
+		appendBinaryPQExpBuffer(buf, chunk, len);
+
+		if (len > 0 && chunk[len - 1] == '\n')
+			break;
+	}
+
+	return buf->len > 0;
+}
+
+/*
+ * Returns value of header "name" of mail message, or NULL. Folded
+ * header lines are joined. The result is malloced.
+ */
+static char *
+get_mail_header(const char *msg, size_t msglen, const char *name)
+{
+	const char *end = msg + msglen;
+	const char *ptr = msg;
+	size_t		namelen = strlen(name);
+
+	while (ptr < end)
+	{
+		const char *eol = memchr(ptr, '\n', end - ptr);
+		size_t		linelen;
+
+		if (!eol)
+			eol = end;
+
+		linelen = eol - ptr;
+		if (linelen > 0 && ptr[linelen - 1] == '\r')
+			linelen--;
+
+		/* empty line is end of headers */
+		if (linelen == 0)
+			break;
+
+		if (linelen > namelen && ptr[namelen] == ':' &&
+			pg_strncasecmp(ptr, name, namelen) == 0)
+		{
+			PQExpBufferData value;
+			const char *vptr = ptr + namelen + 1;
+			char	   *result;
+
+			initPQExpBuffer(&value);
+
+			for (;;)
+			{
+				const char *vend = ptr + linelen;
+
+				while (vptr < vend && (*vptr == ' ' || *vptr == '\t'))
+					vptr++;
+
+				if (value.len > 0)
+					appendPQExpBufferChar(&value, ' ');
+				appendBinaryPQExpBuffer(&value, vptr, vend - vptr);
+
+				/* continuation line starts by whitespace */
+				ptr = eol + 1;
+				if (ptr >= end || (*ptr != ' ' && *ptr != '\t'))
+					break;
+
+				eol = memchr(ptr, '\n', end - ptr);
+				if (!eol)
+					eol = end;
+
+				linelen = eol - ptr;
+				if (linelen > 0 && ptr[linelen - 1] == '\r')
+					linelen--;
+
+				vptr = ptr;
+			}
+
+			result = pg_strdup(value.data);
+			termPQExpBuffer(&value);
+
+			return result;
+		}
+
+		ptr = eol + 1;
+	}
+
+	return NULL;
+}
+
+/*
+ * Import one message with values of requested headers
+ */
+static int
+import_message(BatchImporter *bi, PQExpBuffer msg, const struct _param * param)
+{
+	char	   *values[MAX_HEADERS];
+	int			rc;
+	int			i;
+
+	if (PQExpBufferBroken(msg))
+	{
+		fprintf(stderr, "%s: Out of memory\n", param->progname);
+		return -1;
+	}
+
+	workload_record(msg->len);
+
+	for (i = 0; i < param->nheaders; i++)
+		values[i] = get_mail_header(msg->data, msg->len, param->headers[i]);
+
+	rc = batch_add(bi, msg->data, msg->len, (const char *const *) values);
+
+	for (i = 0; i < param->nheaders; i++)
+		if (values[i])
+			pg_free(values[i]);
+
+	return rc;
+}
+
+/*
+ * Remove the empty line separating messages from end of message
+ */
+static void
+trim_separator(PQExpBuffer msg)
+{
+	if (msg->len > 0 && msg->data[msg->len - 1] == '\n')
+		msg->data[--msg->len] = '\0';
+	if (msg->len > 0 && msg->data[msg->len - 1] == '\r')
+		msg->data[--msg->len] = '\0';
+}
+
+/*
+ * Import messages from mbox file. The message starts by "From " line
+ * at start of file or after empty line. This line is not part of
+ * message. The quoted ">From " lines (mboxrd format) are unquoted.
+ */
+int
+import_mbox(PGconn *conn, FILE *input, const struct _param * param)
+{
+	BatchImporter bi;
+	PQExpBufferData line;
+	PQExpBufferData msg;
+	bool		has_msg = false;
+	bool		prev_empty = true;
+	int			rc = 0;
+
+	if (batch_begin(&bi, conn, param, 1 + param->nheaders) != 0)
+		return -1;
+
+	initPQExpBuffer(&line);
+	initPQExpBuffer(&msg);
+
+	while (read_line(input, &line))
+	{
+		bool		is_empty;
+
+		if (prev_empty && strncmp(line.data, "From ", 5) == 0)
+		{
+			if (has_msg)
+			{
+				/* the empty line before "From " is separator */
+				trim_separator(&msg);
+
+				if ((rc = import_message(&bi, &msg, param)) != 0)
+					break;
+			}
+
+			resetPQExpBuffer(&msg);
+			has_msg = true;
+			prev_empty = false;
+			continue;
+		}
+
+		is_empty = strcmp(line.data, "\n") == 0 || strcmp(line.data, "\r\n") == 0;
+
+		if (has_msg)
+		{
+			const char *ptr = line.data;
+
+			while (*ptr == '>')
+				ptr++;
+
+			if (ptr > line.data && strncmp(ptr, "From ", 5) == 0)
+				appendBinaryPQExpBuffer(&msg, line.data + 1, line.len - 1);
+			else
+				appendBinaryPQExpBuffer(&msg, line.data, line.len);
+		}
+		else if (!is_empty)
+		{
+			fprintf(stderr, "%s: input is not mbox file\n", param->progname);
+			rc = -1;
+			break;
+		}
+
+		prev_empty = is_empty;
+	}
+
+	if (rc == 0 && ferror(input))
+	{
+		fprintf(stderr, "%s: Cannot read data '%s': %s\n",
+				param->progname,
+				param->filename ? param->filename : "stdin",
+				strerror(errno));
+		rc = -1;
+	}
+
+	if (rc == 0 && has_msg)
+	{
+		/* the last message is usually terminated by empty line too */
+		if (prev_empty)
+			trim_separator(&msg);
+
+		rc = import_message(&bi, &msg, param);
+	}
+
+	termPQExpBuffer(&line);
+	termPQExpBuffer(&msg);
+
+	if (rc == 0)
+		rc = batch_end(&bi);
+
+	return rc;
+}
+
+static int
+cmp_names(const void *a, const void *b)
+{
+	return strcmp(*(char *const *) a, *(char *const *) b);
+}
+
+/*
+ * Import all messages from one subdirectory of maildir
+ */
+static int
+import_maildir_subdir(BatchImporter *bi, const char *path,
+					  const struct _param * param)
+{
+	DIR		   *dir;
+	struct dirent *de;
+	char	  **names = NULL;
+	int			nnames = 0;
+	int			maxnames = 0;
+	PQExpBufferData msg;
+	int			rc = 0;
+	int			i;
+
+	dir = opendir(path);
+	if (!dir)
+	{
+		/* missing subdirectory is not an error */
+		if (errno == ENOENT)
+			return 0;
+
+		fprintf(stderr, "%s: Unable to open directory '%s': %s\n",
+				param->progname, path, strerror(errno));
+		return -1;
+	}
+
+	while ((de = readdir(dir)) != NULL)
+	{
+		if (de->d_name[0] == '.')
+			continue;
+
+		if (nnames >= maxnames)
+		{
+			maxnames = maxnames ? maxnames * 2 : 64;
+			names = pg_realloc(names, maxnames * sizeof(char *));
+		}
+
+		names[nnames++] = pg_strdup(de->d_name);
+	}
+
+	closedir(dir);
+
+	/* import in stable order (maildir names starts by timestamp) */
+	if (nnames > 1)
+		qsort(names, nnames, sizeof(char *), cmp_names);
+
+	initPQExpBuffer(&msg);
+
+	for (i = 0; i < nnames && rc == 0; i++)
+	{
+		char		fname[MAXPGPATH];
+		char		buffer[BUFSIZ];
+		struct stat fst;
+		FILE	   *input;
+		size_t		size;
+
+		snprintf(fname, sizeof(fname), "%s/%s", path, names[i]);
+
+		if (stat(fname, &fst) != 0 || !S_ISREG(fst.st_mode))
+			continue;
+
+		input = fopen(fname, "rb");
+		if (!input)
+		{
+			fprintf(stderr, "%s: Unable to open '%s': %s\n",
+					param->progname, fname, strerror(errno));
+			rc = -1;
+			break;
+		}
+
+		resetPQExpBuffer(&msg);
+
+		while ((size = fread(buffer, 1, sizeof(buffer), input)) > 0)
+			appendBinaryPQExpBuffer(&msg, buffer, size);
+
+		if (ferror(input))
+		{
+			fprintf(stderr, "%s: Cannot read data '%s': %s\n",
+					param->progname, fname, strerror(errno));
+			rc = -1;
+		}
+
+		fclose(input);
+
+		if (rc == 0)
+			rc = import_message(bi, &msg, param);
+	}
+
+	termPQExpBuffer(&msg);
+
+	for (i = 0; i < nnames; i++)
+		pg_free(names[i]);
+	if (names)
+		pg_free(names);
+
+	return rc;
+}
+
+/*
+ * Import messages from maildir directory (from subdirectories cur and new)
+ */
+int
+import_maildir(PGconn *conn, const struct _param * param)
+{
+	BatchImporter bi;
+	char		path[MAXPGPATH];
+	int			rc;
+
+	if (batch_begin(&bi, conn, param, 1 + param->nheaders) != 0)
+		return -1;
+
+	snprintf(path, sizeof(path), "%s/cur", param->filename);
+	rc = import_maildir_subdir(&bi, path, param);
+
+	if (rc == 0)
+	{
+		snprintf(path, sizeof(path), "%s/new", param->filename);
+		rc = import_maildir_subdir(&bi, path, param);
+	}
+
+	if (rc == 0)
+		rc = batch_end(&bi);
+
+	return rc;
+}
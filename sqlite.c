@@ -0,0 +1,236 @@
+/*-------------------------------------------------------------------------
+ *
+ * sqlite.c
+ *	  import of documents from SQLite database
+ *
+ * Every row of the query is one document. The first column of the query
+ * is the document (blob or text), the values of other columns are passed
+ * as additional parameters. The rows are read by one statement, so only
+ * one document is held in memory.
+ *
+ * Large blobs can be read by incremental blob I/O. Then the first column
+ * of the query is the rowid of the table with blob column, and the blob
+ * is read to reused buffer, so SQLite doesn't materialize the blob in the
+ * result row.
+ *
+ * IDENTIFICATION
+ *   sqlite.c
+ *
+ *-------------------------------------------------------------------------
+ */
+#include "postgres_fe.h"
+
+#include "pgimportdoc.h"
+
+#ifdef USE_SQLITE
+
+#include <sqlite3.h>
+
+/* the document and additional parameters (like values of headers) */
+#define MAX_SQLITE_COLUMNS		(MAX_HEADERS + 1)
+
+/*
+ * Read the document of current row by incremental blob I/O. The blob
+ * handle is opened for first row, and moved to other rows.
+ */
+static int
+read_blob(sqlite3 *db, sqlite3_blob **blob, const char *table,
+		  const char *column, sqlite3_int64 rowid, PQExpBuffer doc,
+		  const struct _param * param)
+{
+	int			len;
+	int			rc;
+
+	if (*blob == NULL)
+		rc = sqlite3_blob_open(db, "main", table, column, rowid, 0, blob);
+	else
+		rc = sqlite3_blob_reopen(*blob, rowid);
+
+	if (rc != SQLITE_OK)
+	{
+		fprintf(stderr, "%s: Cannot open blob %s.%s of row %lld: %s\n",
+				param->progname, table, column, (long long) rowid,
+				sqlite3_errmsg(db));
+		return -1;
+	}
+
+	len = sqlite3_blob_bytes(*blob);
+
+	resetPQExpBuffer(doc);
+	if (!enlargePQExpBuffer(doc, len + 1))
+	{
+		fprintf(stderr, "%s: Out of memory\n", param->progname);
+		return -1;
+	}
+
+	rc = sqlite3_blob_read(*blob, doc->data, len, 0);
+	if (rc != SQLITE_OK)
+	{
+		fprintf(stderr, "%s: Cannot read blob %s.%s of row %lld: %s\n",
+				param->progname, table, column, (long long) rowid,
+				sqlite3_errmsg(db));
+		return -1;
+	}
+
+	/* text documents are passed as zero terminated strings */
+	doc->len = len;
+	doc->data[len] = '\0';
+
+	return 0;
+}
+
+/*
+ * Import documents returned by query from SQLite database
+ */
+int
+import_sqlite(PGconn *conn, const struct _param * param)
+{
+	BatchImporter bi;
+	sqlite3    *db = NULL;
+	sqlite3_stmt *stmt = NULL;
+	sqlite3_blob *blob = NULL;
+	PQExpBufferData doc;
+	char	   *table = NULL;
+	char	   *column = NULL;
+	int64		nrows = 0;
+	int			ncolumns;
+	int			step;
+	int			rc = 0;
+
+	if (sqlite3_open_v2(param->filename, &db, SQLITE_OPEN_READONLY, NULL) != SQLITE_OK)
+	{
+		fprintf(stderr, "%s: Cannot open SQLite database '%s': %s\n",
+				param->progname, param->filename,
+				db ? sqlite3_errmsg(db) : "out of memory");
+		sqlite3_close(db);
+		return -1;
+	}
+
+	if (sqlite3_prepare_v2(db, param->sqlite_query, -1, &stmt, NULL) != SQLITE_OK)
+	{
+		fprintf(stderr, "%s: Cannot prepare SQLite query: %s\n",
+				param->progname, sqlite3_errmsg(db));
+		sqlite3_close(db);
+		return -1;
+	}
+
+	ncolumns = sqlite3_column_count(stmt);
+	if (ncolumns < 1 || ncolumns > MAX_SQLITE_COLUMNS)
+	{
+		fprintf(stderr, "%s: SQLite query should return from 1 to %d columns\n",
+				param->progname, MAX_SQLITE_COLUMNS);
+		sqlite3_finalize(stmt);
+		sqlite3_close(db);
+		return -1;
+	}
+
+	/* the blob is specified as TABLE.COLUMN */
+	if (param->sqlite_blob != NULL)
+	{
+		table = pg_strdup(param->sqlite_blob);
+		column = strchr(table, '.');
+		*column++ = '\0';
+	}
+
+	if (batch_begin(&bi, conn, param, ncolumns) != 0)
+	{
+		if (table)
+			pg_free(table);
+		sqlite3_finalize(stmt);
+		sqlite3_close(db);
+		return -1;
+	}
+
+	initPQExpBuffer(&doc);
+
+	while ((step = sqlite3_step(stmt)) == SQLITE_ROW)
+	{
+		const char *values[MAX_SQLITE_COLUMNS];
+		const char *data;
+		size_t		len;
+		int			i;
+
+		nrows += 1;
+
+		if (sqlite3_column_type(stmt, 0) == SQLITE_NULL)
+		{
+			fprintf(stderr, "%s: document of row " INT64_FORMAT " is NULL\n",
+					param->progname, nrows);
+			rc = -1;
+			break;
+		}
+
+		if (table)
+		{
+			if (read_blob(db, &blob, table, column,
+						  sqlite3_column_int64(stmt, 0), &doc, param) != 0)
+			{
+				rc = -1;
+				break;
+			}
+
+			data = doc.data;
+			len = doc.len;
+		}
+		else
+		{
+			/* the text is zero terminated */
+			if (param->fmt == FORMAT_BYTEA)
+				data = sqlite3_column_blob(stmt, 0);
+			else
+				data = (const char *) sqlite3_column_text(stmt, 0);
+
+			len = sqlite3_column_bytes(stmt, 0);
+
+			if (!data)
+				data = "";
+		}
+
+		for (i = 1; i < ncolumns; i++)
+		{
+			if (sqlite3_column_type(stmt, i) == SQLITE_NULL)
+				values[i - 1] = NULL;
+			else
+				values[i - 1] = (const char *) sqlite3_column_text(stmt, i);
+		}
+
+		if ((rc = batch_add(&bi, data, len, values)) != 0)
+			break;
+	}
+
+	if (rc == 0 && step != SQLITE_DONE)
+	{
+		fprintf(stderr, "%s: Cannot read result of SQLite query: %s\n",
+				param->progname, sqlite3_errmsg(db));
+		rc = -1;
+	}
+
+	termPQExpBuffer(&doc);
+	if (table)
+		pg_free(table);
+
+	if (blob)
+		sqlite3_blob_close(blob);
+	sqlite3_finalize(stmt);
+	sqlite3_close(db);
+
+	if (rc == 0)
+		rc = batch_end(&bi);
+
+	if (rc == 0 && param->verbose)
+		fprintf(stdout, "Read " INT64_FORMAT " rows from SQLite database\n", nrows);
+
+	return rc;
+}
+
+#else
+
+int
+import_sqlite(PGconn *conn, const struct _param * param)
+{
+	fprintf(stderr, "%s: SQLite is not supported by this build\n",
+			param->progname);
+	return -1;
+}
+
+#endif
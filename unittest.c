@@ -0,0 +1,528 @@
+/*-------------------------------------------------------------------------
+ *
+ * unittest.c
+ *	  regression tests of pgimportdoc kernels
+ *
+ * Checks the functions, that don't need database connection, on small
+ * inputs - JSON Schema validation (valid and invalid documents for every
+ * supported keyword), canonical hashing (equivalent documents have same
+ * hash, different documents have different hash), and encoding kernels
+ * (every implementation supported by CPU gives same result as scalar
+ * implementation for random inputs of all short lengths, and for invalid
+ * character at every position). The failed cases are written to stderr,
+ * and the exit status is 1 when some case failed.
+ *
+ * IDENTIFICATION
+ *   unittest.c
+ *
+ *-------------------------------------------------------------------------
+ */
+#include "postgres_fe.h"
+
+#ifndef WIN32
+#include <unistd.h>
+#endif
+
+#include "pgimportdoc.h"
+
+typedef struct SchemaTest
+{
+	const char *schema;
+	const char *document;
+	bool		valid;
+} SchemaTest;
+
+/* consecutive cases with same schema are validated by one validator */
+static const SchemaTest schema_tests[] = {
+	/* type */
+	{"{\"type\": \"integer\"}", "5", true},
+	{"{\"type\": \"integer\"}", "5.5", false},
+	{"{\"type\": \"integer\"}", "\"5\"", false},
+	{"{\"type\": [\"string\", \"null\"]}", "null", true},
+	{"{\"type\": [\"string\", \"null\"]}", "1", false},
+
+	/* enum */
+	{"{\"enum\": [\"a\", 1, {\"x\": [1, 2]}]}", "{\"x\": [1, 2]}", true},
+	{"{\"enum\": [\"a\", 1, {\"x\": [1, 2]}]}", "{\"x\": [2, 1]}", false},
+	{"{\"enum\": [\"a\", 1, {\"x\": [1, 2]}]}", "\"b\"", false},
+
+	/* const, the order of members is ignored */
+	{"{\"const\": {\"a\": 1, \"b\": 2}}", "{\"b\": 2, \"a\": 1}", true},
+	{"{\"const\": {\"a\": 1, \"b\": 2}}", "{\"a\": 1}", false},
+
+	/* $ref */
+	{"{\"definitions\": {\"pos\": {\"minimum\": 0}},"
+	 " \"properties\": {\"a\": {\"$ref\": \"#/definitions/pos\"}}}", "{\"a\": 1}", true},
+	{"{\"definitions\": {\"pos\": {\"minimum\": 0}},"
+	 " \"properties\": {\"a\": {\"$ref\": \"#/definitions/pos\"}}}", "{\"a\": -1}", false},
+
+	/* allOf, anyOf, oneOf, not */
+	{"{\"allOf\": [{\"minimum\": 1}, {\"maximum\": 3}]}", "2", true},
+	{"{\"allOf\": [{\"minimum\": 1}, {\"maximum\": 3}]}", "4", false},
+	{"{\"anyOf\": [{\"type\": \"string\"}, {\"type\": \"null\"}]}", "null", true},
+	{"{\"anyOf\": [{\"type\": \"string\"}, {\"type\": \"null\"}]}", "1", false},
+	{"{\"oneOf\": [{\"multipleOf\": 2}, {\"multipleOf\": 3}]}", "4", true},
+	{"{\"oneOf\": [{\"multipleOf\": 2}, {\"multipleOf\": 3}]}", "6", false},
+	{"{\"oneOf\": [{\"multipleOf\": 2}, {\"multipleOf\": 3}]}", "5", false},
+	{"{\"not\": {\"type\": \"string\"}}", "1", true},
+	{"{\"not\": {\"type\": \"string\"}}", "\"x\"", false},
+
+	/* properties, additionalProperties, required */
+	{"{\"properties\": {\"a\": {\"type\": \"string\"}}}", "{\"a\": \"x\", \"b\": 1}", true},
+	{"{\"properties\": {\"a\": {\"type\": \"string\"}}}", "{\"a\": 1}", false},
+	{"{\"properties\": {\"a\": {}}, \"additionalProperties\": false}", "{\"a\": 1}", true},
+	{"{\"properties\": {\"a\": {}}, \"additionalProperties\": false}", "{\"a\": 1, \"b\": 2}", false},
+	{"{\"additionalProperties\": {\"type\": \"integer\"}}", "{\"a\": 1}", true},
+	{"{\"additionalProperties\": {\"type\": \"integer\"}}", "{\"a\": \"x\"}", false},
+	{"{\"required\": [\"a\", \"b\"]}", "{\"a\": 1, \"b\": null}", true},
+	{"{\"required\": [\"a\", \"b\"]}", "{\"a\": 1}", false},
+
+	/* minProperties, maxProperties */
+	{"{\"minProperties\": 1}", "{\"a\": 1}", true},
+	{"{\"minProperties\": 1}", "{}", false},
+	{"{\"maxProperties\": 1}", "{\"a\": 1}", true},
+	{"{\"maxProperties\": 1}", "{\"a\": 1, \"b\": 2}", false},
+
+	/* items (list and tuple validation) */
+	{"{\"items\": {\"type\": \"integer\"}}", "[1, 2]", true},
+	{"{\"items\": {\"type\": \"integer\"}}", "[1, \"x\"]", false},
+	{"{\"items\": [{\"type\": \"string\"}, {\"type\": \"integer\"}]}", "[\"a\", 1, null]", true},
+	{"{\"items\": [{\"type\": \"string\"}, {\"type\": \"integer\"}]}", "[1, \"a\"]", false},
+
+	/* minItems, maxItems, uniqueItems */
+	{"{\"minItems\": 2}", "[1, 2]", true},
+	{"{\"minItems\": 2}", "[1]", false},
+	{"{\"maxItems\": 1}", "[1]", true},
+	{"{\"maxItems\": 1}", "[1, 2]", false},
+	{"{\"uniqueItems\": true}", "[1, {\"a\": 1}, {\"a\": 2}]", true},
+	{"{\"uniqueItems\": true}", "[{\"a\": 1, \"b\": 2}, {\"b\": 2, \"a\": 1}]", false},
+
+	/* minLength, maxLength count characters (escaped surrogate pair is one) */
+	{"{\"minLength\": 2}", "\"ab\"", true},
+	{"{\"minLength\": 2}", "\"\xc3\xa9\"", false},
+	{"{\"minLength\": 2}", "\"\\uD83D\\uDE00\"", false},
+	{"{\"minLength\": 2}", "\"\\n\\u00e9\"", true},
+	{"{\"maxLength\": 1}", "\"\\uD83D\\uDE00\"", true},
+	{"{\"maxLength\": 1}", "\"\\ud83d\\ude00\"", true},
+	{"{\"maxLength\": 1}", "\"\\uD83D\\u00e9\"", false},
+	{"{\"maxLength\": 1}", "\"ab\"", false},
+
+	/* minimum, maximum (with draft 4 boolean exclusive limits) */
+	{"{\"minimum\": 1}", "1", true},
+	{"{\"minimum\": 1}", "0.5", false},
+	{"{\"minimum\": 1, \"exclusiveMinimum\": true}", "1", false},
+	{"{\"maximum\": 1}", "1", true},
+	{"{\"maximum\": 1}", "1.5", false},
+	{"{\"maximum\": 1, \"exclusiveMaximum\": true}", "1", false},
+
+	/* exclusiveMinimum, exclusiveMaximum, multipleOf */
+	{"{\"exclusiveMinimum\": 0}", "0.1", true},
+	{"{\"exclusiveMinimum\": 0}", "0", false},
+	{"{\"exclusiveMaximum\": 0}", "-0.1", true},
+	{"{\"exclusiveMaximum\": 0}", "0", false},
+	{"{\"multipleOf\": 0.1}", "0.3", true},
+	{"{\"multipleOf\": 0.1}", "0.35", false},
+
+	/* keywords of other types are ignored */
+	{"{\"minLength\": 3, \"minimum\": 5}", "[1]", true},
+
+	/* boolean schema */
+	{"true", "{\"a\": 1}", true},
+	{"false", "{\"a\": 1}", false},
+
+	/* document is not valid JSON */
+	{"{}", "{\"a\": 1,", false},
+	{"{}", "[1, 2", false},
+	{NULL}
+};
+
+typedef struct CanonTest
+{
+	CanonicalForm form;
+	const char *a;
+	const char *b;
+	bool		equal;			/* should be hashes equal */
+} CanonTest;
+
+static const CanonTest canon_tests[] = {
+	/* order and quoting of attributes */
+	{CANONICAL_XML, "<a y='1' x=\"2\"/>", "<a x=\"2\" y=\"1\"></a>", true},
+	{CANONICAL_XML, "<a q='\"'/>", "<a q=\"&quot;\"/>", true},
+	/* whitespaces between elements, line ends */
+	{CANONICAL_XML, "<a>\n  <b>t</b>\n  <c/>\n</a>", "<a><b>t</b><c/></a>", true},
+	{CANONICAL_XML, "<a>x\r\ny</a>", "<a>x\ny</a>", true},
+	/* XML declaration, DOCTYPE, comments */
+	{CANONICAL_XML, "<?xml version=\"1.0\"?>\n<!DOCTYPE a>\n<a><!-- c -->t</a>", "<a>t</a>", true},
+	/* CDATA section */
+	{CANONICAL_XML, "<a><![CDATA[x<y & z]]></a>", "<a>x&lt;y &amp; z</a>", true},
+	/* different documents */
+	{CANONICAL_XML, "<a>t</a>", "<a>u</a>", false},
+	{CANONICAL_XML, "<a>t u</a>", "<a>tu</a>", false},
+	{CANONICAL_XML, "<a x=\"1\"/>", "<a x=\"2\"/>", false},
+	{CANONICAL_XML, "<a x=\"1\"/>", "<a y=\"1\"/>", false},
+	{CANONICAL_XML, "<a><b/><c/></a>", "<a><c/><b/></a>", false},
+	{CANONICAL_XML, "<a><b/></a>", "<a><B/></a>", false},
+
+	/* order of keys, whitespaces */
+	{CANONICAL_JSON, "{\"b\": 1, \"a\": 2}", "{\"a\":2,\"b\":1}", true},
+	{CANONICAL_JSON, "{\"a\": {\"z\": 1, \"y\": [1, {\"q\": 1, \"p\": 2}]}}",
+	 "\n{ \"a\" : { \"y\" : [ 1 , { \"p\" : 2 , \"q\" : 1 } ] , \"z\" : 1 } }\n", true},
+	{CANONICAL_JSON, "[ ]", "[]", true},
+	/* different documents (strings and numbers are not normalized) */
+	{CANONICAL_JSON, "{\"a\": 1}", "{\"a\": 2}", false},
+	{CANONICAL_JSON, "{\"a\": 1}", "{\"b\": 1}", false},
+	{CANONICAL_JSON, "[1, 2]", "[2, 1]", false},
+	{CANONICAL_JSON, "{\"a\": \"x y\"}", "{\"a\": \"xy\"}", false},
+	{CANONICAL_JSON, "{\"a\": 1}", "{\"a\": 1.0}", false},
+	{CANONICAL_JSON, "{\"a\": [1]}", "{\"a\": 1}", false},
+	{0}
+};
+
+/* the kernels are checked for every length to this, and for long_lengths */
+#define KERNEL_MAX_LEN		130
+#define KERNEL_TRIALS		4
+#define KERNEL_BUFSIZE		4096
+
+/* lengths around multiples of vector sizes */
+static const size_t long_lengths[] = {255, 256, 257, 511, 512, 513, 1031};
+
+typedef enum KernelFunc
+{
+	KERNEL_ESCAPE_TEXT,
+	KERNEL_HEX_ENCODE,
+	KERNEL_HEX_DECODE,
+	KERNEL_BASE64_DECODE,
+	NUM_KERNEL_FUNCS
+} KernelFunc;
+
+static const char *kernel_func_names[] = {
+	"escape_text", "hex_encode", "hex_decode", "base64_decode"
+};
+
+static const char hex_chars[] = "0123456789abcdefABCDEF";
+static const char b64_chars[] =
+"ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/-_";
+
+/* characters that stop block decoders (invalid, whitespaces, padding) */
+static const char hex_invalid[] = "gG:/@`x \n\r\t\x80\xff";
+static const char b64_invalid[] = "=*.@[` \n\r\t\x80\xff";
+
+static const char *progname;
+static int	ntests = 0;
+static int	nfailed = 0;
+
+#ifndef WIN32
+
+/*
+ * Load schema from unlinked temporary file
+ */
+static int
+load_schema(struct _param *param, const char *schema)
+{
+	const char *tmpdir = getenv("TMPDIR");
+	char		path[MAXPGPATH];
+	int			fd;
+	int			rc;
+
+	snprintf(path, sizeof(path), "%s/pgimportdoc_unittest_XXXXXX", tmpdir ? tmpdir : "/tmp");
+
+	fd = mkstemp(path);
+	if (fd < 0 || write(fd, schema, strlen(schema)) != (ssize_t) strlen(schema))
+	{
+		fprintf(stderr, "%s: Cannot write temporary file '%s': %s\n",
+				progname, path, strerror(errno));
+		exit(1);
+	}
+
+	close(fd);
+
+	param->progname = progname;
+	param->schema = path;
+	rc = schema_load(param);
+	param->schema = NULL;
+
+	unlink(path);
+
+	return rc;
+}
+
+static void
+test_schema(void)
+{
+	struct _param param;
+	SchemaValidator *sv = NULL;
+	const SchemaTest *t;
+
+	memset(&param, 0, sizeof(param));
+
+	for (t = schema_tests; t->schema; t++)
+	{
+		const char *error;
+		int			rc;
+
+		if (t == schema_tests || strcmp(t->schema, t[-1].schema) != 0)
+		{
+			if (sv)
+			{
+				schema_validator_free(sv);
+				schema_unload();
+			}
+
+			if (load_schema(&param, t->schema) != 0)
+				exit(1);
+
+			sv = schema_validator_create(&param);
+			if (!sv)
+				exit(1);
+		}
+
+		rc = schema_validate(sv, t->document, strlen(t->document), &error);
+
+		ntests++;
+		if (rc != (t->valid ? 1 : 0))
+		{
+			fprintf(stderr, "FAIL schema %s: document %s should be %s (%s)\n",
+					t->schema, t->document, t->valid ? "valid" : "invalid",
+					rc == 1 ? "valid" : error);
+			nfailed++;
+		}
+	}
+
+	if (sv)
+	{
+		schema_validator_free(sv);
+		schema_unload();
+	}
+}
+
+#endif
+
+static void
+test_canon(void)
+{
+	struct _param param;
+	Canonicalizer *cn[CANONICAL_JSON + 1] = {NULL};
+	const CanonTest *t;
+	int			i;
+
+	memset(&param, 0, sizeof(param));
+	param.progname = progname;
+
+	for (t = canon_tests; t->a; t++)
+	{
+		char		hash_a[CANONICAL_HASH_LEN + 1];
+		char		hash_b[CANONICAL_HASH_LEN + 1];
+
+		if (!cn[t->form])
+		{
+			param.canonical_hash = t->form;
+			cn[t->form] = canon_create(&param);
+		}
+
+		if (canon_hash(cn[t->form], t->a, strlen(t->a), hash_a) != 0 ||
+			canon_hash(cn[t->form], t->b, strlen(t->b), hash_b) != 0)
+			exit(1);
+
+		ntests++;
+		if ((strcmp(hash_a, hash_b) == 0) != t->equal)
+		{
+			fprintf(stderr, "FAIL canon %s: hash of %s and %s should be %s\n",
+					t->form == CANONICAL_XML ? "xml" : "json", t->a, t->b,
+					t->equal ? "equal" : "different");
+			nfailed++;
+		}
+	}
+
+	for (i = 0; i <= CANONICAL_JSON; i++)
+		if (cn[i])
+			canon_free(cn[i]);
+}
+
+/* deterministic generator of inputs */
+static uint64 rng_state = UINT64CONST(0x9E3779B97F4A7C15);
+
+static uint64
+rng_next(void)
+{
+	rng_state ^= rng_state << 13;
+	rng_state ^= rng_state >> 7;
+	rng_state ^= rng_state << 17;
+
+	return rng_state;
+}
+
+static size_t
+call_kernel(const EncodeKernels *k, KernelFunc func, char *dst,
+			const char *src, size_t len)
+{
+	switch (func)
+	{
+		case KERNEL_ESCAPE_TEXT:
+			return k->escape_text(dst, src, len);
+		case KERNEL_HEX_ENCODE:
+			return k->hex_encode(dst, src, len);
+		case KERNEL_HEX_DECODE:
+			return k->hex_decode(dst, src, len);
+		case KERNEL_BASE64_DECODE:
+			return k->base64_decode(dst, src, len);
+		default:
+			return 0;
+	}
+}
+
+/*
+ * Generate input of kernel. Text contains escaped characters, input of
+ * decoders contains valid characters only.
+ */
+static void
+generate_kernel_input(KernelFunc func, char *buf, size_t len)
+{
+	size_t		i;
+
+	for (i = 0; i < len; i++)
+	{
+		uint64		r = rng_next();
+
+		switch (func)
+		{
+			case KERNEL_ESCAPE_TEXT:
+				buf[i] = r % 8 == 0 ? "\\\n\r\t"[(r >> 8) % 4] : (char) (r >> 16);
+				break;
+			case KERNEL_HEX_ENCODE:
+				buf[i] = (char) (r >> 16);
+				break;
+			case KERNEL_HEX_DECODE:
+				buf[i] = hex_chars[r % (sizeof(hex_chars) - 1)];
+				break;
+			case KERNEL_BASE64_DECODE:
+				buf[i] = b64_chars[r % (sizeof(b64_chars) - 1)];
+				break;
+			default:
+				break;
+		}
+	}
+}
+
+/*
+ * Compare result of implementation with scalar implementation. The bytes
+ * after max size of result (2 * len for encoding, len for decoding) should
+ * not be changed.
+ */
+static void
+compare_kernel(const EncodeKernels *k, KernelFunc func, const char *src,
+			   size_t len, int invalid_pos)
+{
+	static char expected[KERNEL_BUFSIZE];
+	static char actual[KERNEL_BUFSIZE];
+	size_t		expected_len;
+	size_t		actual_len;
+	size_t		outlen;
+	size_t		maxlen;
+	size_t		i;
+	bool		ok;
+
+	memset(expected, 0x5a, sizeof(expected));
+	memset(actual, 0x5a, sizeof(actual));
+
+	expected_len = call_kernel(&encode_kernels_scalar, func, expected, src, len);
+	actual_len = call_kernel(k, func, actual, src, len);
+
+	/* decoders return number of processed input characters */
+	if (func == KERNEL_HEX_DECODE)
+		outlen = expected_len / 2;
+	else if (func == KERNEL_BASE64_DECODE)
+		outlen = expected_len / 8 * 6;
+	else
+		outlen = expected_len;
+
+	maxlen = func == KERNEL_ESCAPE_TEXT || func == KERNEL_HEX_ENCODE ? 2 * len : len;
+
+	ok = expected_len == actual_len && memcmp(expected, actual, outlen) == 0;
+	for (i = maxlen; ok && i < sizeof(actual); i++)
+		ok = actual[i] == 0x5a;
+
+	ntests++;
+	if (!ok)
+	{
+		if (invalid_pos >= 0)
+			fprintf(stderr, "FAIL kernel %s %s: length %zu, invalid character at %d\n",
+					k->name, kernel_func_names[func], len, invalid_pos);
+		else
+			fprintf(stderr, "FAIL kernel %s %s: length %zu\n",
+					k->name, kernel_func_names[func], len);
+		nfailed++;
+	}
+}
+
+static void
+test_kernels(void)
+{
+	const EncodeKernels *const *impls;
+	DecodeState state;
+	char		src[KERNEL_BUFSIZE / 2];
+	int			i;
+
+	/* the decode tables are initialized lazily */
+	decode_init(&state, INPUT_ENCODING_BASE64);
+
+	impls = encode_supported_kernels();
+
+	for (i = 0; impls[i]; i++)
+	{
+		int			func;
+
+		if (impls[i] == &encode_kernels_scalar)
+			continue;
+
+		for (func = 0; func < NUM_KERNEL_FUNCS; func++)
+		{
+			int			l;
+
+			for (l = 0; l <= KERNEL_MAX_LEN + (int) lengthof(long_lengths); l++)
+			{
+				size_t		len = l <= KERNEL_MAX_LEN ? l : long_lengths[l - KERNEL_MAX_LEN - 1];
+				const char *invalid;
+				int			trial;
+				int			pos;
+
+				for (trial = 0; trial < KERNEL_TRIALS; trial++)
+				{
+					generate_kernel_input(func, src, len);
+					compare_kernel(impls[i], func, src, len, -1);
+				}
+
+				if (func == KERNEL_HEX_DECODE)
+					invalid = hex_invalid;
+				else if (func == KERNEL_BASE64_DECODE)
+					invalid = b64_invalid;
+				else
+					continue;
+
+				/* the valid prefix should be decoded by every implementation */
+				for (pos = 0; pos < (int) len; pos++)
+				{
+					generate_kernel_input(func, src, len);
+					src[pos] = invalid[pos % strlen(invalid)];
+					compare_kernel(impls[i], func, src, len, pos);
+				}
+			}
+		}
+	}
+}
+
+int
+main(int argc, char **argv)
+{
+	progname = get_progname(argv[0]);
+
+#ifndef WIN32
+	test_schema();
+#endif
+
+	test_canon();
+	test_kernels();
+
+	printf("%d tests, %d failed\n", ntests, nfailed);
+
+	return nfailed > 0 ? 1 : 0;
+}
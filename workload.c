@@ -0,0 +1,331 @@
+/*-------------------------------------------------------------------------
+ *
+ * workload.c
+ *	  capture of workload profile and its replay
+ *
+ * The profile holds the type and the command, and for every document
+ * its arrival time and size. The content of documents is not stored.
+ * The replay generates synthetic documents of the same type and size,
+ * and imports them with the same timing.
+ *
+ * The profile is text file:
+ *
+ *   format XML|TEXT|BYTEA
+ *   mode single|copy|mbox|maildir|fifo
+ *   nparams N
+ *   command COMMAND
+ *   doc MICROSECONDS SIZE
+ *   ...
+ *
+ * IDENTIFICATION
+ *   workload.c
+ *
+ *-------------------------------------------------------------------------
+ */
+#include "postgres_fe.h"
+
+#include <pthread.h>
+
+#include "portability/instr_time.h"
+
+#include "pgimportdoc.h"
+
+static FILE *record_file = NULL;
+static instr_time record_start;
+static pthread_mutex_t record_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static const char *format_names[] = {"XML", "TEXT", "BYTEA"};
+
+/*
+ * Start capture of workload profile to file
+ */
+int
+workload_record_open(const char *filename, const char *mode,
+					 const struct _param * param)
+{
+	const char *ptr;
+
+	record_file = fopen(filename, "w");
+	if (!record_file)
+	{
+		fprintf(stderr, "%s: Unable to open '%s': %s\n",
+				param->progname, filename, strerror(errno));
+		return -1;
+	}
+
+	fprintf(record_file, "format %s\n", format_names[param->fmt]);
+	fprintf(record_file, "mode %s\n", mode);
+	fprintf(record_file, "nparams %d\n", 1 + param->nheaders);
+
+	/* command is stored on one line */
+	fputs("command ", record_file);
+	for (ptr = param->command; *ptr; ptr++)
+		fputc(*ptr == '\n' || *ptr == '\r' ? ' ' : *ptr, record_file);
+	fputc('\n', record_file);
+
+	INSTR_TIME_SET_CURRENT(record_start);
+
+	return 0;
+}
+
+/*
+ * Store arrival time and size of document. It can be called from more
+ * threads.
+ */
+void
+workload_record(int64 size)
+{
+	instr_time	now;
+
+	if (!record_file)
+		return;
+
+	INSTR_TIME_SET_CURRENT(now);
+	INSTR_TIME_SUBTRACT(now, record_start);
+
+	pthread_mutex_lock(&record_mutex);
+	fprintf(record_file, "doc " UINT64_FORMAT " " INT64_FORMAT "\n",
+			(uint64) INSTR_TIME_GET_MICROSEC(now), size);
+	pthread_mutex_unlock(&record_mutex);
+}
+
+int
+workload_record_close(const struct _param * param)
+{
+	int			rc = 0;
+
+	if (!record_file)
+		return 0;
+
+	if (ferror(record_file) || fclose(record_file) != 0)
+	{
+		fprintf(stderr, "%s: Cannot write workload profile: %s\n",
+				param->progname, strerror(errno));
+		rc = -1;
+	}
+
+	record_file = NULL;
+
+	return rc;
+}
+
+/*
+ * Fill buffer by synthetic document of requested size. The text
+ * document is JSON string, so it can be casted to json too.
+ */
+static void
+generate_document(PQExpBuffer buf, enum format fmt, size_t size)
+{
+	size_t		i;
+
+	resetPQExpBuffer(buf);
+
+	if (!enlargePQExpBuffer(buf, size))
+		return;
+
+	if (fmt == FORMAT_BYTEA)
+	{
+		for (i = 0; i < size; i++)
+			buf->data[i] = (char) (random() & 0xff);
+	}
+	else if (fmt == FORMAT_XML && size >= 7)
+	{
+		memcpy(buf->data, "<d>", 3);
+		memset(buf->data + 3, 'a', size - 7);
+		memcpy(buf->data + size - 4, "</d>", 4);
+	}
+	else if (fmt == FORMAT_XML)
+	{
+		/* too short document is still valid */
+		memcpy(buf->data, "<d/>", 4);
+		size = 4;
+	}
+	else if (size >= 2)
+	{
+		buf->data[0] = '"';
+		memset(buf->data + 1, 'a', size - 2);
+		buf->data[size - 1] = '"';
+	}
+	else
+		memset(buf->data, 'a', size);
+
+	buf->len = size;
+	buf->data[size] = '\0';
+}
+
+/*
+ * Import synthetic documents described by workload profile
+ */
+int
+import_replay(const char *database, const struct _param * param)
+{
+	struct _param rparam = *param;
+	BatchImporter bi;
+	PQExpBufferData line;
+	PQExpBufferData doc;
+	PGconn	   *conn;
+	FILE	   *input;
+	char		buffer[BUFSIZ];
+	char		mode[32] = "single";
+	char	   *command = NULL;
+	int			nparams = 1;
+	const char *nullparams[MAX_HEADERS] = {NULL};
+	instr_time	start;
+	int64		ndocs = 0;
+	int			rc = 0;
+
+	input = fopen(param->replay, "r");
+	if (!input)
+	{
+		fprintf(stderr, "%s: Unable to open '%s': %s\n",
+				param->progname, param->replay, strerror(errno));
+		return -1;
+	}
+
+	initPQExpBuffer(&line);
+	initPQExpBuffer(&doc);
+
+	/* read header of profile */
+	while (fgets(buffer, sizeof(buffer), input) != NULL)
+	{
+		char		value[32];
+
+		resetPQExpBuffer(&line);
+		appendPQExpBufferStr(&line, buffer);
+
+		/* command can be longer than buffer */
+		while (line.len > 0 && line.data[line.len - 1] != '\n' &&
+			   fgets(buffer, sizeof(buffer), input) != NULL)
+			appendPQExpBufferStr(&line, buffer);
+
+		if (line.len > 0 && line.data[line.len - 1] == '\n')
+			line.data[--line.len] = '\0';
+
+		if (strncmp(line.data, "doc ", 4) == 0)
+			break;
+		else if (sscanf(line.data, "format %31s", value) == 1)
+		{
+			if (strcmp(value, "XML") == 0)
+				rparam.fmt = FORMAT_XML;
+			else if (strcmp(value, "BYTEA") == 0)
+				rparam.fmt = FORMAT_BYTEA;
+			else
+				rparam.fmt = FORMAT_TEXT;
+		}
+		else if (sscanf(line.data, "mode %31s", value) == 1)
+			strlcpy(mode, value, sizeof(mode));
+		else if (sscanf(line.data, "nparams %d", &nparams) == 1)
+		{
+			if (nparams < 1 || nparams > MAX_HEADERS + 1)
+			{
+				fprintf(stderr, "%s: invalid workload profile '%s'\n",
+						param->progname, param->replay);
+				rc = -1;
+				break;
+			}
+		}
+		else if (strncmp(line.data, "command ", 8) == 0)
+			command = pg_strdup(line.data + 8);
+	}
+
+	/* command from command line has higher priority */
+	if (!param->command)
+		rparam.command = command;
+
+	if (rc == 0 && !rparam.command)
+	{
+		fprintf(stderr, "%s: workload profile '%s' has not command\n",
+				param->progname, param->replay);
+		rc = -1;
+	}
+
+	/* without splitting every document was imported in own transaction */
+	if (strcmp(mode, "single") == 0 || strcmp(mode, "copy") == 0)
+		rparam.batch_size = 1;
+
+	if (rc == 0 && param->verbose)
+		fprintf(stdout, "Replay %s workload\n", mode);
+
+	conn = rc == 0 ? connect_database(database, &rparam) : NULL;
+	if (!conn)
+		rc = -1;
+
+	if (rc == 0 && batch_begin(&bi, conn, &rparam, nparams) != 0)
+		rc = -1;
+
+	INSTR_TIME_SET_CURRENT(start);
+
+	while (rc == 0 && strncmp(line.data, "doc ", 4) == 0)
+	{
+		uint64		usec;
+		int64		size;
+		instr_time	now;
+
+		if (sscanf(line.data, "doc " UINT64_FORMAT " " INT64_FORMAT,
+				   &usec, &size) != 2 || size < 0)
+		{
+			fprintf(stderr, "%s: invalid workload profile '%s'\n",
+					param->progname, param->replay);
+			rc = -1;
+			break;
+		}
+
+		/* wait to arrival time of document */
+		INSTR_TIME_SET_CURRENT(now);
+		INSTR_TIME_SUBTRACT(now, start);
+		if ((uint64) INSTR_TIME_GET_MICROSEC(now) < usec)
+		{
+			/* the waiting documents should be committed before sleep */
+			if (batch_flush(&bi) != 0)
+			{
+				rc = -1;
+				break;
+			}
+
+			INSTR_TIME_SET_CURRENT(now);
+			INSTR_TIME_SUBTRACT(now, start);
+			if ((uint64) INSTR_TIME_GET_MICROSEC(now) < usec)
+				pg_usleep((long) (usec - INSTR_TIME_GET_MICROSEC(now)));
+		}
+
+		generate_document(&doc, rparam.fmt, size);
+		if (PQExpBufferBroken(&doc))
+		{
+			fprintf(stderr, "%s: Out of memory\n", param->progname);
+			rc = -1;
+			break;
+		}
+
+		if (batch_add(&bi, doc.data, doc.len, nullparams) != 0)
+		{
+			rc = -1;
+			break;
+		}
+
+		ndocs += 1;
+
+		if (fgets(buffer, sizeof(buffer), input) == NULL)
+			break;
+
+		resetPQExpBuffer(&line);
+		appendPQExpBufferStr(&line, buffer);
+	}
+
+	if (rc == 0)
+		rc = batch_end(&bi);
+
+	if (rc == 0 && param->verbose)
+		fprintf(stdout, "Replayed " INT64_FORMAT " documents\n", ndocs);
+
+	if (conn)
+		PQfinish(conn);
+
+	fclose(input);
+	termPQExpBuffer(&line);
+	termPQExpBuffer(&doc);
+
+	if (command)
+		pg_free(command);
+
+	return rc;
+}